@@ -5,20 +5,35 @@ import time
 import json
 import requests
 import logging
+import struct
 import psycopg2
+from psycopg2.extras import execute_values, Json
+from concurrent.futures import ThreadPoolExecutor
 from datetime import datetime, timedelta
 from typing import Dict, List, Any, Optional
 import asyncio
 import aiohttp
+from aiohttp import web
 import signal
 import sys
 
+# Cabecera de lote del formato binario de los ESP32 (audimeter_wire.h)
+AUDIMETER_WIRE_CONTENT_TYPE = 'application/x-audimeter-fp'
+AUDIMETER_WIRE_MAGIC = 0x46444D41
+AUDIMETER_BATCH_HEADER = struct.Struct('<IBBH24s')
+
 class AudienceExtractor:
     def __init__(self):
         self.setup_logging()
         self.load_config()
         self.setup_database()
         self.running = True
+        self.http: Optional[aiohttp.ClientSession] = None
+        self.pending_fingerprints: List[tuple] = []
+        
+        # Un único hilo para psycopg2: la conexión no admite uso concurrente
+        # y así el bucle de eventos no se bloquea mientras se escribe
+        self.db_executor = ThreadPoolExecutor(max_workers=1)
         
         # Configurar manejador de señales para parada limpia
         signal.signal(signal.SIGINT, self.signal_handler)
@@ -46,6 +61,12 @@ class AudienceExtractor:
             'remote_endpoint': os.getenv('REMOTE_ENDPOINT'),
             'remote_api_key': os.getenv('REMOTE_API_KEY'),
             'poll_interval': int(os.getenv('POLL_INTERVAL', 10)),
+            'host_concurrency': int(os.getenv('HOST_CONCURRENCY', 16)),
+            'http_pool_size': int(os.getenv('HTTP_POOL_SIZE', 32)),
+            'db_batch_size': int(os.getenv('DB_BATCH_SIZE', 1000)),
+            'fingerprint_port': int(os.getenv('FINGERPRINT_PORT', 8090)),
+            'fingerprint_endpoint': os.getenv('FINGERPRINT_ENDPOINT'),
+            'fingerprint_concurrency': int(os.getenv('FINGERPRINT_CONCURRENCY', 8)),
             'db_config': {
                 'host': os.getenv('DB_HOST', 'localhost'),
                 'port': int(os.getenv('DB_PORT', 5432)),
@@ -56,6 +77,10 @@ class AudienceExtractor:
         }
         
         self.ntopng_base_url = f"http://{self.config['ntopng_host']}:{self.config['ntopng_port']}"
+        self.ntopng_auth = aiohttp.BasicAuth(
+            self.config['ntopng_user'], 
+            self.config['ntopng_password']
+        )
         self.logger.info("Configuración cargada correctamente")
     
     def setup_database(self):
@@ -111,72 +136,98 @@ class AudienceExtractor:
                 CREATE INDEX IF NOT EXISTS idx_app_timestamp ON application_summary(timestamp);
                 CREATE INDEX IF NOT EXISTS idx_app_name ON application_summary(application);
             """)
+            
+            # Lotes de fingerprints recibidos de los ESP32 del hogar
+            cursor.execute("""
+                CREATE TABLE IF NOT EXISTS audio_fingerprints (
+                    id BIGSERIAL PRIMARY KEY,
+                    received_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
+                    device_id VARCHAR(32),
+                    device_ip VARCHAR(45),
+                    content_type VARCHAR(64),
+                    record_count INTEGER,
+                    payload BYTEA,
+                    upstream_status INTEGER,
+                    match_results JSONB
+                );
+                
+                CREATE INDEX IF NOT EXISTS idx_fp_received ON audio_fingerprints(received_at);
+                CREATE INDEX IF NOT EXISTS idx_fp_device ON audio_fingerprints(device_id);
+            """)
     
-    async def get_ntopng_data(self, endpoint: str) -> Optional[Dict]:
-        """Obtener datos de la API de ntopng"""
+    async def db_call(self, func, *args):
+        """Ejecutar una operación de base de datos en su hilo"""
+        loop = asyncio.get_running_loop()
+        return await loop.run_in_executor(self.db_executor, func, *args)
+    
+    async def get_ntopng_data(self, endpoint: str, params: Optional[Dict] = None) -> Optional[Dict]:
+        """Obtener datos de la API de ntopng con la sesión compartida"""
         url = f"{self.ntopng_base_url}/lua/rest/{endpoint}"
         
         try:
-            auth = aiohttp.BasicAuth(
-                self.config['ntopng_user'], 
-                self.config['ntopng_password']
-            )
-            
-            async with aiohttp.ClientSession(auth=auth) as session:
-                async with session.get(url, timeout=30) as response:
-                    if response.status == 200:
-                        return await response.json()
-                    else:
-                        self.logger.warning(f"Error HTTP {response.status} en {endpoint}")
-                        return None
+            async with self.http.get(url, params=params, auth=self.ntopng_auth,
+                                     timeout=30) as response:
+                if response.status == 200:
+                    # ntopng no siempre declara application/json
+                    return await response.json(content_type=None)
+                else:
+                    self.logger.warning(f"Error HTTP {response.status} en {endpoint}")
+                    return None
         except Exception as e:
             self.logger.error(f"Error obteniendo datos de {endpoint}: {e}")
             return None
     
+    async def extract_host(self, host_key: str, semaphore: asyncio.Semaphore) -> List[Dict]:
+        """Extraer las aplicaciones de un host"""
+        async with semaphore:
+            host_details = await self.get_ntopng_data("get/host/data.json", {'host': host_key})
+        
+        entries = []
+        if host_details and 'rsp' in host_details:
+            host_data = host_details['rsp']
+            
+            # Extraer aplicaciones del host
+            for app_name, app_data in host_data.get('applications', {}).items():
+                entries.append({
+                    'host_ip': host_key,
+                    'application': app_name,
+                    'category': app_data.get('category', 'Unknown'),
+                    'bytes_sent': app_data.get('bytes.sent', 0),
+                    'bytes_received': app_data.get('bytes.rcvd', 0),
+                    'packets_sent': app_data.get('packets.sent', 0),
+                    'packets_received': app_data.get('packets.rcvd', 0),
+                    'duration': app_data.get('duration', 0),
+                    'flow_info': app_data
+                })
+        return entries
+    
     async def extract_traffic_data(self) -> List[Dict]:
         """Extraer datos de tráfico de ntopng"""
         traffic_data = []
         
-        # Obtener hosts activos
-        hosts_data = await self.get_ntopng_data("get/host/active.json")
+        # Hosts, flows y aplicaciones activos en paralelo
+        hosts_data, flows_data, apps_data = await asyncio.gather(
+            self.get_ntopng_data("get/host/active.json"),
+            self.get_ntopng_data("get/flow/active.json"),
+            self.get_ntopng_data("get/application/data.json")
+        )
         if not hosts_data:
             return traffic_data
         
-        # Obtener flows activos
-        flows_data = await self.get_ntopng_data("get/flow/active.json")
-        
-        # Obtener aplicaciones
-        apps_data = await self.get_ntopng_data("get/application/data.json")
-        
-        # Procesar datos de hosts
-        for host_key, host_info in hosts_data.get('rsp', {}).items():
-            try:
-                # Obtener detalles específicos del host
-                host_details = await self.get_ntopng_data(f"get/host/data.json?host={host_key}")
-                
-                if host_details and 'rsp' in host_details:
-                    host_data = host_details['rsp']
-                    
-                    # Extraer aplicaciones del host
-                    for app_name, app_data in host_data.get('applications', {}).items():
-                        traffic_entry = {
-                            'host_ip': host_key,
-                            'application': app_name,
-                            'category': app_data.get('category', 'Unknown'),
-                            'bytes_sent': app_data.get('bytes.sent', 0),
-                            'bytes_received': app_data.get('bytes.rcvd', 0),
-                            'packets_sent': app_data.get('packets.sent', 0),
-                            'packets_received': app_data.get('packets.rcvd', 0),
-                            'duration': app_data.get('duration', 0),
-                            'flow_info': app_data
-                        }
-                        traffic_data.append(traffic_entry)
-                        
-            except Exception as e:
-                self.logger.error(f"Error procesando host {host_key}: {e}")
+        # Detalles de cada host, como mucho host_concurrency a la vez
+        semaphore = asyncio.Semaphore(self.config['host_concurrency'])
+        host_keys = list(hosts_data.get('rsp', {}).keys())
+        results = await asyncio.gather(
+            *(self.extract_host(host_key, semaphore) for host_key in host_keys),
+            return_exceptions=True
+        )
+        for host_key, result in zip(host_keys, results):
+            if isinstance(result, Exception):
+                self.logger.error(f"Error procesando host {host_key}: {result}")
                 continue
+            traffic_data.extend(result)
         
-        self.logger.info(f"Extraídos {len(traffic_data)} registros de tráfico")
+        self.logger.info(f"Extraídos {len(traffic_data)} registros de tráfico de {len(host_keys)} hosts")
         return traffic_data
     
     def store_local_data(self, traffic_data: List[Dict]):
@@ -184,27 +235,27 @@ class AudienceExtractor:
         if not traffic_data:
             return
         
+        rows = [(
+            entry['host_ip'],
+            entry['application'],
+            entry['category'],
+            entry['bytes_sent'],
+            entry['bytes_received'],
+            entry['packets_sent'],
+            entry['packets_received'],
+            entry['duration'],
+            Json(entry['flow_info'])
+        ) for entry in traffic_data]
+        
         try:
+            # Un INSERT multi-fila por cada db_batch_size registros
             with self.db_conn.cursor() as cursor:
-                for entry in traffic_data:
-                    cursor.execute("""
-                        INSERT INTO traffic_metrics 
-                        (host_ip, application, category, bytes_sent, bytes_received, 
-                         packets_sent, packets_received, duration, flow_info)
-                        VALUES (%(host_ip)s, %(application)s, %(category)s, 
-                               %(bytes_sent)s, %(bytes_received)s, %(packets_sent)s, 
-                               %(packets_received)s, %(duration)s, %(flow_info)s)
-                    """, {
-                        'host_ip': entry['host_ip'],
-                        'application': entry['application'],
-                        'category': entry['category'],
-                        'bytes_sent': entry['bytes_sent'],
-                        'bytes_received': entry['bytes_received'],
-                        'packets_sent': entry['packets_sent'],
-                        'packets_received': entry['packets_received'],
-                        'duration': entry['duration'],
-                        'flow_info': json.dumps(entry['flow_info'])
-                    })
+                execute_values(cursor, """
+                    INSERT INTO traffic_metrics 
+                    (host_ip, application, category, bytes_sent, bytes_received, 
+                     packets_sent, packets_received, duration, flow_info)
+                    VALUES %s
+                """, rows, page_size=self.config['db_batch_size'])
             
             self.logger.info(f"Almacenados {len(traffic_data)} registros localmente")
             
@@ -229,20 +280,19 @@ class AudienceExtractor:
                 'metrics': data
             }
             
-            async with aiohttp.ClientSession() as session:
-                async with session.post(
-                    self.config['remote_endpoint'],
-                    json=payload,
-                    headers=headers,
-                    timeout=60
-                ) as response:
-                    
-                    if response.status == 200:
-                        self.logger.info(f"Datos enviados exitosamente al servidor remoto")
-                        return True
-                    else:
-                        self.logger.error(f"Error enviando datos: HTTP {response.status}")
-                        return False
+            async with self.http.post(
+                self.config['remote_endpoint'],
+                json=payload,
+                headers=headers,
+                timeout=60
+            ) as response:
+                
+                if response.status == 200:
+                    self.logger.info(f"Datos enviados exitosamente al servidor remoto")
+                    return True
+                else:
+                    self.logger.error(f"Error enviando datos: HTTP {response.status}")
+                    return False
                         
         except Exception as e:
             self.logger.error(f"Error enviando datos al servidor remoto: {e}")
@@ -286,30 +336,142 @@ class AudienceExtractor:
             app_summary[app]['hosts'].add(entry['host_ip'])
             app_summary[app]['durations'].append(entry['duration'])
         
+        rows = []
+        for app, summary in app_summary.items():
+            avg_duration = sum(summary['durations']) / len(summary['durations']) if summary['durations'] else 0
+            rows.append((
+                app,
+                summary['category'],
+                summary['total_bytes'],
+                summary['total_flows'],
+                len(summary['hosts']),
+                avg_duration,
+                f"{self.config['poll_interval']}s"
+            ))
+        
         # Almacenar resumen
         try:
             with self.db_conn.cursor() as cursor:
-                for app, summary in app_summary.items():
-                    avg_duration = sum(summary['durations']) / len(summary['durations']) if summary['durations'] else 0
-                    
-                    cursor.execute("""
-                        INSERT INTO application_summary 
-                        (application, category, total_bytes, total_flows, 
-                         unique_hosts, avg_duration, summary_period)
-                        VALUES (%s, %s, %s, %s, %s, %s, %s)
-                    """, (
-                        app,
-                        summary['category'],
-                        summary['total_bytes'],
-                        summary['total_flows'],
-                        len(summary['hosts']),
-                        avg_duration,
-                        f"{self.config['poll_interval']}s"
-                    ))
+                execute_values(cursor, """
+                    INSERT INTO application_summary 
+                    (application, category, total_bytes, total_flows, 
+                     unique_hosts, avg_duration, summary_period)
+                    VALUES %s
+                """, rows, page_size=self.config['db_batch_size'])
                     
         except Exception as e:
             self.logger.error(f"Error almacenando resumen: {e}")
     
+    def store_fingerprints(self, rows: List[tuple]):
+        """Almacenar los lotes de fingerprints recibidos"""
+        try:
+            with self.db_conn.cursor() as cursor:
+                execute_values(cursor, """
+                    INSERT INTO audio_fingerprints 
+                    (received_at, device_id, device_ip, content_type, record_count, 
+                     payload, upstream_status, match_results)
+                    VALUES %s
+                """, rows, page_size=self.config['db_batch_size'])
+            
+            self.logger.info(f"Almacenados {len(rows)} lotes de fingerprints")
+            
+        except Exception as e:
+            self.logger.error(f"Error almacenando fingerprints: {e}")
+    
+    async def flush_fingerprints(self):
+        """Escribir en bloque los lotes acumulados desde la última vez"""
+        if not self.pending_fingerprints:
+            return
+        rows, self.pending_fingerprints = self.pending_fingerprints, []
+        await self.db_call(self.store_fingerprints, rows)
+    
+    def parse_fingerprint_batch(self, content_type: str, body: bytes) -> tuple:
+        """Obtener device_id y número de registros de un lote de un ESP32"""
+        if content_type.startswith(AUDIMETER_WIRE_CONTENT_TYPE):
+            if len(body) < AUDIMETER_BATCH_HEADER.size:
+                return None, 0
+            magic, version, header_size, record_count, device_id = \
+                AUDIMETER_BATCH_HEADER.unpack_from(body)
+            if magic != AUDIMETER_WIRE_MAGIC:
+                return None, 0
+            return device_id.rstrip(b'\0').decode('ascii', 'replace'), record_count
+        
+        try:
+            batch = json.loads(body)
+            return batch.get('device_id'), len(batch.get('records', []))
+        except (ValueError, AttributeError):
+            return None, 0
+    
+    async def handle_fingerprints(self, request: web.Request) -> web.Response:
+        """Recibir un lote de un ESP32 y reenviarlo al servidor de matching.
+        
+        La respuesta del servidor (canales identificados, configuración
+        remota) vuelve tal cual al dispositivo. Si el reenvío falla se
+        responde 502 y el dispositivo conserva el lote para reintentarlo.
+        """
+        body = await request.read()
+        content_type = request.headers.get('Content-Type', 'application/json')
+        device_id, record_count = self.parse_fingerprint_batch(content_type, body)
+        if device_id is None:
+            return web.json_response({'error': 'lote no válido'}, status=400)
+        
+        status = None
+        response_body = b'{"results":[]}'
+        response_type = 'application/json'
+        endpoint = self.config['fingerprint_endpoint']
+        if endpoint:
+            try:
+                async with self.upload_semaphore:
+                    async with self.http.post(
+                        endpoint,
+                        data=body,
+                        headers={'Content-Type': content_type},
+                        timeout=30
+                    ) as response:
+                        status = response.status
+                        response_body = await response.read()
+                        response_type = response.content_type
+            except Exception as e:
+                self.logger.error(f"Error reenviando fingerprints de {device_id}: {e}")
+        
+        results = None
+        if status == 200:
+            try:
+                results = Json(json.loads(response_body))
+            except ValueError:
+                pass
+        self.pending_fingerprints.append((
+            datetime.utcnow(),
+            device_id,
+            request.remote,
+            content_type[:64],
+            record_count,
+            psycopg2.Binary(body),
+            status,
+            results
+        ))
+        if len(self.pending_fingerprints) >= self.config['db_batch_size']:
+            await self.flush_fingerprints()
+        
+        if endpoint and status is None:
+            return web.json_response({'error': 'servidor de matching no disponible'}, status=502)
+        return web.Response(body=response_body, status=status or 200,
+                            content_type=response_type)
+    
+    async def start_fingerprint_server(self) -> Optional[web.AppRunner]:
+        """Escuchar los envíos de los ESP32 (mismas rutas que el servidor de matching)"""
+        if self.config['fingerprint_port'] <= 0:
+            return None
+        
+        app = web.Application(client_max_size=4 * 1024 * 1024)
+        app.router.add_post('/api/fingerprint', self.handle_fingerprints)
+        app.router.add_post('/api/match', self.handle_fingerprints)
+        runner = web.AppRunner(app, access_log=None)
+        await runner.setup()
+        await web.TCPSite(runner, port=self.config['fingerprint_port']).start()
+        self.logger.info(f"Recibiendo fingerprints en el puerto {self.config['fingerprint_port']}")
+        return runner
+    
     def signal_handler(self, signum, frame):
         """Manejar señales de terminación"""
         self.logger.info(f"Recibida señal {signum}, deteniendo extractor...")
@@ -319,32 +481,50 @@ class AudienceExtractor:
         """Ejecutar el bucle principal del extractor"""
         self.logger.info("Iniciando extractor de audiencias...")
         
-        while self.running:
-            try:
-                start_time = datetime.utcnow()
-                
-                # Extraer datos de tráfico
-                traffic_data = await self.extract_traffic_data()
-                
-                if traffic_data:
-                    # Almacenar localmente
-                    self.store_local_data(traffic_data)
+        # Una sola sesión HTTP con su pool de conexiones para ntopng, el
+        # servidor remoto y el de matching
+        connector = aiohttp.TCPConnector(limit=self.config['http_pool_size'])
+        async with aiohttp.ClientSession(connector=connector) as http:
+            self.http = http
+            self.upload_semaphore = asyncio.Semaphore(self.config['fingerprint_concurrency'])
+            runner = await self.start_fingerprint_server()
+            
+            while self.running:
+                try:
+                    start_time = datetime.utcnow()
                     
-                    # Generar resumen
-                    self.generate_summary(traffic_data)
+                    # Extraer datos de tráfico
+                    traffic_data = await self.extract_traffic_data()
                     
-                    # Enviar al servidor remoto
-                    if await self.send_to_remote(traffic_data):
-                        self.mark_as_sent(start_time)
-                
-                # Esperar hasta el próximo ciclo
-                await asyncio.sleep(self.config['poll_interval'])
-                
-            except Exception as e:
-                self.logger.error(f"Error en el bucle principal: {e}")
-                await asyncio.sleep(5)  # Esperar antes de reintentar
+                    if traffic_data:
+                        # Almacenar localmente
+                        await self.db_call(self.store_local_data, traffic_data)
+                        
+                        # Generar resumen
+                        await self.db_call(self.generate_summary, traffic_data)
+                        
+                        # Enviar al servidor remoto
+                        if await self.send_to_remote(traffic_data):
+                            await self.db_call(self.mark_as_sent, start_time)
+                    
+                    await self.flush_fingerprints()
+                    
+                    # Esperar hasta el próximo ciclo, descontando lo que duró este
+                    elapsed = (datetime.utcnow() - start_time).total_seconds()
+                    if elapsed > self.config['poll_interval']:
+                        self.logger.warning(f"Ciclo de {elapsed:.1f} s, más largo que POLL_INTERVAL")
+                    await asyncio.sleep(max(self.config['poll_interval'] - elapsed, 0))
+                    
+                except Exception as e:
+                    self.logger.error(f"Error en el bucle principal: {e}")
+                    await asyncio.sleep(5)  # Esperar antes de reintentar
+            
+            if runner:
+                await runner.cleanup()
+            await self.flush_fingerprints()
         
         self.logger.info("Extractor detenido")
+        self.db_executor.shutdown()
         self.db_conn.close()
 
 if __name__ == "__main__":
@@ -0,0 +1,117 @@
+/*
+ * Formato binario de fingerprints (application/x-audimeter-fp)
+ * Compartido entre el firmware ESP32 y el servidor de matching
+ *
+ * Todos los campos son little-endian y las estructuras están empaquetadas.
+ * Un cuerpo es una cabecera de lote seguida de record_count registros;
+ * cada registro empieza por su tamaño total, de modo que un lector puede
+ * saltar tipos o versiones que no entienda.
+ */
+
+#ifndef AUDIMETER_WIRE_H
+#define AUDIMETER_WIRE_H
+
+#include <stdint.h>
+
+#define AUDIMETER_WIRE_CONTENT_TYPE  "application/x-audimeter-fp"
+#define AUDIMETER_WIRE_MAGIC         0x46444D41u   // "AMDF"
+#define AUDIMETER_WIRE_VERSION       1
+#define AUDIMETER_DEVICE_ID_LEN      24
+#define AUDIMETER_TASK_NAME_LEN      16
+
+// Tipos de registro
+#define AUDIMETER_RECORD_FINGERPRINT  1
+#define AUDIMETER_RECORD_HEARTBEAT    2
+#define AUDIMETER_RECORD_TELEMETRY    3
+
+// Codificación del payload de un fingerprint
+#define AUDIMETER_FEATURES_LANDMARKS  1   // count x {uint32 hash, uint32 offset}
+#define AUDIMETER_FEATURES_MFCC_F32   2   // count x float32
+#define AUDIMETER_FEATURES_MFCC_I16   3   // count x int16, valor = q * scale
+#define AUDIMETER_FEATURES_MFCC_I8    4   // count x int8, valor = q * scale
+
+// Etapas medidas en la telemetría
+#define AUDIMETER_STAGE_CAPTURE       0   // Conversión de un bloque DMA
+#define AUDIMETER_STAGE_PREEMPHASIS   1   // Pre-énfasis de un bloque
+#define AUDIMETER_STAGE_FFT           2   // Ventana, FFT y potencia de un frame
+#define AUDIMETER_STAGE_MFCC          3   // Banco mel y DCT de un frame
+#define AUDIMETER_STAGE_HASHING       4   // Landmarks de un frame
+#define AUDIMETER_STAGE_FINGERPRINT   5   // Cierre del fingerprint y MD5
+#define AUDIMETER_STAGE_ENCODING      6   // Serialización de un registro
+#define AUDIMETER_STAGE_HTTP          7   // Petición HTTP completa, con la espera de red
+
+// Cabecera del lote
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t header_size;               // sizeof(audimeter_batch_header_t)
+    uint16_t record_count;
+    char device_id[AUDIMETER_DEVICE_ID_LEN];   // Rellenado con NUL
+    uint32_t sample_rate;
+    uint8_t quality_level;
+    uint8_t reserved[3];
+} audimeter_batch_header_t;
+
+// Cabecera común de cada registro
+typedef struct __attribute__((packed)) {
+    uint32_t record_size;              // Bytes del registro, incluida esta cabecera
+    uint8_t type;                      // AUDIMETER_RECORD_*
+    uint8_t encoding;                  // AUDIMETER_FEATURES_* (sólo fingerprints)
+    uint16_t reserved;
+    uint64_t timestamp;                // Microsegundos UTC
+    uint8_t hash[16];                  // MD5; en heartbeats, el del último completo
+    float confidence;
+} audimeter_record_header_t;
+
+// Fingerprint: sigue a la cabecera común y precede a `count` elementos
+typedef struct __attribute__((packed)) {
+    uint16_t duration;                 // Segundos de audio cubiertos
+    uint16_t frames;
+    uint16_t hop_length;
+    uint16_t fft_size;
+    uint16_t coeffs;                   // Coeficientes por frame (0 en landmarks)
+    uint16_t reserved;
+    float scale;                       // Escala de los MFCC cuantizados
+    uint32_t count;                    // Elementos del payload
+} audimeter_fingerprint_t;
+
+// Heartbeat: sigue a la cabecera común
+typedef struct __attribute__((packed)) {
+    uint64_t since;                    // Timestamp del último fingerprint completo
+    uint32_t suppressed;               // Fingerprints omitidos desde entonces
+} audimeter_heartbeat_t;
+
+// Telemetría: sigue a la cabecera común (hash a cero y confidence 0) y
+// precede a stage_count audimeter_stage_stats_t y task_count
+// audimeter_task_stats_t
+typedef struct __attribute__((packed)) {
+    uint32_t period_ms;                // Intervalo cubierto por las estadísticas
+    uint16_t cpu_mhz;                  // Para convertir ciclos en tiempo
+    uint8_t stage_count;
+    uint8_t task_count;
+    uint32_t free_heap;
+    uint32_t min_free_internal;        // Mínimo histórico de RAM interna libre
+    uint32_t largest_internal_block;
+    uint32_t queue_dropped;            // Registros perdidos por cola de envío llena
+    uint32_t store_pending;            // Registros pendientes en flash
+} audimeter_telemetry_t;
+
+// Duración de una etapa en ciclos de CPU durante el periodo
+typedef struct __attribute__((packed)) {
+    uint8_t stage;                     // AUDIMETER_STAGE_*
+    uint8_t reserved[3];
+    uint32_t count;
+    uint32_t min_cycles;
+    uint32_t mean_cycles;
+    uint32_t p99_cycles;               // Límite superior de la cubeta del p99
+    uint32_t max_cycles;
+} audimeter_stage_stats_t;
+
+typedef struct __attribute__((packed)) {
+    char name[AUDIMETER_TASK_NAME_LEN];   // Rellenado con NUL
+    uint32_t stack_free;               // Mínimo de pila libre desde el arranque (bytes)
+    uint16_t cpu_permille;             // Uso de un core durante el periodo (‰)
+    uint16_t reserved;
+} audimeter_task_stats_t;
+
+#endif // AUDIMETER_WIRE_H
@@ -0,0 +1,1424 @@
+/*
+ * Pipeline DSP de fingerprints de audio
+ * Extraído de main.c para compilarlo también en el host (ver bench/)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "audio_dsp.h"
+#include "dsp_port.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define PRE_EMPHASIS_ALPHA_Q15  31785   // 0.97 en Q15
+
+// ================================
+// PRESETS Y MEDICIÓN
+// ================================
+
+static const dsp_preset_t dsp_presets[DSP_PRESET_COUNT] = {
+    { 16000, 512,  10, 8,  DSP_MODE_FIXED },   // 1: Básica - bajo consumo
+    { 16000, 512,  12, 10, DSP_MODE_FIXED },   // 2: Baja
+    { 16000, 1024, 13, 12, DSP_MODE_FLOAT },   // 3: Media (por defecto)
+    { 16000, 1024, 15, 13, DSP_MODE_FLOAT },   // 4: Alta
+    { 16000, 1024, 20, 16, DSP_MODE_FLOAT },   // 5: Máxima - mayor precisión
+};
+
+const dsp_preset_t* dsp_preset(uint8_t level) {
+    if (level < 1 || level > DSP_PRESET_COUNT) {
+        return NULL;
+    }
+    return &dsp_presets[level - 1];
+}
+
+const dsp_preset_t* dsp_preset_analysis(uint8_t level, fingerprint_mode_t mode) {
+    if (level < 1 || level > DSP_PRESET_COUNT) {
+        return NULL;
+    }
+    return dsp_preset(mode == FINGERPRINT_MODE_LANDMARKS ? DSP_LANDMARK_PRESET : level);
+}
+
+static dsp_span_hook_t dsp_span_hook = NULL;
+
+void dsp_set_span_hook(dsp_span_hook_t hook) {
+    dsp_span_hook = hook;
+}
+
+#if AUDIO_PERF_ENABLE
+#define DSP_SPAN_BEGIN(span)        uint32_t span = dsp_span_hook ? dsp_cycles() : 0
+#define DSP_SPAN_END(span, stage)   do { \
+        if (dsp_span_hook) dsp_span_hook(stage, dsp_cycles() - span); \
+    } while (0)
+#else
+#define DSP_SPAN_BEGIN(span)        do { } while (0)
+#define DSP_SPAN_END(span, stage)   do { } while (0)
+#endif
+
+// ================================
+// FUNCIONES DE PROCESAMIENTO DE AUDIO
+// ================================
+
+// Calcular los coeficientes de la ventana de Hamming
+void build_hamming_window(float* window, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        window[i] = 0.54 - 0.46 * cosf(2.0 * M_PI * i / (length - 1));
+    }
+}
+
+// Pre-énfasis para mejorar altas frecuencias. `prev` conserva la última
+// muestra de entrada entre bloques consecutivos.
+void DSP_HOT_FN pre_emphasis(const float* in, float* out, size_t length, float alpha, float* prev) {
+    float last = *prev;
+    for (size_t i = 0; i < length; i++) {
+        float x = in[i];
+        out[i] = x - alpha * last;
+        last = x;
+    }
+    *prev = last;
+}
+
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+static inline int16_t float_to_q15(float x) {
+    int32_t v = (int32_t)lrintf(x * 32768.0f);
+    return (v > INT16_MAX) ? INT16_MAX : (v < -INT16_MAX) ? -INT16_MAX : (int16_t)v;
+}
+
+// Pre-énfasis en Q15. La salida se escala por 1/2 para que x - alpha*prev
+// no desborde; el factor se compensa en el exponente del espectro.
+void DSP_HOT_FN pre_emphasis_q15(const int16_t* in, int16_t* out, size_t length, int16_t* prev) {
+    int32_t last = *prev;
+    for (size_t i = 0; i < length; i++) {
+        int32_t x = in[i];
+        out[i] = (int16_t)((x - ((PRE_EMPHASIS_ALPHA_Q15 * last) >> 15)) >> 1);
+        last = x;
+    }
+    *prev = (int16_t)last;
+}
+#endif
+
+// Detectar si la muestra contiene principalmente ruido
+bool DSP_HOT_FN is_noise(const float* data, size_t length, float threshold) {
+    float energy = 0.0;
+    for (size_t i = 0; i < length; i++) {
+        energy += data[i] * data[i];
+    }
+    energy /= length;
+    return energy < threshold;
+}
+
+// Logaritmo natural aproximado (error < 1e-4) sin llamar a logf
+static inline float fast_logf(float x) {
+    union { float f; uint32_t i; } u = { .f = x };
+    float e = (float)((int)((u.i >> 23) & 0xFF) - 127);
+    u.i = (u.i & 0x007FFFFF) | 0x3F800000;   // Mantisa en [1, 2)
+    float m = u.f;
+    float log2_m = -1.7417939f + (2.8212026f + (-1.4699568f +
+                   (0.44717955f - 0.056570851f * m) * m) * m) * m;
+    return (e + log2_m) * 0.69314718f;
+}
+
+// ================================
+// DIEZMADO
+// ================================
+
+#define DECIMATOR_CUTOFF        0.9f    // Corte (-6 dB) relativo al Nyquist de salida
+#define DECIMATOR_KAISER_BETA   5.65f   // ~60 dB de atenuación en la banda eliminada
+
+// Función de Bessel modificada I0 por su serie de potencias
+static float bessel_i0(float x) {
+    float sum = 1.0f, term = 1.0f;
+    float q = x * x / 4.0f;
+    for (int k = 1; k < 32 && term > 1e-9f * sum; k++) {
+        term *= q / ((float)k * k);
+        sum += term;
+    }
+    return sum;
+}
+
+esp_err_t decimator_init(decimator_t* dec, uint32_t input_rate, uint32_t output_rate) {
+    if (output_rate == 0 || input_rate % output_rate != 0 ||
+        input_rate / output_rate < 2 || input_rate / output_rate > DECIMATOR_MAX_FACTOR) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    dec->input_rate = input_rate;
+    dec->output_rate = output_rate;
+    dec->factor = input_rate / output_rate;
+    dec->n_taps = dec->factor * DECIMATOR_TAPS_PER_PHASE;
+
+    // Sinc con ventana de Kaiser, normalizado a ganancia 1 en continua
+    float cutoff = DECIMATOR_CUTOFF / (2.0f * dec->factor);   // Ciclos por muestra de entrada
+    float center = (dec->n_taps - 1) / 2.0f;
+    float norm = bessel_i0(DECIMATOR_KAISER_BETA);
+    float sum = 0.0f;
+    for (int i = 0; i < dec->n_taps; i++) {
+        float t = i - center;
+        float r = t / center;
+        float x = 2.0f * (float)M_PI * cutoff * t;
+        float sinc = 2.0f * cutoff * sinf(x) / x;   // t nunca es 0: n_taps es par
+        float kaiser = bessel_i0(DECIMATOR_KAISER_BETA * sqrtf(1.0f - r * r)) / norm;
+        dec->coeffs[i] = sinc * kaiser;
+        sum += dec->coeffs[i];
+    }
+    for (int i = 0; i < dec->n_taps; i++) {
+        dec->coeffs[i] /= sum;
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+        dec->coeffs_q15[i] = float_to_q15(dec->coeffs[i]);
+#endif
+    }
+    decimator_reset(dec);
+    return ESP_OK;
+}
+
+void decimator_reset(decimator_t* dec) {
+    memset(dec->delay, 0, sizeof(dec->delay));
+    dsp_port_fird_init_f32(&dec->fir, dec->coeffs, dec->delay, dec->n_taps, dec->factor);
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+    memset(dec->delay_q15, 0, sizeof(dec->delay_q15));
+    dsp_port_fird_init_s16(&dec->fir_q15, dec->coeffs_q15, dec->delay_q15, dec->n_taps, dec->factor);
+#endif
+}
+
+size_t DSP_HOT_FN decimator_process(decimator_t* dec, const float* in, float* out, size_t length) {
+    return dsp_port_fird_f32(&dec->fir, in, out, length / dec->factor);
+}
+
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+size_t DSP_HOT_FN decimator_process_q15(decimator_t* dec, const int16_t* in, int16_t* out, size_t length) {
+    return dsp_port_fird_s16(&dec->fir_q15, in, out, length / dec->factor);
+}
+#endif
+
+// ================================
+// ARENAS DE MEMORIA DEL PIPELINE
+// ================================
+
+// Vaciar la arena garantizando al menos `bytes`. Invalida todo lo repartido.
+esp_err_t arena_prepare(arena_t* arena, size_t bytes) {
+    arena->used = 0;
+    arena->epoch++;
+    if (bytes <= arena->capacity) {
+        return ESP_OK;
+    }
+    
+    size_t capacity = (bytes + ARENA_GRANULE - 1) & ~(size_t)(ARENA_GRANULE - 1);
+    dsp_port_free(arena->base);
+    arena->base = dsp_port_aligned_alloc(ARENA_ALIGN, capacity, arena->caps);
+    if (arena->base == NULL && arena->fallback_caps) {
+        arena->base = dsp_port_aligned_alloc(ARENA_ALIGN, capacity, arena->fallback_caps);
+    }
+    arena->capacity = arena->base ? capacity : 0;
+    arena->grows++;
+    return arena->base ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+// Repartir `bytes` alineados a ARENA_ALIGN; NULL si no caben
+void* arena_alloc(arena_t* arena, size_t bytes) {
+    size_t size = arena_align(bytes);
+    if (arena->base == NULL || arena->used + size > arena->capacity) {
+        return NULL;
+    }
+    void* ptr = arena->base + arena->used;
+    arena->used += size;
+    if (arena->used > arena->high_water) {
+        arena->high_water = arena->used;
+    }
+    return ptr;
+}
+
+void arena_release(arena_t* arena) {
+    dsp_port_free(arena->base);
+    arena->base = NULL;
+    arena->capacity = 0;
+    arena->used = 0;
+    arena->epoch++;
+}
+
+// ================================
+// CONTEXTO DSP PRECALCULADO
+// ================================
+
+#define MEL_LOG_FLOOR  1e-10f
+
+static inline float hz_to_mel(float hz) {
+    return 2595.0f * log10f(1.0f + hz / 700.0f);
+}
+
+static inline float mel_to_hz(float mel) {
+    return 700.0f * (powf(10.0f, mel / 2595.0f) - 1.0f);
+}
+
+static void dsp_kernels_select(dsp_context_t* ctx);
+
+void dsp_context_free(dsp_context_t* ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+static inline uint16_t dsp_mel_weight_count(uint16_t n_bins, uint16_t n_mels) {
+    return 2 * n_bins + n_mels;
+}
+
+size_t dsp_context_bytes(uint16_t fft_size, uint16_t n_mels, uint16_t n_mfcc, dsp_mode_t mode) {
+    size_t points = fft_size / 2;
+    size_t n_weights = dsp_mel_weight_count(points + 1, n_mels);
+    size_t bytes = arena_align(fft_size * sizeof(float)) +
+                   arena_align(points * sizeof(float)) +
+                   arena_align(points * sizeof(uint16_t)) +
+                   arena_align((points / 2 + 1) * 2 * sizeof(float)) +
+                   arena_align(n_weights * sizeof(float)) +
+                   arena_align(n_mfcc * n_mels * sizeof(float));
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+    if (mode == DSP_MODE_FIXED) {
+        bytes += arena_align(fft_size * sizeof(int16_t)) +
+                 arena_align(points * sizeof(int16_t)) +
+                 arena_align((points / 2 + 1) * 2 * sizeof(int16_t)) +
+                 arena_align(n_weights * sizeof(int16_t));
+    }
+#endif
+    return bytes;
+}
+
+// Tabla de intercambios para el reordenamiento bit-reverso de n puntos
+static uint16_t build_bitrev_pairs(uint16_t* pairs, uint16_t n) {
+    uint16_t count = 0;
+    int bits = 0;
+    while ((1 << bits) < n) {
+        bits++;
+    }
+    for (uint16_t i = 0; i < n; i++) {
+        uint16_t j = 0;
+        for (int b = 0; b < bits; b++) {
+            j |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        if (i < j) {
+            pairs[count*2] = i;
+            pairs[count*2 + 1] = j;
+            count++;
+        }
+    }
+    return count;
+}
+
+// Banco de filtros triangulares en escala mel entre min_freq y max_freq
+static void build_mel_filterbank(dsp_context_t* ctx, uint16_t n_bins) {
+    float max_freq = fminf(ctx->max_freq, ctx->sample_rate / 2.0f);
+    float mel_min = hz_to_mel(ctx->min_freq);
+    float mel_max = hz_to_mel(max_freq);
+    float bin_hz = (float)ctx->sample_rate / ctx->fft_size;
+    uint16_t offset = 0;
+    
+    for (int m = 0; m < ctx->n_mels; m++) {
+        float left = mel_to_hz(mel_min + (mel_max - mel_min) * m / (ctx->n_mels + 1)) / bin_hz;
+        float center = mel_to_hz(mel_min + (mel_max - mel_min) * (m + 1) / (ctx->n_mels + 1)) / bin_hz;
+        float right = mel_to_hz(mel_min + (mel_max - mel_min) * (m + 2) / (ctx->n_mels + 1)) / bin_hz;
+        
+        int first = (int)ceilf(left);
+        int last = (int)floorf(right);
+        if (last >= n_bins) last = n_bins - 1;
+        
+        mel_band_t* band = &ctx->mel_bands[m];
+        band->weight_offset = offset;
+        
+        if (last < first) {
+            // Triángulo más estrecho que un bin: usar el bin más cercano
+            band->start_bin = (uint16_t)fminf(roundf(center), n_bins - 1);
+            band->n_bins = 1;
+            ctx->mel_weights[offset++] = 1.0f;
+            continue;
+        }
+        
+        band->start_bin = first;
+        band->n_bins = last - first + 1;
+        for (int k = first; k <= last; k++) {
+            float w = (k <= center) ? (k - left) / (center - left)
+                                    : (right - k) / (right - center);
+            ctx->mel_weights[offset++] = fmaxf(w, 0.0f);
+        }
+    }
+}
+
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+// Versiones Q15 de las tablas ya construidas en punto flotante
+static esp_err_t build_q15_tables(dsp_context_t* ctx, arena_t* arena, uint16_t n_weights) {
+    ctx->window_q15 = arena_alloc(arena, ctx->fft_size * sizeof(int16_t));
+    ctx->twiddles_q15 = arena_alloc(arena, ctx->fft_points * sizeof(int16_t));
+    ctx->split_twiddles_q15 = arena_alloc(arena, (ctx->fft_points / 2 + 1) * 2 * sizeof(int16_t));
+    ctx->mel_weights_q15 = arena_alloc(arena, n_weights * sizeof(int16_t));
+    if (!ctx->window_q15 || !ctx->twiddles_q15 ||
+        !ctx->split_twiddles_q15 || !ctx->mel_weights_q15) {
+        return ESP_ERR_NO_MEM;
+    }
+    
+    for (int i = 0; i < ctx->fft_size; i++) {
+        ctx->window_q15[i] = float_to_q15(ctx->window[i]);
+    }
+    dsp_port_gen_w_r2_sc16(ctx->twiddles_q15, ctx->fft_points);
+    dsp_port_bit_rev_sc16(ctx->twiddles_q15, ctx->fft_points >> 1);
+    for (int k = 0; k < (ctx->fft_points / 2 + 1) * 2; k++) {
+        ctx->split_twiddles_q15[k] = float_to_q15(ctx->split_twiddles[k]);
+    }
+    
+    // Cada banda se acumula con dsps_dotprod_s16 sobre potencias de 15 bits:
+    // con pesos divididos por 2^h (h = ceil(log2(suma))) el resultado cabe en int16
+    for (int m = 0; m < ctx->n_mels; m++) {
+        mel_band_t* band = &ctx->mel_bands[m];
+        const float* w = &ctx->mel_weights[band->weight_offset];
+        float sum = 0.0f;
+        for (int k = 0; k < band->n_bins; k++) {
+            sum += w[k];
+        }
+        uint8_t h = 0;
+        while ((float)(1 << h) < sum) {
+            h++;
+        }
+        band->q15_headroom = h;
+        for (int k = 0; k < band->n_bins; k++) {
+            ctx->mel_weights_q15[band->weight_offset + k] = float_to_q15(ldexpf(w[k], -h));
+        }
+    }
+    return ESP_OK;
+}
+#endif
+
+// Sin la ruta Q15 compilada siempre se usa float
+static inline dsp_mode_t dsp_effective_mode(dsp_mode_t mode) {
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+    return (mode == DSP_MODE_FIXED) ? DSP_MODE_FIXED : DSP_MODE_FLOAT;
+#else
+    return DSP_MODE_FLOAT;
+#endif
+}
+
+esp_err_t dsp_context_build(dsp_context_t* ctx, const dsp_params_t* params,
+                            arena_t* arena, size_t extra_bytes) {
+    dsp_context_free(ctx);
+    
+    ctx->params = *params;
+    ctx->mode = dsp_effective_mode(params->mode);
+    ctx->sample_rate = params->sample_rate;
+    ctx->fft_size = params->fft_size;
+    ctx->n_mels = (params->n_mels < MAX_MEL_BANDS) ? params->n_mels : MAX_MEL_BANDS;
+    ctx->n_mfcc = (params->n_mfcc < ctx->n_mels) ? params->n_mfcc : ctx->n_mels;
+    ctx->min_freq = params->min_freq;
+    ctx->max_freq = params->max_freq;
+    ctx->fft_points = ctx->fft_size / 2;
+    ctx->n_bins = ctx->fft_points + 1;
+    ctx->fft_log2 = 0;
+    while ((1 << ctx->fft_log2) < ctx->fft_points) {
+        ctx->fft_log2++;
+    }
+    
+    uint16_t n_bins = ctx->n_bins;
+    uint16_t n_weights = dsp_mel_weight_count(n_bins, ctx->n_mels);
+    size_t bytes = dsp_context_bytes(ctx->fft_size, ctx->n_mels, ctx->n_mfcc, ctx->mode);
+    if (arena_prepare(arena, bytes + extra_bytes) != ESP_OK) {
+        dsp_context_free(ctx);
+        return ESP_ERR_NO_MEM;
+    }
+    ctx->window = arena_alloc(arena, ctx->fft_size * sizeof(float));
+    ctx->twiddles = arena_alloc(arena, ctx->fft_points * sizeof(float));
+    ctx->bitrev_pairs = arena_alloc(arena, ctx->fft_points * sizeof(uint16_t));
+    ctx->split_twiddles = arena_alloc(arena, (ctx->fft_points / 2 + 1) * 2 * sizeof(float));
+    ctx->mel_weights = arena_alloc(arena, n_weights * sizeof(float));
+    ctx->dct = arena_alloc(arena, ctx->n_mfcc * ctx->n_mels * sizeof(float));
+    if (!ctx->window || !ctx->twiddles || !ctx->bitrev_pairs ||
+        !ctx->split_twiddles || !ctx->mel_weights || !ctx->dct) {
+        dsp_context_free(ctx);
+        return ESP_ERR_NO_MEM;
+    }
+    
+    build_hamming_window(ctx->window, ctx->fft_size);
+    
+    // Misma tabla que genera dsps_fft2r_init_fc32, pero propia del contexto
+    dsp_port_gen_w_r2_fc32(ctx->twiddles, ctx->fft_points);
+    dsp_port_bit_rev_fc32(ctx->twiddles, ctx->fft_points >> 1);
+    ctx->n_bitrev_pairs = build_bitrev_pairs(ctx->bitrev_pairs, ctx->fft_points);
+    
+    // Factores del paso de separación de la FFT real
+    for (int k = 0; k <= ctx->fft_points / 2; k++) {
+        ctx->split_twiddles[k*2] = cosf(2.0f * M_PI * k / ctx->fft_size);
+        ctx->split_twiddles[k*2 + 1] = sinf(2.0f * M_PI * k / ctx->fft_size);
+    }
+    
+    ctx->band_start_bin = (ctx->min_freq * ctx->fft_size) / ctx->sample_rate;
+    ctx->band_end_bin = (ctx->max_freq * ctx->fft_size) / ctx->sample_rate;
+    if (ctx->band_end_bin > n_bins) {
+        ctx->band_end_bin = n_bins;
+    }
+    
+    build_mel_filterbank(ctx, n_bins);
+    
+    // DCT-II ortonormal: c[k] = sum_m s_k * cos(pi * k * (m + 0.5) / M) * log_mel[m]
+    for (int k = 0; k < ctx->n_mfcc; k++) {
+        float scale = sqrtf((k == 0 ? 1.0f : 2.0f) / ctx->n_mels);
+        for (int m = 0; m < ctx->n_mels; m++) {
+            ctx->dct[k * ctx->n_mels + m] = scale * cosf(M_PI * k * (m + 0.5f) / ctx->n_mels);
+        }
+    }
+    
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+    if (ctx->mode == DSP_MODE_FIXED && build_q15_tables(ctx, arena, n_weights) != ESP_OK) {
+        dsp_context_free(ctx);
+        return ESP_ERR_NO_MEM;
+    }
+#endif
+    dsp_kernels_select(ctx);
+    ctx->valid = true;
+    return ESP_OK;
+}
+
+static bool dsp_params_equal(const dsp_params_t* a, const dsp_params_t* b) {
+    return a->sample_rate == b->sample_rate && a->fft_size == b->fft_size &&
+           a->n_mels == b->n_mels && a->n_mfcc == b->n_mfcc &&
+           a->min_freq == b->min_freq && a->max_freq == b->max_freq &&
+           dsp_effective_mode(a->mode) == dsp_effective_mode(b->mode);
+}
+
+esp_err_t dsp_context_update(dsp_context_t* ctx, const dsp_params_t* params,
+                             arena_t* arena, size_t extra_bytes) {
+    if (ctx->valid && dsp_params_equal(&ctx->params, params)) {
+        return ESP_OK;
+    }
+    return dsp_context_build(ctx, params, arena, extra_bytes);
+}
+
+// ================================
+// NÚCLEOS POR FRAME
+// ================================
+
+// Cada núcleo se escribe una vez como función inline con los tamaños como
+// parámetros y se instancia con constantes para las formas de los presets:
+// el compilador ve límites fijos, desenrolla y mantiene los contadores en
+// registros. dsp_context_build elige las instancias en kernels; cualquier
+// otra forma usa la instancia genérica, que lee los tamaños del contexto.
+
+#define DSP_ALWAYS_INLINE  static inline __attribute__((always_inline))
+
+// Tamaños de FFT, bandas mel y pares (n_mels, n_mfcc) con instancia propia:
+// los de dsp_presets, más FFT 2048 para el menú
+#define DSP_KERNEL_FFT_SIZES(X)  X(512) X(1024) X(2048)
+#define DSP_KERNEL_MEL_BANDS(X)  X(10) X(12) X(13) X(15) X(20)
+#define DSP_KERNEL_DCT_SHAPES(X) X(10, 8) X(12, 10) X(13, 12) X(15, 13) X(20, 16)
+
+// Aplicar la ventana de Hamming al frame
+DSP_ALWAYS_INLINE void window_body(const dsp_context_t* ctx, const float* in, float* out,
+                                   const uint16_t n) {
+    const float* window = ctx->window;
+#pragma GCC unroll 8
+    for (uint16_t i = 0; i < n; i++) {
+        out[i] = in[i] * window[i];
+    }
+}
+
+// FFT compleja in-place de m puntos usando las tablas del contexto
+DSP_ALWAYS_INLINE void fft_body(const dsp_context_t* ctx, float* data, const uint16_t m) {
+    dsp_port_fft2r_fc32(data, m, ctx->twiddles);
+    const uint16_t* pairs = ctx->bitrev_pairs;
+    const uint16_t n_pairs = ctx->n_bitrev_pairs;
+    for (uint16_t p = 0; p < n_pairs; p++) {
+        uint16_t i = pairs[p*2] * 2;
+        uint16_t j = pairs[p*2 + 1] * 2;
+        float re = data[i], im = data[i + 1];
+        data[i] = data[j];
+        data[i + 1] = data[j + 1];
+        data[j] = re;
+        data[j + 1] = im;
+    }
+}
+
+// Espectro de potencia de 2*m muestras reales. Las muestras pares e
+// impares se interpretan como parte real e imaginaria de m puntos
+// complejos; tras la FFT de media longitud, el paso de separación recupera
+// los bins X[0..m]. `data` se destruye; `power` recibe m + 1 valores.
+DSP_ALWAYS_INLINE void power_spectrum_body(const dsp_context_t* ctx, float* data, float* power,
+                                           const uint16_t m) {
+    const float* split = ctx->split_twiddles;
+    
+    fft_body(ctx, data, m);
+    
+    // DC y Nyquist quedan empaquetados en Z[0]
+    float dc = data[0] + data[1];
+    float nyquist = data[0] - data[1];
+    power[0] = dc * dc;
+    power[m] = nyquist * nyquist;
+    
+#pragma GCC unroll 4
+    for (uint16_t k = 1; k <= m / 2; k++) {
+        float ar = data[2*k],       ai = data[2*k + 1];
+        float br = data[2*(m - k)], bi = -data[2*(m - k) + 1];   // conj(Z[m-k])
+        
+        // Fe = (a + b) / 2, Fo = -j (a - b) / 2
+        float fe_r = 0.5f * (ar + br), fe_i = 0.5f * (ai + bi);
+        float fo_r = 0.5f * (ai - bi), fo_i = -0.5f * (ar - br);
+        
+        // t = W^k * Fo con W = exp(-j 2 pi / fft_size)
+        float c = split[k*2], s = split[k*2 + 1];
+        float t_r = c * fo_r + s * fo_i;
+        float t_i = c * fo_i - s * fo_r;
+        
+        // X[k] = Fe + t, X[m-k] = conj(Fe - t)
+        float xr = fe_r + t_r, xi = fe_i + t_i;
+        float yr = fe_r - t_r, yi = fe_i - t_i;
+        power[k] = xr * xr + xi * xi;
+        power[m - k] = yr * yr + yi * yi;
+    }
+}
+
+// Banco de filtros mel disperso y logaritmo: n_mels energías
+DSP_ALWAYS_INLINE void mel_body(const dsp_context_t* ctx, const float* power, float* log_mel,
+                                const uint16_t n_mels) {
+#pragma GCC unroll 32
+    for (uint16_t m = 0; m < n_mels; m++) {
+        const mel_band_t* band = &ctx->mel_bands[m];
+        const float* w = &ctx->mel_weights[band->weight_offset];
+        const float* p = &power[band->start_bin];
+        float energy = 0.0f;
+        for (int k = 0; k < band->n_bins; k++) {
+            energy += w[k] * p[k];
+        }
+        log_mel[m] = fast_logf(energy + MEL_LOG_FLOOR);
+    }
+}
+
+// DCT-II de las energías log-mel: n_mfcc coeficientes. Común a ambas rutas.
+// Con tamaños constantes se desenrolla entera.
+DSP_ALWAYS_INLINE void dct_body(const dsp_context_t* ctx, const float* log_mel, float* mfcc,
+                                const uint16_t n_mels, const uint16_t n_mfcc) {
+    const float* dct = ctx->dct;
+#pragma GCC unroll 32
+    for (uint16_t k = 0; k < n_mfcc; k++) {
+        const float* row = &dct[k * n_mels];
+        float acc = 0.0f;
+#pragma GCC unroll 32
+        for (uint16_t m = 0; m < n_mels; m++) {
+            acc += row[m] * log_mel[m];
+        }
+        mfcc[k] = acc;
+    }
+}
+
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+// FFT compleja sc16 in-place. Cada etapa escala por 1/2: la salida es Z / m.
+DSP_ALWAYS_INLINE void fft_q15_body(const dsp_context_t* ctx, int16_t* data, const uint16_t m) {
+    dsp_port_fft2r_sc16(data, m, ctx->twiddles_q15);
+    // Un punto complejo sc16 ocupa 32 bits: intercambio en una sola palabra
+    uint32_t* z = (uint32_t*)data;
+    const uint16_t* pairs = ctx->bitrev_pairs;
+    const uint16_t n_pairs = ctx->n_bitrev_pairs;
+    for (uint16_t p = 0; p < n_pairs; p++) {
+        uint16_t i = pairs[p*2];
+        uint16_t j = pairs[p*2 + 1];
+        uint32_t t = z[i];
+        z[i] = z[j];
+        z[j] = t;
+    }
+}
+
+// Espectro de potencia en Q15 con el mismo paso de separación que la ruta
+// float. Devuelve el exponente e tal que |X[k]|^2 = power[k] * 2^e cuando
+// la entrada se interpreta como Q15 (32768 = 1.0).
+DSP_ALWAYS_INLINE int power_spectrum_q15_body(const dsp_context_t* ctx, int16_t* data,
+                                              uint32_t* power, const uint16_t m) {
+    const int16_t* split = ctx->split_twiddles_q15;
+    
+    fft_q15_body(ctx, data, m);
+    
+    int32_t dc = ((int32_t)data[0] + data[1]) >> 1;
+    int32_t nyquist = ((int32_t)data[0] - data[1]) >> 1;
+    power[0] = (uint32_t)(dc * dc);
+    power[m] = (uint32_t)(nyquist * nyquist);
+    
+#pragma GCC unroll 4
+    for (uint16_t k = 1; k <= m / 2; k++) {
+        int32_t ar = data[2*k],       ai = data[2*k + 1];
+        int32_t br = data[2*(m - k)], bi = -data[2*(m - k) + 1];
+        
+        int32_t fe_r = (ar + br) >> 1, fe_i = (ai + bi) >> 1;
+        int32_t fo_r = (ai - bi) >> 1, fo_i = -((ar - br) >> 1);
+        
+        int32_t c = split[k*2], s = split[k*2 + 1];
+        int32_t t_r = (c * fo_r + s * fo_i) >> 15;
+        int32_t t_i = (c * fo_i - s * fo_r) >> 15;
+        
+        // X/2 para que el cuadrado quepa en 32 bits sin signo
+        int32_t xr = (fe_r + t_r) >> 1, xi = (fe_i + t_i) >> 1;
+        int32_t yr = (fe_r - t_r) >> 1, yi = (fe_i - t_i) >> 1;
+        power[k] = (uint32_t)(xr * xr) + (uint32_t)(xi * xi);
+        power[m - k] = (uint32_t)(yr * yr) + (uint32_t)(yi * yi);
+    }
+    
+    // power = |X|^2 * 2^30 / (4 * m^2)
+    return 2 * ctx->fft_log2 + 2 - 30;
+}
+
+// Banco de filtros mel en Q15. Cada banda se normaliza a 15 bits
+// (coma flotante por bloques) y se acumula con dsps_dotprod_s16;
+// `scratch` necesita espacio para la banda más ancha.
+DSP_ALWAYS_INLINE void mel_q15_body(const dsp_context_t* ctx, const uint32_t* power, int exponent,
+                                    int16_t* scratch, float* log_mel, const uint16_t n_mels) {
+#pragma GCC unroll 32
+    for (uint16_t m = 0; m < n_mels; m++) {
+        const mel_band_t* band = &ctx->mel_bands[m];
+        const uint32_t* p = &power[band->start_bin];
+        
+        uint32_t peak = 0;
+        for (int k = 0; k < band->n_bins; k++) {
+            if (p[k] > peak) peak = p[k];
+        }
+        int shift = (peak > INT16_MAX) ? (32 - __builtin_clz(peak)) - 15 : 0;
+        for (int k = 0; k < band->n_bins; k++) {
+            scratch[k] = (int16_t)(p[k] >> shift);
+        }
+        
+        int16_t acc = 0;
+        dsp_port_dotprod_s16(&ctx->mel_weights_q15[band->weight_offset], scratch,
+                             &acc, band->n_bins, 0);
+        float energy = ldexpf((float)acc, shift + band->q15_headroom + exponent);
+        log_mel[m] = fast_logf(energy + MEL_LOG_FLOOR);
+    }
+}
+#endif
+
+// Instancias genéricas: tamaños leídos del contexto. Ventana y espectro van
+// a IRAM (DSP_HOT_FN); mel y DCT, desenrollados, ocupan demasiado para ella
+// y sus bucles caben de sobra en la caché de flash.
+static void DSP_HOT_FN window_any(const dsp_context_t* ctx, const float* in, float* out) {
+    window_body(ctx, in, out, ctx->fft_size);
+}
+static void DSP_HOT_FN power_spectrum_any(const dsp_context_t* ctx, float* data, float* power) {
+    power_spectrum_body(ctx, data, power, ctx->fft_points);
+}
+static void mel_any(const dsp_context_t* ctx, const float* power, float* log_mel) {
+    mel_body(ctx, power, log_mel, ctx->n_mels);
+}
+static void dct_any(const dsp_context_t* ctx, const float* log_mel, float* mfcc) {
+    dct_body(ctx, log_mel, mfcc, ctx->n_mels, ctx->n_mfcc);
+}
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+static int DSP_HOT_FN power_spectrum_q15_any(const dsp_context_t* ctx, int16_t* data, uint32_t* power) {
+    return power_spectrum_q15_body(ctx, data, power, ctx->fft_points);
+}
+static void mel_q15_any(const dsp_context_t* ctx, const uint32_t* power, int exponent,
+                        int16_t* scratch, float* log_mel) {
+    mel_q15_body(ctx, power, exponent, scratch, log_mel, ctx->n_mels);
+}
+#endif
+
+// Instancias con tamaños constantes
+#define DSP_KERNEL_FFT_DEFINE(n) \
+    static void DSP_HOT_FN window_##n(const dsp_context_t* ctx, const float* in, float* out) { \
+        window_body(ctx, in, out, n); \
+    } \
+    static void DSP_HOT_FN power_spectrum_##n(const dsp_context_t* ctx, float* data, float* power) { \
+        power_spectrum_body(ctx, data, power, n / 2); \
+    } \
+    DSP_KERNEL_FFT_Q15_DEFINE(n)
+
+#define DSP_KERNEL_MEL_DEFINE(n) \
+    static void mel_##n(const dsp_context_t* ctx, const float* power, float* log_mel) { \
+        mel_body(ctx, power, log_mel, n); \
+    } \
+    DSP_KERNEL_MEL_Q15_DEFINE(n)
+
+#define DSP_KERNEL_DCT_DEFINE(mels, mfcc) \
+    static void dct_##mels##_##mfcc(const dsp_context_t* ctx, const float* log_mel, float* out) { \
+        dct_body(ctx, log_mel, out, mels, mfcc); \
+    }
+
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+#define DSP_KERNEL_FFT_Q15_DEFINE(n) \
+    static int DSP_HOT_FN power_spectrum_q15_##n(const dsp_context_t* ctx, int16_t* data, uint32_t* power) { \
+        return power_spectrum_q15_body(ctx, data, power, n / 2); \
+    }
+#define DSP_KERNEL_MEL_Q15_DEFINE(n) \
+    static void mel_q15_##n(const dsp_context_t* ctx, const uint32_t* power, int exponent, \
+                            int16_t* scratch, float* log_mel) { \
+        mel_q15_body(ctx, power, exponent, scratch, log_mel, n); \
+    }
+#else
+#define DSP_KERNEL_FFT_Q15_DEFINE(n)
+#define DSP_KERNEL_MEL_Q15_DEFINE(n)
+#endif
+
+DSP_KERNEL_FFT_SIZES(DSP_KERNEL_FFT_DEFINE)
+DSP_KERNEL_MEL_BANDS(DSP_KERNEL_MEL_DEFINE)
+DSP_KERNEL_DCT_SHAPES(DSP_KERNEL_DCT_DEFINE)
+
+// Elegir las instancias para la forma del contexto
+static void dsp_kernels_select(dsp_context_t* ctx) {
+    dsp_kernels_t* k = &ctx->kernels;
+    k->window = window_any;
+    k->power_spectrum = power_spectrum_any;
+    k->mel = mel_any;
+    k->dct = dct_any;
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+    k->power_spectrum_q15 = power_spectrum_q15_any;
+    k->mel_q15 = mel_q15_any;
+#endif
+    k->specialized = 0;
+
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+#define DSP_KERNEL_FFT_Q15_SELECT(n)  k->power_spectrum_q15 = power_spectrum_q15_##n;
+#define DSP_KERNEL_MEL_Q15_SELECT(n)  k->mel_q15 = mel_q15_##n;
+#else
+#define DSP_KERNEL_FFT_Q15_SELECT(n)
+#define DSP_KERNEL_MEL_Q15_SELECT(n)
+#endif
+#define DSP_KERNEL_FFT_SELECT(n) \
+    if (ctx->fft_size == n) { \
+        k->window = window_##n; \
+        k->power_spectrum = power_spectrum_##n; \
+        DSP_KERNEL_FFT_Q15_SELECT(n) \
+        k->specialized |= DSP_KERNELS_FFT; \
+    }
+#define DSP_KERNEL_MEL_SELECT(n) \
+    if (ctx->n_mels == n) { \
+        k->mel = mel_##n; \
+        DSP_KERNEL_MEL_Q15_SELECT(n) \
+        k->specialized |= DSP_KERNELS_MEL; \
+    }
+#define DSP_KERNEL_DCT_SELECT(mels, mfcc) \
+    if (ctx->n_mels == mels && ctx->n_mfcc == mfcc) { \
+        k->dct = dct_##mels##_##mfcc; \
+        k->specialized |= DSP_KERNELS_DCT; \
+    }
+
+    DSP_KERNEL_FFT_SIZES(DSP_KERNEL_FFT_SELECT)
+    DSP_KERNEL_MEL_BANDS(DSP_KERNEL_MEL_SELECT)
+    DSP_KERNEL_DCT_SHAPES(DSP_KERNEL_DCT_SELECT)
+}
+
+void DSP_HOT_FN dsp_context_power_spectrum(const dsp_context_t* ctx, float* data, float* power) {
+    ctx->kernels.power_spectrum(ctx, data, power);
+}
+
+void DSP_HOT_FN dsp_context_mel(const dsp_context_t* ctx, const float* power, float* log_mel) {
+    ctx->kernels.mel(ctx, power, log_mel);
+}
+
+void DSP_HOT_FN dsp_context_dct(const dsp_context_t* ctx, const float* log_mel, float* mfcc) {
+    ctx->kernels.dct(ctx, log_mel, mfcc);
+}
+
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+int DSP_HOT_FN dsp_context_power_spectrum_q15(const dsp_context_t* ctx, int16_t* data, uint32_t* power) {
+    return ctx->kernels.power_spectrum_q15(ctx, data, power);
+}
+
+void DSP_HOT_FN dsp_context_mel_q15(const dsp_context_t* ctx, const uint32_t* power, int exponent,
+                                    int16_t* scratch, float* log_mel) {
+    ctx->kernels.mel_q15(ctx, power, exponent, scratch, log_mel);
+}
+#endif
+
+// ================================
+// ANALIZADOR STFT INCREMENTAL
+// ================================
+
+#define PRE_EMPHASIS_ALPHA  0.97f
+
+void stft_stream_init(stft_stream_t* stft, dsp_context_t* dsp, arena_t* arena,
+                      stft_frame_cb_t on_frame, void* ctx) {
+    memset(stft, 0, sizeof(*stft));
+    stft->ctx = dsp;
+    stft->arena = arena;
+    stft->on_frame = on_frame;
+    stft->cb_ctx = ctx;
+}
+
+static inline size_t stft_stream_bytes(uint16_t fft_size) {
+    return 2 * arena_align(fft_size * sizeof(float)) +
+           arena_align((fft_size / 2 + 1) * sizeof(float));
+}
+
+esp_err_t stft_stream_reset(stft_stream_t* stft, const dsp_params_t* params) {
+    esp_err_t err = dsp_context_update(stft->ctx, params, stft->arena,
+                                       stft_stream_bytes(params->fft_size));
+    if (err != ESP_OK) {
+        return err;
+    }
+    
+    // Las tablas se reconstruyeron: repartir los buffers tras ellas
+    if (stft->arena_epoch != stft->arena->epoch) {
+        uint16_t n = stft->ctx->fft_size;
+        stft->history = arena_alloc(stft->arena, n * sizeof(float));
+        stft->fft_buffer = arena_alloc(stft->arena, n * sizeof(float));
+        stft->power_spectrum = arena_alloc(stft->arena, (n / 2 + 1) * sizeof(float));
+        if (!stft->history || !stft->fft_buffer || !stft->power_spectrum) {
+            stft->ctx->valid = false;
+            return ESP_ERR_NO_MEM;
+        }
+        stft->arena_epoch = stft->arena->epoch;
+    }
+    
+    stft->fft_size = stft->ctx->fft_size;
+    stft->hop_length = params->hop_length;
+    stft->fill = 0;
+    stft->prev_sample = 0.0f;
+    stft->prev_sample_q15 = 0;
+    stft->energy = 0.0;
+    stft->n_samples = 0;
+    stft->n_frames = 0;
+    return ESP_OK;
+}
+
+// Entrega del frame al consumidor. Si want_spectrum está
+// activo, power_spectrum ya contiene el espectro logarítmico como float.
+static void DSP_HOT_FN stft_stream_emit(stft_stream_t* stft, const float* mfcc) {
+    const dsp_context_t* ctx = stft->ctx;
+    stft_frame_t frame = {
+        .index = stft->n_frames,
+        .mfcc = mfcc,
+        .n_mfcc = ctx->n_mfcc,
+        .log_power = stft->want_spectrum ? stft->power_spectrum : NULL,
+        .first_bin = ctx->band_start_bin,
+        .end_bin = ctx->band_end_bin,
+    };
+    stft->n_frames++;
+    
+    if (stft->on_frame) {
+        stft->on_frame(&frame, stft->cb_ctx);
+    }
+}
+
+// Calcular las características del frame contenido en history
+static void DSP_HOT_FN stft_stream_process_frame(stft_stream_t* stft) {
+    const dsp_context_t* ctx = stft->ctx;
+    float* fft_buffer = stft->fft_buffer;
+    float* power_spectrum = stft->power_spectrum;
+    
+    // Copiar ventana de audio aplicando la ventana precalculada
+    DSP_SPAN_BEGIN(fft_span);
+    ctx->kernels.window(ctx, stft->history, fft_buffer);
+    
+    // FFT real y espectro de potencia
+    dsp_context_power_spectrum(ctx, fft_buffer, power_spectrum);
+    DSP_SPAN_END(fft_span, DSP_STAGE_FFT);
+    
+    float log_mel[MAX_MEL_BANDS];
+    float mfcc[MAX_MFCC_COEFFS];
+    DSP_SPAN_BEGIN(mfcc_span);
+    dsp_context_mel(ctx, power_spectrum, log_mel);
+    dsp_context_dct(ctx, log_mel, mfcc);
+    DSP_SPAN_END(mfcc_span, DSP_STAGE_MFCC);
+    
+    if (stft->want_spectrum) {
+        for (int k = ctx->band_start_bin; k < ctx->band_end_bin; k++) {
+            power_spectrum[k] = fast_logf(power_spectrum[k] + MEL_LOG_FLOOR);
+        }
+    }
+    stft_stream_emit(stft, mfcc);
+}
+
+void DSP_HOT_FN stft_stream_feed(stft_stream_t* stft, const float* block, size_t length) {
+    stft->n_samples += length;
+    
+    while (length > 0) {
+        size_t n = stft->fft_size - stft->fill;
+        if (n > length) {
+            n = length;
+        }
+        
+        float energy = 0.0f;
+        for (size_t i = 0; i < n; i++) {
+            energy += block[i] * block[i];
+        }
+        stft->energy += energy;
+        
+        DSP_SPAN_BEGIN(span);
+        pre_emphasis(block, &stft->history[stft->fill], n, PRE_EMPHASIS_ALPHA, &stft->prev_sample);
+        DSP_SPAN_END(span, DSP_STAGE_PREEMPHASIS);
+        stft->fill += n;
+        block += n;
+        length -= n;
+        
+        if (stft->fill == stft->fft_size) {
+            stft_stream_process_frame(stft);
+            
+            // Desplazar la historia un salto
+            size_t keep = stft->fft_size - stft->hop_length;
+            memmove(stft->history, &stft->history[stft->hop_length], keep * sizeof(float));
+            stft->fill = keep;
+        }
+    }
+}
+
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+// Frame Q15: ventana, FFT sc16 y banco mel con kernels enteros de esp-dsp
+static void DSP_HOT_FN stft_stream_process_frame_q15(stft_stream_t* stft) {
+    const dsp_context_t* ctx = stft->ctx;
+    const int16_t* history = stft->history_q15;
+    
+    DSP_SPAN_BEGIN(fft_span);
+    // Normalizar el frame para que la FFT (1/2 por etapa) conserve resolución:
+    // el pico queda por debajo de 2^14 y el desplazamiento se aplica en la ventana
+    int32_t peak = 0;
+    for (int i = 0; i < stft->fft_size; i++) {
+        int32_t a = history[i] < 0 ? -history[i] : history[i];
+        if (a > peak) peak = a;
+    }
+    int bits = peak ? 32 - __builtin_clz((uint32_t)peak) : 0;
+    int norm = 14 - bits;
+    dsp_port_mul_s16(history, ctx->window_q15, stft->fft_buffer_q15,
+                     stft->fft_size, 15 - norm);
+    
+    int exponent = dsp_context_power_spectrum_q15(ctx, stft->fft_buffer_q15,
+                                                  stft->power_spectrum_q15);
+    DSP_SPAN_END(fft_span, DSP_STAGE_FFT);
+    // Deshacer el 1/2 del pre-énfasis y la normalización del frame
+    exponent += 2 - 2 * norm;
+    
+    // fft_buffer ya no se usa: sirve de espacio temporal para cada banda
+    float log_mel[MAX_MEL_BANDS];
+    float mfcc[MAX_MFCC_COEFFS];
+    DSP_SPAN_BEGIN(mfcc_span);
+    dsp_context_mel_q15(ctx, stft->power_spectrum_q15, exponent,
+                        stft->fft_buffer_q15, log_mel);
+    dsp_context_dct(ctx, log_mel, mfcc);
+    DSP_SPAN_END(mfcc_span, DSP_STAGE_MFCC);
+    
+    if (stft->want_spectrum) {
+        // Convertir in situ a ln(power * 2^exponent) en float
+        const float log_scale = exponent * 0.69314718f;
+        for (int k = ctx->band_start_bin; k < ctx->band_end_bin; k++) {
+            uint32_t p = stft->power_spectrum_q15[k];
+            stft->power_spectrum[k] = fast_logf((float)p + 1.0f) + log_scale;
+        }
+    }
+    stft_stream_emit(stft, mfcc);
+}
+
+// Alimentar el analizador con un bloque Q15
+void DSP_HOT_FN stft_stream_feed_q15(stft_stream_t* stft, const int16_t* block, size_t length) {
+    stft->n_samples += length;
+    
+    while (length > 0) {
+        size_t n = stft->fft_size - stft->fill;
+        if (n > length) {
+            n = length;
+        }
+        
+        int64_t energy = 0;
+        for (size_t i = 0; i < n; i++) {
+            energy += (int32_t)block[i] * block[i];
+        }
+        stft->energy += ldexp((double)energy, -30);
+        
+        DSP_SPAN_BEGIN(span);
+        pre_emphasis_q15(block, &stft->history_q15[stft->fill], n, &stft->prev_sample_q15);
+        DSP_SPAN_END(span, DSP_STAGE_PREEMPHASIS);
+        stft->fill += n;
+        block += n;
+        length -= n;
+        
+        if (stft->fill == stft->fft_size) {
+            stft_stream_process_frame_q15(stft);
+            
+            size_t keep = stft->fft_size - stft->hop_length;
+            memmove(stft->history_q15, &stft->history_q15[stft->hop_length], keep * sizeof(int16_t));
+            stft->fill = keep;
+        }
+    }
+}
+#endif
+
+// ================================
+// GENERACIÓN DE FINGERPRINTS
+// ================================
+
+// Parámetros de la constelación de picos
+#define LANDMARK_CANDIDATES       16     // Máximos locales evaluados por frame
+#define LANDMARK_MAX_DT           32     // Frames máximos entre ancla y destino
+#define LANDMARK_MAX_DF           64     // Bins máximos entre ancla y destino
+#define LANDMARK_THRESH_DECAY     0.05f  // Caída del umbral por frame (ln)
+#define LANDMARK_MASK_SLOPE       0.5f   // Caída de la máscara por bin (ln)
+#define LANDMARK_MASK_WIDTH       8      // Bins a cada lado cubiertos por la máscara
+#define LANDMARK_MIN_LOG_POWER    -18.0f // Umbral inicial absoluto
+
+// Construir el hash de 32 bits de un par de picos
+static inline uint32_t landmark_hash(uint16_t f1, uint16_t f2, uint16_t dt) {
+    return ((uint32_t)(f1 & 0x3FF) << 22) | ((uint32_t)(f2 & 0x3FF) << 12) | (dt & 0xFFF);
+}
+
+void landmark_extractor_reset(landmark_extractor_t* ex) {
+    for (int k = 0; k < AUDIO_DSP_MAX_FFT_SIZE/2 + 1; k++) {
+        ex->threshold[k] = LANDMARK_MIN_LOG_POWER;
+    }
+    ex->n_recent = 0;
+}
+
+size_t DSP_HOT_FN landmark_extractor_frame(landmark_extractor_t* ex, const stft_frame_t* frame,
+                                           landmark_t* out, size_t max_out) {
+    const float* lp = frame->log_power;
+    float* th = ex->threshold;
+    uint16_t cand_bin[LANDMARK_CANDIDATES];
+    float cand_val[LANDMARK_CANDIDATES];
+    int n_cand = 0;
+    
+    // Máximos locales por encima del umbral, ordenados de mayor a menor
+    for (int k = frame->first_bin + 1; k + 1 < frame->end_bin; k++) {
+        th[k] -= LANDMARK_THRESH_DECAY;
+        float v = lp[k];
+        if (v <= th[k] || v <= lp[k - 1] || v < lp[k + 1]) {
+            continue;
+        }
+        int pos = n_cand;
+        while (pos > 0 && cand_val[pos - 1] < v) {
+            pos--;
+        }
+        if (pos >= LANDMARK_CANDIDATES) {
+            continue;
+        }
+        int last = (n_cand < LANDMARK_CANDIDATES) ? n_cand : LANDMARK_CANDIDATES - 1;
+        for (int i = last; i > pos; i--) {
+            cand_bin[i] = cand_bin[i - 1];
+            cand_val[i] = cand_val[i - 1];
+        }
+        cand_bin[pos] = k;
+        cand_val[pos] = v;
+        if (n_cand < LANDMARK_CANDIDATES) n_cand++;
+    }
+    
+    size_t n_out = 0;
+    int accepted = 0;
+    for (int c = 0; c < n_cand && accepted < LANDMARK_PEAKS_PER_FRAME; c++) {
+        uint16_t bin = cand_bin[c];
+        float v = cand_val[c];
+        if (v <= th[bin]) {
+            continue;   // Enmascarado por un pico más fuerte de este frame
+        }
+        
+        // Elevar el umbral alrededor del pico
+        int lo = (bin > LANDMARK_MASK_WIDTH) ? bin - LANDMARK_MASK_WIDTH : 0;
+        int hi = bin + LANDMARK_MASK_WIDTH;
+        if (hi >= frame->end_bin) hi = frame->end_bin - 1;
+        for (int k = lo; k <= hi; k++) {
+            float mask = v - LANDMARK_MASK_SLOPE * abs(k - bin);
+            if (mask > th[k]) th[k] = mask;
+        }
+        accepted++;
+        
+        // Emparejar con anclas anteriores dentro de la zona objetivo. Limitar
+        // también los pares por destino acota el trabajo por frame.
+        uint32_t oldest = (ex->n_recent > LANDMARK_RECENT_PEAKS) ?
+                          ex->n_recent - LANDMARK_RECENT_PEAKS : 0;
+        int pairs = 0;
+        for (uint32_t i = oldest; i < ex->n_recent && n_out < max_out &&
+                                  pairs < LANDMARK_FANOUT; i++) {
+            landmark_peak_t* anchor = &ex->recent[i & (LANDMARK_RECENT_PEAKS - 1)];
+            uint32_t dt = frame->index - anchor->frame;
+            if (dt == 0 || dt > LANDMARK_MAX_DT || anchor->fanout >= LANDMARK_FANOUT ||
+                abs((int)bin - (int)anchor->bin) > LANDMARK_MAX_DF) {
+                continue;
+            }
+            out[n_out].hash = landmark_hash(anchor->bin, bin, dt);
+            out[n_out].offset = anchor->frame;
+            n_out++;
+            pairs++;
+            anchor->fanout++;
+        }
+        
+        landmark_peak_t* peak = &ex->recent[ex->n_recent & (LANDMARK_RECENT_PEAKS - 1)];
+        peak->frame = frame->index;
+        peak->bin = bin;
+        peak->fanout = 0;
+        ex->n_recent++;
+    }
+    return n_out;
+}
+
+void DSP_HOT_FN fingerprint_session_on_frame(const stft_frame_t* frame, void* ctx) {
+    fingerprint_session_t* session = (fingerprint_session_t*)ctx;
+    if (!session->continuous && session->n_frames >= session->max_frames) {
+        return;
+    }
+    for (int k = 0; k < session->n_coeffs; k++) {
+        session->mfcc_sum[k] += frame->mfcc[k];
+        session->mfcc_sq_sum[k] += frame->mfcc[k] * frame->mfcc[k];
+    }
+    session->sum_frames++;
+    
+    if (session->mode == FINGERPRINT_MODE_LANDMARKS) {
+        if (frame->log_power) {
+            landmark_t found[LANDMARK_MAX_PER_FRAME];
+            DSP_SPAN_BEGIN(span);
+            size_t n = landmark_extractor_frame(&session->extractor, frame,
+                                                found, LANDMARK_MAX_PER_FRAME);
+            DSP_SPAN_END(span, DSP_STAGE_HASHING);
+            for (size_t i = 0; i < n; i++) {
+                session->landmarks[session->n_landmarks % session->landmarks_allocated] = found[i];
+                session->n_landmarks++;
+            }
+        }
+    } else {
+        size_t row = session->n_frames % session->max_frames;
+        memcpy(&session->mfcc[row * session->n_coeffs], frame->mfcc,
+               session->n_coeffs * sizeof(float));
+    }
+    session->n_frames++;
+}
+
+esp_err_t fingerprint_session_reset(fingerprint_session_t* session, const stft_stream_t* stft,
+                                    const fingerprint_params_t* params) {
+    const dsp_context_t* ctx = stft->ctx;
+    session->continuous = params->continuous;
+    session->window_seconds = params->window_seconds;
+    session->noise_threshold = params->noise_threshold;
+    size_t samples = (size_t)ctx->sample_rate * params->window_seconds;
+    size_t frames = (samples >= ctx->fft_size) ?
+                    (samples - ctx->fft_size) / stft->hop_length + 1 : 0;
+    if (frames > UINT16_MAX) {
+        frames = UINT16_MAX;
+    }
+    if (frames == 0) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    size_t interval = (size_t)ctx->sample_rate * params->interval_seconds / stft->hop_length;
+    
+    session->mode = (params->mode == FINGERPRINT_MODE_MFCC) ?
+                    FINGERPRINT_MODE_MFCC : FINGERPRINT_MODE_LANDMARKS;
+    
+    // Anillo de la captura y, en modo continuo, copia lineal de la ventana:
+    // se recorren secuencialmente (en el ESP32, arena en PSRAM)
+    bool landmarks = (session->mode == FINGERPRINT_MODE_LANDMARKS);
+    size_t elem_size = landmarks ? sizeof(landmark_t) : sizeof(float);
+    size_t needed = landmarks ? frames * LANDMARK_MAX_PER_FRAME : frames * ctx->n_mfcc;
+    size_t copies = session->continuous ? 2 : 1;
+    if (arena_prepare(session->arena, copies * arena_align(needed * elem_size)) != ESP_OK) {
+        return ESP_ERR_NO_MEM;
+    }
+    void* ring = arena_alloc(session->arena, needed * elem_size);
+    void* window = session->continuous ? arena_alloc(session->arena, needed * elem_size) : NULL;
+    
+    session->mfcc = landmarks ? NULL : ring;
+    session->window_mfcc = landmarks ? NULL : window;
+    session->landmarks = landmarks ? ring : NULL;
+    session->window_landmarks = landmarks ? window : NULL;
+    session->landmarks_allocated = landmarks ? needed : 0;
+    if (landmarks) {
+        landmark_extractor_reset(&session->extractor);
+    }
+    
+    session->n_coeffs = ctx->n_mfcc;
+    session->max_frames = frames;
+    session->interval_frames = (interval > 0 && interval < UINT16_MAX) ? interval : frames;
+    session->n_frames = 0;
+    session->last_emit_frame = 0;
+    session->n_landmarks = 0;
+    session->sum_frames = 0;
+    memset(session->mfcc_sum, 0, sizeof(session->mfcc_sum));
+    memset(session->mfcc_sq_sum, 0, sizeof(session->mfcc_sq_sum));
+    return ESP_OK;
+}
+
+void fingerprint_session_mark_emitted(fingerprint_session_t* session, stft_stream_t* stft) {
+    session->last_emit_frame = session->n_frames;
+    session->sum_frames = 0;
+    memset(session->mfcc_sum, 0, sizeof(session->mfcc_sum));
+    memset(session->mfcc_sq_sum, 0, sizeof(session->mfcc_sq_sum));
+    stft->energy = 0.0;
+    stft->n_samples = 0;
+}
+
+// Copiar la ventana deslizante en orden cronológico. Los offsets de los
+// landmarks pasan a ser relativos al primer frame de la ventana.
+static void fingerprint_session_linearize(fingerprint_session_t* session, uint32_t start,
+                                          fingerprint_t* fingerprint) {
+    if (session->mode == FINGERPRINT_MODE_LANDMARKS) {
+        size_t capacity = session->landmarks_allocated;
+        uint32_t oldest = (session->n_landmarks > capacity) ? session->n_landmarks - capacity : 0;
+        uint32_t n = 0;
+        for (uint32_t i = oldest; i < session->n_landmarks; i++) {
+            const landmark_t* lm = &session->landmarks[i % capacity];
+            if (lm->offset >= start) {
+                session->window_landmarks[n].hash = lm->hash;
+                session->window_landmarks[n].offset = lm->offset - start;
+                n++;
+            }
+        }
+        fingerprint->landmarks = session->window_landmarks;
+        fingerprint->n_landmarks = n;
+    } else {
+        size_t row_bytes = session->n_coeffs * sizeof(float);
+        size_t first = start % session->max_frames;
+        size_t rows = session->n_frames - start;
+        size_t head = (first + rows > session->max_frames) ? session->max_frames - first : rows;
+        memcpy(session->window_mfcc, &session->mfcc[first * session->n_coeffs], head * row_bytes);
+        memcpy(&session->window_mfcc[head * session->n_coeffs], session->mfcc,
+               (rows - head) * row_bytes);
+        fingerprint->mfcc = session->window_mfcc;
+    }
+}
+
+fingerprint_status_t generate_fingerprint(stft_stream_t* stft, fingerprint_session_t* session,
+                                          uint64_t timestamp, fingerprint_t* fingerprint) {
+    if (stft->n_samples == 0 || stft->energy / stft->n_samples < session->noise_threshold ||
+        session->sum_frames == 0) {
+        fingerprint->confidence = 0.0;
+        return FINGERPRINT_NOISE;
+    }
+    
+    DSP_SPAN_BEGIN(span);
+    uint32_t start = (session->n_frames > session->max_frames) ?
+                     session->n_frames - session->max_frames : 0;
+    fingerprint->mode = session->mode;
+    fingerprint->n_frames = session->n_frames - start;
+    fingerprint->n_coeffs = session->n_coeffs;
+    fingerprint->mfcc = NULL;
+    fingerprint->landmarks = NULL;
+    fingerprint->n_landmarks = 0;
+    
+    if (session->continuous) {
+        fingerprint_session_linearize(session, start, fingerprint);
+    } else if (session->mode == FINGERPRINT_MODE_LANDMARKS) {
+        fingerprint->landmarks = session->landmarks;
+        fingerprint->n_landmarks = session->n_landmarks;
+    } else {
+        fingerprint->mfcc = session->mfcc;
+    }
+    
+    // Generar hash único de las características
+    if (session->mode == FINGERPRINT_MODE_LANDMARKS) {
+        if (fingerprint->n_landmarks == 0) {
+            fingerprint->confidence = 0.0;
+            return FINGERPRINT_NO_PEAKS;
+        }
+        calculate_md5(fingerprint->landmarks,
+                      fingerprint->n_landmarks * sizeof(landmark_t), fingerprint->hash);
+    } else {
+        calculate_md5(fingerprint->mfcc,
+                      fingerprint->n_frames * fingerprint->n_coeffs * sizeof(float),
+                      fingerprint->hash);
+    }
+    
+    // Calcular confianza sobre el vector MFCC medio del último intervalo
+    float mfcc_mean[MAX_MFCC_COEFFS];
+    float energy = 0.0, variance = 0.0, mean = 0.0;
+    for (int k = 0; k < session->n_coeffs; k++) {
+        mfcc_mean[k] = session->mfcc_sum[k] / session->sum_frames;
+        energy += mfcc_mean[k] * mfcc_mean[k];
+        mean += mfcc_mean[k];
+    }
+    mean /= session->n_coeffs;
+    
+    for (int k = 0; k < session->n_coeffs; k++) {
+        float diff = mfcc_mean[k] - mean;
+        variance += diff * diff;
+    }
+    variance /= session->n_coeffs;
+    
+    fingerprint->confidence = fminf(1.0, sqrtf(energy) * sqrtf(variance) * 10.0);
+    
+    // Firma: media y desviación por coeficiente; c0 (nivel) se omite para
+    // que un cambio de volumen no cuente como cambio de contenido
+    fingerprint->signature_len = 0;
+    for (int k = 1; k < session->n_coeffs; k++) {
+        float var = session->mfcc_sq_sum[k] / session->sum_frames - mfcc_mean[k] * mfcc_mean[k];
+        fingerprint->signature[fingerprint->signature_len++] = mfcc_mean[k];
+        fingerprint->signature[fingerprint->signature_len++] = sqrtf(fmaxf(var, 0.0f));
+    }
+    fingerprint->timestamp = timestamp;
+    fingerprint->duration = session->window_seconds;
+    DSP_SPAN_END(span, DSP_STAGE_FINGERPRINT);
+    return FINGERPRINT_OK;
+}
+
+// ================================
+// COLOCACIÓN EN MEMORIA
+// ================================
+
+typedef struct {
+    dsp_placement_t* out;
+    size_t max;
+    size_t count;
+} placement_list_t;
+
+static void placement_add(placement_list_t* list, const char* name, const void* addr,
+                          size_t bytes, bool code, bool hot) {
+    if (addr == NULL || list->count >= list->max) {
+        return;
+    }
+    list->out[list->count++] = (dsp_placement_t){
+        .name = name, .addr = addr, .bytes = bytes, .code = code, .hot = hot
+    };
+}
+
+#define PLACEMENT_CODE(list, fn)  placement_add(list, #fn, (const void*)(fn), 0, true, true)
+
+size_t dsp_placement_list(const stft_stream_t* stft, const fingerprint_session_t* session,
+                          dsp_placement_t* out, size_t max) {
+    placement_list_t list = { .out = out, .max = max, .count = 0 };
+    const dsp_context_t* ctx = stft->ctx;
+    bool fixed = false;
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+    fixed = (ctx->mode == DSP_MODE_FIXED);
+#endif
+
+    // Código por frame
+    PLACEMENT_CODE(&list, stft_stream_feed);
+    PLACEMENT_CODE(&list, stft_stream_process_frame);
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+    PLACEMENT_CODE(&list, stft_stream_feed_q15);
+    PLACEMENT_CODE(&list, stft_stream_process_frame_q15);
+#endif
+    PLACEMENT_CODE(&list, decimator_process);
+    PLACEMENT_CODE(&list, landmark_extractor_frame);
+    PLACEMENT_CODE(&list, fingerprint_session_on_frame);
+    placement_add(&list, "kernels.window", (const void*)ctx->kernels.window, 0, true, true);
+    placement_add(&list, "kernels.power_spectrum", (const void*)ctx->kernels.power_spectrum,
+                  0, true, true);
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+    placement_add(&list, "kernels.power_spectrum_q15",
+                  (const void*)ctx->kernels.power_spectrum_q15, 0, true, true);
+#endif
+#define PLACEMENT_KERNEL(fn)  PLACEMENT_CODE(&list, fn);
+    DSP_PORT_HOT_KERNELS(PLACEMENT_KERNEL)
+#undef PLACEMENT_KERNEL
+
+    // Tablas del contexto y buffers por frame (arena del analizador)
+    size_t bins = ctx->fft_points / 2 + 1;
+    const mel_band_t* last = &ctx->mel_bands[ctx->n_mels - 1];
+    size_t n_weights = last->weight_offset + last->n_bins;
+    if (fixed) {
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+        placement_add(&list, "window_q15", ctx->window_q15, ctx->fft_size * sizeof(int16_t),
+                      false, true);
+        placement_add(&list, "twiddles_q15", ctx->twiddles_q15,
+                      ctx->fft_points * sizeof(int16_t), false, true);
+        placement_add(&list, "split_twiddles_q15", ctx->split_twiddles_q15,
+                      bins * 2 * sizeof(int16_t), false, true);
+        placement_add(&list, "mel_weights_q15", ctx->mel_weights_q15,
+                      n_weights * sizeof(int16_t), false, true);
+#endif
+    } else {
+        placement_add(&list, "window", ctx->window, ctx->fft_size * sizeof(float), false, true);
+        placement_add(&list, "twiddles", ctx->twiddles, ctx->fft_points * sizeof(float),
+                      false, true);
+        placement_add(&list, "split_twiddles", ctx->split_twiddles, bins * 2 * sizeof(float),
+                      false, true);
+        placement_add(&list, "mel_weights", ctx->mel_weights, n_weights * sizeof(float),
+                      false, true);
+    }
+    placement_add(&list, "dct", ctx->dct, ctx->n_mfcc * ctx->n_mels * sizeof(float), false, true);
+    placement_add(&list, "stft.history", stft->history, stft->fft_size * sizeof(float),
+                  false, true);
+    placement_add(&list, "stft.fft_buffer", stft->fft_buffer, stft->fft_size * sizeof(float),
+                  false, true);
+    placement_add(&list, "stft.power_spectrum", stft->power_spectrum,
+                  (stft->fft_size / 2 + 1) * sizeof(float), false, true);
+    placement_add(&list, "landmark_extractor", &session->extractor, sizeof(session->extractor),
+                  false, true);
+
+    // Historia de la ventana: se recorre secuencialmente, puede ir a PSRAM
+    size_t ring_bytes = session->landmarks ?
+                        session->landmarks_allocated * sizeof(landmark_t) :
+                        (size_t)session->max_frames * session->n_coeffs * sizeof(float);
+    placement_add(&list, "session.mfcc", session->mfcc, ring_bytes, false, false);
+    placement_add(&list, "session.landmarks", session->landmarks, ring_bytes, false, false);
+    placement_add(&list, "session.window_mfcc", session->window_mfcc, ring_bytes, false, false);
+    placement_add(&list, "session.window_landmarks", session->window_landmarks, ring_bytes,
+                  false, false);
+    return list.count;
+}
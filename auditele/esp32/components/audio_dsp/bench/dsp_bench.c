@@ -0,0 +1,379 @@
+/*
+ * Benchmark del pipeline DSP en el host
+ *
+ * Pasa cada WAV, remuestreado a DSP_CAPTURE_RATE como lo entregaría el
+ * I2S, por el diezmador y los 5 presets de calidad, en modo MFCC y
+ * landmarks (éstos con el análisis común de dsp_preset_analysis), y reporta frames/s, ns/frame y el reparto por etapa. El digest MD5 de
+ * los fingerprints de cada combinación se puede comparar con un fichero
+ * golden para detectar cambios de salida al optimizar.
+ *
+ * Uso: dsp_bench [--golden FICHERO | --update-golden FICHERO] [wav...]
+ * Sin WAVs se usa una señal sintética determinista.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "audio_dsp.h"
+
+#define BENCH_HOP_LENGTH      512
+#define BENCH_MIN_FREQ        300.0f
+#define BENCH_MAX_FREQ        8000.0f
+#define BENCH_WINDOW_SECONDS  10
+#define BENCH_BLOCK_SAMPLES   960    // Igual que CAPTURE_BLOCK_SAMPLES (a DSP_CAPTURE_RATE)
+#define BENCH_SYNTH_SECONDS   60
+#define BENCH_MAX_GOLDEN      256
+
+// ================================
+// ENTRADA
+// ================================
+
+typedef struct {
+    char name[64];
+    float* samples;            // Mono en [-1, 1)
+    size_t length;
+    uint32_t sample_rate;
+} bench_audio_t;
+
+static uint32_t read_le(const uint8_t* p, int bytes) {
+    uint32_t v = 0;
+    for (int i = 0; i < bytes; i++) {
+        v |= (uint32_t)p[i] << (8 * i);
+    }
+    return v;
+}
+
+// WAV PCM de 16 bits; los canales se promedian
+static bool wav_load(const char* path, bench_audio_t* audio) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "%s: no se puede abrir\n", path);
+        return false;
+    }
+    uint8_t riff[12];
+    if (fread(riff, 1, 12, f) != 12 || memcmp(riff, "RIFF", 4) || memcmp(riff + 8, "WAVE", 4)) {
+        fprintf(stderr, "%s: no es un WAV\n", path);
+        fclose(f);
+        return false;
+    }
+
+    uint16_t channels = 0, bits = 0;
+    uint8_t chunk[8];
+    bool ok = false;
+    while (fread(chunk, 1, 8, f) == 8) {
+        uint32_t size = read_le(chunk + 4, 4);
+        if (!memcmp(chunk, "fmt ", 4)) {
+            uint8_t fmt[16];
+            if (size < 16 || fread(fmt, 1, 16, f) != 16) {
+                break;
+            }
+            channels = read_le(fmt + 2, 2);
+            audio->sample_rate = read_le(fmt + 4, 4);
+            bits = read_le(fmt + 14, 2);
+            fseek(f, size - 16 + (size & 1), SEEK_CUR);
+        } else if (!memcmp(chunk, "data", 4)) {
+            if (bits != 16 || channels == 0) {
+                fprintf(stderr, "%s: sólo PCM de 16 bits\n", path);
+                break;
+            }
+            size_t frames = size / (2 * channels);
+            int16_t* pcm = malloc(frames * channels * sizeof(int16_t));
+            audio->samples = malloc(frames * sizeof(float));
+            if (pcm && audio->samples) {
+                frames = fread(pcm, 2 * channels, frames, f);
+                for (size_t i = 0; i < frames; i++) {
+                    int32_t sum = 0;
+                    for (int c = 0; c < channels; c++) {
+                        sum += pcm[i * channels + c];
+                    }
+                    audio->samples[i] = (float)sum / (32768.0f * channels);
+                }
+                audio->length = frames;
+                ok = true;
+            }
+            free(pcm);
+            break;
+        } else {
+            fseek(f, size + (size & 1), SEEK_CUR);
+        }
+    }
+    fclose(f);
+
+    const char* base = strrchr(path, '/');
+    snprintf(audio->name, sizeof(audio->name), "%s", base ? base + 1 : path);
+    return ok;
+}
+
+// Tonos que cambian cada segundo sobre ruido: picos claros y MFCC variables
+static void synth_audio(bench_audio_t* audio) {
+    audio->sample_rate = DSP_CAPTURE_RATE;
+    audio->length = (size_t)audio->sample_rate * BENCH_SYNTH_SECONDS;
+    audio->samples = malloc(audio->length * sizeof(float));
+    snprintf(audio->name, sizeof(audio->name), "synthetic");
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < audio->length; i++) {
+        float t = (float)i / audio->sample_rate;
+        int second = (int)t;
+        float f1 = 400.0f + 137.0f * (second % 11);
+        float f2 = 1200.0f + 311.0f * (second % 7);
+        seed = seed * 1664525u + 1013904223u;
+        float noise = ((int32_t)seed >> 8) / 8388608.0f;
+        audio->samples[i] = 0.3f * sinf(2.0f * (float)M_PI * f1 * t) +
+                            0.2f * sinf(2.0f * (float)M_PI * f2 * t) + 0.02f * noise;
+    }
+}
+
+// Remuestreo lineal a `rate`, como una captura del I2S a esa tasa
+static float* resample(const bench_audio_t* audio, uint32_t rate, size_t* length) {
+    double step = (double)audio->sample_rate / rate;
+    size_t n = (size_t)((audio->length - 1) / step);
+    float* out = malloc(n * sizeof(float));
+    for (size_t i = 0; i < n; i++) {
+        double pos = i * step;
+        size_t k = (size_t)pos;
+        float frac = (float)(pos - k);
+        out[i] = audio->samples[k] * (1.0f - frac) + audio->samples[k + 1] * frac;
+    }
+    *length = n;
+    return out;
+}
+
+// ================================
+// MEDICIÓN
+// ================================
+
+static uint64_t stage_cycles[DSP_STAGE_COUNT];
+
+static void bench_span(dsp_stage_t stage, uint32_t cycles) {
+    stage_cycles[stage] += cycles;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+typedef struct {
+    uint32_t frames;
+    uint32_t fingerprints;
+    uint32_t landmarks;
+    double ns;
+    double decimate_ns;        // Parte de `ns` en el diezmador
+    char digest[33];           // MD5 de los hashes de todas las ventanas
+} bench_result_t;
+
+static arena_t hot_arena = { .name = "hot" };
+static arena_t bulk_arena = { .name = "bulk" };
+static dsp_context_t dsp_ctx;
+static stft_stream_t stft;
+static fingerprint_session_t session;
+static decimator_t decimator;
+
+// `samples` a DSP_CAPTURE_RATE; cada ventana se diezma bloque a bloque
+static bool bench_run(const float* samples, size_t length, const dsp_preset_t* preset,
+                      fingerprint_mode_t mode, bench_result_t* result) {
+    dsp_params_t params = {
+        .sample_rate = preset->sample_rate,
+        .fft_size = preset->fft_size,
+        .hop_length = BENCH_HOP_LENGTH,
+        .n_mels = preset->n_mels,
+        .n_mfcc = preset->n_mfcc,
+        .min_freq = BENCH_MIN_FREQ,
+        .max_freq = BENCH_MAX_FREQ,
+        .mode = preset->mode,
+    };
+    fingerprint_params_t fp_params = {
+        .mode = mode,
+        .window_seconds = BENCH_WINDOW_SECONDS,
+        .interval_seconds = BENCH_WINDOW_SECONDS,
+        .noise_threshold = 0.0001f,
+    };
+    size_t window = (size_t)DSP_CAPTURE_RATE * BENCH_WINDOW_SECONDS;
+    size_t n_windows = length / window;
+    char* hashes = calloc(n_windows + 1, 32);
+    int16_t native_q15[BENCH_BLOCK_SAMPLES];
+    float block[BENCH_BLOCK_SAMPLES];
+    int16_t block_q15[BENCH_BLOCK_SAMPLES];
+    if (decimator_init(&decimator, DSP_CAPTURE_RATE, preset->sample_rate) != ESP_OK) {
+        free(hashes);
+        return false;
+    }
+
+    memset(result, 0, sizeof(*result));
+    memset(stage_cycles, 0, sizeof(stage_cycles));
+    // Cada combinación empieza con tablas nuevas, como tras un cambio de preset
+    dsp_context_free(&dsp_ctx);
+    stft_stream_init(&stft, &dsp_ctx, &hot_arena, fingerprint_session_on_frame, &session);
+    session.arena = &bulk_arena;
+
+    double start = now_ns();
+    for (size_t w = 0; w < n_windows; w++) {
+        if (stft_stream_reset(&stft, &params) != ESP_OK ||
+            fingerprint_session_reset(&session, &stft, &fp_params) != ESP_OK) {
+            free(hashes);
+            return false;
+        }
+        stft.want_spectrum = (mode == FINGERPRINT_MODE_LANDMARKS);
+        decimator_reset(&decimator);
+        const float* in = &samples[w * window];
+        for (size_t i = 0; i < window; i += BENCH_BLOCK_SAMPLES) {
+            size_t n = (window - i < BENCH_BLOCK_SAMPLES) ? window - i : BENCH_BLOCK_SAMPLES;
+            if (dsp_ctx.mode == DSP_MODE_FIXED) {
+                for (size_t k = 0; k < n; k++) {
+                    float v = in[i + k] * 32768.0f;
+                    native_q15[k] = (int16_t)(v > 32767.0f ? 32767 : v < -32768.0f ? -32768 : v);
+                }
+                double t = now_ns();
+                n = decimator_process_q15(&decimator, native_q15, block_q15, n);
+                result->decimate_ns += now_ns() - t;
+                stft_stream_feed_q15(&stft, block_q15, n);
+            } else {
+                double t = now_ns();
+                n = decimator_process(&decimator, &in[i], block, n);
+                result->decimate_ns += now_ns() - t;
+                stft_stream_feed(&stft, block, n);
+            }
+        }
+
+        fingerprint_t fingerprint;
+        if (generate_fingerprint(&stft, &session, w, &fingerprint) == FINGERPRINT_OK) {
+            memcpy(&hashes[result->fingerprints * 32], fingerprint.hash, 32);
+            result->fingerprints++;
+            result->landmarks += fingerprint.n_landmarks;
+        }
+        result->frames += stft.n_frames;
+    }
+    result->ns = now_ns() - start;
+    calculate_md5(hashes, result->fingerprints * 32, result->digest);
+    free(hashes);
+    return true;
+}
+
+// ================================
+// GOLDEN
+// ================================
+
+typedef struct {
+    char key[96];
+    char digest[33];
+} golden_t;
+
+static golden_t golden[BENCH_MAX_GOLDEN];
+static int n_golden = 0;
+
+static void golden_load(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        return;
+    }
+    while (n_golden < BENCH_MAX_GOLDEN &&
+           fscanf(f, "%95s %32s", golden[n_golden].key, golden[n_golden].digest) == 2) {
+        n_golden++;
+    }
+    fclose(f);
+}
+
+static const char* golden_find(const char* key) {
+    for (int i = 0; i < n_golden; i++) {
+        if (!strcmp(golden[i].key, key)) {
+            return golden[i].digest;
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    const char* golden_path = NULL;
+    bool update = false;
+    int first_wav = 1;
+    if (argc > 2 && (!strcmp(argv[1], "--golden") || !strcmp(argv[1], "--update-golden"))) {
+        golden_path = argv[2];
+        update = !strcmp(argv[1], "--update-golden");
+        first_wav = 3;
+    }
+    for (int i = first_wav; i < argc; i++) {
+        // Opción desconocida, mal escrita o sin fichero: no tratarla como WAV
+        if (argv[i][0] == '-') {
+            fprintf(stderr, "Uso: %s [--golden FICHERO | --update-golden FICHERO] [wav...]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (golden_path && !update) {
+        golden_load(golden_path);
+    }
+    FILE* golden_out = update ? fopen(golden_path, "w") : NULL;
+
+    int n_audio = (argc > first_wav) ? argc - first_wav : 1;
+    bench_audio_t* audio = calloc(n_audio, sizeof(bench_audio_t));
+    if (argc > first_wav) {
+        for (int i = 0; i < n_audio; i++) {
+            if (!wav_load(argv[first_wav + i], &audio[i])) {
+                return 1;
+            }
+        }
+    } else {
+        synth_audio(&audio[0]);
+    }
+
+    dsp_set_span_hook(bench_span);
+    printf("%-20s %-3s %-9s %7s %10s %9s %6s  %-40s %s\n", "wav", "q", "mode", "frames",
+           "frames/s", "ns/frame", "decim%", "preemph/fft/mfcc/hashing/fingerprint %", "digest");
+
+    int failures = 0;
+    for (int a = 0; a < n_audio; a++) {
+        size_t length;
+        float* samples = resample(&audio[a], DSP_CAPTURE_RATE, &length);
+        for (uint8_t level = 1; level <= DSP_PRESET_COUNT; level++) {
+            for (int mode = FINGERPRINT_MODE_MFCC; mode <= FINGERPRINT_MODE_LANDMARKS; mode++) {
+                const dsp_preset_t* preset = dsp_preset_analysis(level, mode);
+                bench_result_t r;
+                if (!bench_run(samples, length, preset, mode, &r)) {
+                    fprintf(stderr, "Sin memoria para el preset %d\n", level);
+                    return 1;
+                }
+
+                uint64_t total = 0;
+                for (int s = 0; s < DSP_STAGE_COUNT; s++) {
+                    total += stage_cycles[s];
+                }
+                char split[64];
+                int pos = 0;
+                for (int s = 0; s < DSP_STAGE_COUNT; s++) {
+                    pos += snprintf(split + pos, sizeof(split) - pos, "%s%.1f", s ? "/" : "",
+                                    total ? 100.0 * stage_cycles[s] / total : 0.0);
+                }
+
+                const char* mode_name = (mode == FINGERPRINT_MODE_LANDMARKS) ? "landmarks" : "mfcc";
+                printf("%-20.20s %-3d %-9s %7u %10.0f %9.0f %6.1f  %-40s %s\n", audio[a].name,
+                       level, mode_name, r.frames, r.frames * 1e9 / r.ns,
+                       r.frames ? r.ns / r.frames : 0.0, 100.0 * r.decimate_ns / r.ns,
+                       split, r.digest);
+
+                char key[96];
+                snprintf(key, sizeof(key), "%s:%d:%s", audio[a].name, level, mode_name);
+                if (golden_out) {
+                    fprintf(golden_out, "%s %s\n", key, r.digest);
+                } else if (golden_path) {
+                    const char* expected = golden_find(key);
+                    if (expected == NULL || strcmp(expected, r.digest)) {
+                        printf("  GOLDEN distinto para %s: esperado %s\n", key,
+                               expected ? expected : "(ausente)");
+                        failures++;
+                    }
+                }
+            }
+        }
+        free(samples);
+        free(audio[a].samples);
+    }
+
+    if (golden_out) {
+        fclose(golden_out);
+    }
+    free(audio);
+    return failures ? 1 : 0;
+}
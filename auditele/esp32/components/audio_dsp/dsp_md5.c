@@ -0,0 +1,111 @@
+/*
+ * MD5 (RFC 1321) para el hash de los fingerprints
+ * Propio del componente para no depender de la biblioteca criptográfica
+ * de cada plataforma; sólo se calcula una vez por fingerprint.
+ */
+
+#include <string.h>
+#include "audio_dsp.h"
+
+typedef struct {
+    uint32_t state[4];
+    uint64_t length;           // Bytes procesados
+    uint8_t block[64];
+} md5_ctx_t;
+
+static const uint32_t md5_k[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const uint8_t md5_r[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+static void md5_transform(uint32_t state[4], const uint8_t block[64]) {
+    uint32_t w[16];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)block[i*4] | ((uint32_t)block[i*4 + 1] << 8) |
+               ((uint32_t)block[i*4 + 2] << 16) | ((uint32_t)block[i*4 + 3] << 24);
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    for (int i = 0; i < 64; i++) {
+        uint32_t f;
+        int g;
+        if (i < 16) {
+            f = (b & c) | (~b & d);
+            g = i;
+        } else if (i < 32) {
+            f = (d & b) | (~d & c);
+            g = (5 * i + 1) & 15;
+        } else if (i < 48) {
+            f = b ^ c ^ d;
+            g = (3 * i + 5) & 15;
+        } else {
+            f = c ^ (b | ~d);
+            g = (7 * i) & 15;
+        }
+        uint32_t t = a + f + md5_k[i] + w[g];
+        a = d;
+        d = c;
+        c = b;
+        b += (t << md5_r[i]) | (t >> (32 - md5_r[i]));
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
+
+static void md5_update(md5_ctx_t* ctx, const uint8_t* data, size_t len) {
+    size_t used = ctx->length & 63;
+    ctx->length += len;
+    while (len > 0) {
+        size_t n = 64 - used;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(&ctx->block[used], data, n);
+        used += n;
+        data += n;
+        len -= n;
+        if (used == 64) {
+            md5_transform(ctx->state, ctx->block);
+            used = 0;
+        }
+    }
+}
+
+void calculate_md5(const void* data, size_t len, char* output) {
+    md5_ctx_t ctx = {
+        .state = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 },
+    };
+    md5_update(&ctx, data, len);
+
+    // Relleno: 0x80, ceros hasta 56 mód 64 y la longitud en bits
+    uint64_t bits = ctx.length * 8;
+    uint8_t pad[72] = { 0x80 };
+    size_t pad_len = ((ctx.length & 63) < 56) ? 56 - (ctx.length & 63) : 120 - (ctx.length & 63);
+    for (int i = 0; i < 8; i++) {
+        pad[pad_len + i] = (uint8_t)(bits >> (8 * i));
+    }
+    md5_update(&ctx, pad, pad_len + 8);
+
+    static const char hex[] = "0123456789abcdef";
+    for (int i = 0; i < 16; i++) {
+        uint8_t byte = (uint8_t)(ctx.state[i / 4] >> (8 * (i % 4)));
+        output[i*2] = hex[byte >> 4];
+        output[i*2 + 1] = hex[byte & 0x0F];
+    }
+    output[32] = '\0';
+}
@@ -0,0 +1,230 @@
+/*
+ * Kernels portables del pipeline DSP para compilar fuera del ESP32
+ * Mismo algoritmo y formato de tablas que las versiones ansi de esp-dsp
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#include "audio_dsp.h"
+#include "dsp_port.h"
+
+#if defined(__XTENSA__)
+uint32_t DSP_HOT_FN dsp_cycles(void) {
+    uint32_t ccount;
+    __asm__ __volatile__("rsr %0, ccount" : "=a"(ccount));
+    return ccount;
+}
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+uint32_t DSP_HOT_FN dsp_cycles(void) {
+    return (uint32_t)__rdtsc();
+}
+#else
+#include <time.h>
+uint32_t DSP_HOT_FN dsp_cycles(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec);
+}
+#endif
+
+#ifndef ESP_PLATFORM
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Factores (cos, sin) de n/2 puntos, como dsps_gen_w_r2_fc32
+void dsp_port_gen_w_r2_fc32(float* w, int n) {
+    float e = M_PI * 2.0 / n;
+    for (int i = 0; i < (n >> 1); i++) {
+        w[2 * i] = cosf(i * e);
+        w[2 * i + 1] = sinf(i * e);
+    }
+}
+
+// Reordenamiento bit-reverso de n puntos complejos
+void dsp_port_bit_rev_fc32(float* data, int n) {
+    int j = 0;
+    for (int i = 1; i < n - 1; i++) {
+        int k = n >> 1;
+        while (k <= j) {
+            j -= k;
+            k >>= 1;
+        }
+        j += k;
+        if (i < j) {
+            float re = data[j * 2], im = data[j * 2 + 1];
+            data[j * 2] = data[i * 2];
+            data[j * 2 + 1] = data[i * 2 + 1];
+            data[i * 2] = re;
+            data[i * 2 + 1] = im;
+        }
+    }
+}
+
+// FFT radix-2 in-place con factores en orden bit-reverso; la salida
+// queda en orden bit-reverso
+void dsp_port_fft2r_fc32(float* data, int n, const float* w) {
+    int ie = 1;
+    for (int n2 = n / 2; n2 > 0; n2 >>= 1) {
+        int ia = 0;
+        for (int j = 0; j < ie; j++) {
+            float c = w[2 * j];
+            float s = w[2 * j + 1];
+            for (int i = 0; i < n2; i++) {
+                int m = ia + n2;
+                float re = c * data[2 * m] + s * data[2 * m + 1];
+                float im = c * data[2 * m + 1] - s * data[2 * m];
+                data[2 * m] = data[2 * ia] - re;
+                data[2 * m + 1] = data[2 * ia + 1] - im;
+                data[2 * ia] += re;
+                data[2 * ia + 1] += im;
+                ia++;
+            }
+            ia += n2;
+        }
+        ie <<= 1;
+    }
+}
+
+void dsp_port_gen_w_r2_sc16(int16_t* w, int n) {
+    float e = M_PI * 2.0 / n;
+    for (int i = 0; i < (n >> 1); i++) {
+        w[2 * i] = (int16_t)(INT16_MAX * cosf(i * e));
+        w[2 * i + 1] = (int16_t)(INT16_MAX * sinf(i * e));
+    }
+}
+
+void dsp_port_bit_rev_sc16(int16_t* data, int n) {
+    uint32_t* z = (uint32_t*)data;
+    int j = 0;
+    for (int i = 1; i < n - 1; i++) {
+        int k = n >> 1;
+        while (k <= j) {
+            j -= k;
+            k >>= 1;
+        }
+        j += k;
+        if (i < j) {
+            uint32_t t = z[j];
+            z[j] = z[i];
+            z[i] = t;
+        }
+    }
+}
+
+// FFT sc16: cada mariposa escala por 1/2 con redondeo, como esp-dsp
+void dsp_port_fft2r_sc16(int16_t* data, int n, const int16_t* w) {
+    int ie = 1;
+    for (int n2 = n / 2; n2 > 0; n2 >>= 1) {
+        int ia = 0;
+        for (int j = 0; j < ie; j++) {
+            int32_t c = w[2 * j];
+            int32_t s = w[2 * j + 1];
+            for (int i = 0; i < n2; i++) {
+                int m = ia + n2;
+                int32_t ar = data[2 * ia], ai = data[2 * ia + 1];
+                int32_t mr = data[2 * m], mi = data[2 * m + 1];
+                int32_t re = c * mr + s * mi;
+                int32_t im = c * mi - s * mr;
+                data[2 * m] = (int16_t)(((ar << 15) - re + 0x7fff) >> 16);
+                data[2 * m + 1] = (int16_t)(((ai << 15) - im + 0x7fff) >> 16);
+                data[2 * ia] = (int16_t)(((ar << 15) + re + 0x7fff) >> 16);
+                data[2 * ia + 1] = (int16_t)(((ai << 15) + im + 0x7fff) >> 16);
+                ia++;
+            }
+            ia += n2;
+        }
+        ie <<= 1;
+    }
+}
+
+void dsp_port_dotprod_s16(const int16_t* a, const int16_t* b, int16_t* dest, int len, int8_t shift) {
+    int64_t acc = 0x7fff >> shift;
+    for (int i = 0; i < len; i++) {
+        acc += (int32_t)a[i] * (int32_t)b[i];
+    }
+    int final_shift = shift - 15;
+    *dest = (int16_t)(final_shift > 0 ? (acc << final_shift) : (acc >> -final_shift));
+}
+
+void dsp_port_mul_s16(const int16_t* a, const int16_t* b, int16_t* out, int len, int shift) {
+    for (int i = 0; i < len; i++) {
+        out[i] = (int16_t)(((int32_t)a[i] * (int32_t)b[i]) >> shift);
+    }
+}
+
+// FIR diezmador: `len` muestras de salida, cada una tras insertar `decim`
+// de entrada. delay[pos] es la más antigua y se multiplica por coeffs[0].
+void dsp_port_fird_init_f32(dsp_fir_f32_t* fir, float* coeffs, float* delay, int n, int decim) {
+    fir->coeffs = coeffs;
+    fir->delay = delay;
+    fir->N = n;
+    fir->pos = 0;
+    fir->decim = decim;
+}
+
+int dsp_port_fird_f32(dsp_fir_f32_t* fir, const float* in, float* out, int len) {
+    for (int i = 0; i < len; i++) {
+        for (int k = 0; k < fir->decim; k++) {
+            fir->delay[fir->pos++] = *in++;
+            if (fir->pos >= fir->N) {
+                fir->pos = 0;
+            }
+        }
+        float acc = 0.0f;
+        int c = 0;
+        for (int n = fir->pos; n < fir->N; n++) {
+            acc += fir->coeffs[c++] * fir->delay[n];
+        }
+        for (int n = 0; n < fir->pos; n++) {
+            acc += fir->coeffs[c++] * fir->delay[n];
+        }
+        out[i] = acc;
+    }
+    return len;
+}
+
+void dsp_port_fird_init_s16(dsp_fir_s16_t* fir, int16_t* coeffs, int16_t* delay, int n, int decim) {
+    fir->coeffs = coeffs;
+    fir->delay = delay;
+    fir->coeffs_len = (int16_t)n;
+    fir->pos = 0;
+    fir->decim = (int16_t)decim;
+    fir->shift = 0;
+}
+
+// Acumulador de 64 bits y redondeo como dsp_port_dotprod_s16
+int dsp_port_fird_s16(dsp_fir_s16_t* fir, const int16_t* in, int16_t* out, int len) {
+    int final_shift = fir->shift - 15;
+    for (int i = 0; i < len; i++) {
+        for (int k = 0; k < fir->decim; k++) {
+            fir->delay[fir->pos++] = *in++;
+            if (fir->pos >= fir->coeffs_len) {
+                fir->pos = 0;
+            }
+        }
+        int64_t acc = 0x7fff >> fir->shift;
+        int c = 0;
+        for (int n = fir->pos; n < fir->coeffs_len; n++) {
+            acc += (int32_t)fir->coeffs[c++] * fir->delay[n];
+        }
+        for (int n = 0; n < fir->pos; n++) {
+            acc += (int32_t)fir->coeffs[c++] * fir->delay[n];
+        }
+        out[i] = (int16_t)(final_shift > 0 ? (acc << final_shift) : (acc >> -final_shift));
+    }
+    return len;
+}
+
+void* dsp_port_aligned_alloc(size_t align, size_t bytes, uint32_t caps) {
+    (void)caps;
+    return aligned_alloc(align, (bytes + align - 1) & ~(align - 1));
+}
+
+void dsp_port_free(void* ptr) {
+    free(ptr);
+}
+
+#endif
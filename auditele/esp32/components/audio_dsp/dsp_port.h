@@ -0,0 +1,79 @@
+/*
+ * Capa de portabilidad del pipeline DSP
+ *
+ * En el ESP32 cada kernel es la función de esp-dsp (versión ae32 con
+ * CONFIG_DSP_OPTIMIZED) y la memoria sale de heap_caps. En el host se usan
+ * las versiones portables de dsp_port.c, equivalentes a las ansi de esp-dsp.
+ */
+
+#ifndef DSP_PORT_H
+#define DSP_PORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "audio_dsp.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_dsp.h"
+#include "esp_heap_caps.h"
+
+#define dsp_port_gen_w_r2_fc32(w, n)       dsps_gen_w_r2_fc32(w, n)
+#define dsp_port_bit_rev_fc32(data, n)     dsps_bit_rev_fc32_ansi(data, n)
+#define dsp_port_gen_w_r2_sc16(w, n)       dsps_gen_w_r2_sc16(w, n)
+#define dsp_port_bit_rev_sc16(data, n)     dsps_bit_rev_sc16_ansi(data, n)
+#define dsp_port_dotprod_s16(a, b, dest, len, shift)  dsps_dotprod_s16(a, b, dest, len, shift)
+#define dsp_port_mul_s16(a, b, out, len, shift)       dsps_mul_s16(a, b, out, len, 1, 1, 1, shift)
+
+// dsps_fird elige por sí mismo la versión ae32 con CONFIG_DSP_OPTIMIZED.
+// La variante s16 (esp-dsp >= 1.4) recibe además la fase inicial y el
+// desplazamiento del resultado: 0 y 0 dan Q15 desde la primera muestra.
+#define dsp_port_fird_init_f32(fir, coeffs, delay, n, decim)  dsps_fird_init_f32(fir, coeffs, delay, n, decim)
+#define dsp_port_fird_f32(fir, in, out, len)                  dsps_fird_f32(fir, in, out, len)
+#define dsp_port_fird_init_s16(fir, coeffs, delay, n, decim)  dsps_fird_init_s16(fir, coeffs, delay, n, decim, 0, 0)
+#define dsp_port_fird_s16(fir, in, out, len)                  dsps_fird_s16(fir, in, out, len)
+
+#if CONFIG_DSP_OPTIMIZED
+#define dsp_port_fft2r_fc32(data, n, w)    dsps_fft2r_fc32_ae32_(data, n, w)
+#define dsp_port_fft2r_sc16(data, n, w)    dsps_fft2r_sc16_ae32_(data, n, (uint16_t*)(w))
+#define DSP_PORT_FFT_KERNELS(X)            X(dsps_fft2r_fc32_ae32_) X(dsps_fft2r_sc16_ae32_)
+#else
+#define dsp_port_fft2r_fc32(data, n, w)    dsps_fft2r_fc32_ansi_(data, n, w)
+#define dsp_port_fft2r_sc16(data, n, w)    dsps_fft2r_sc16_ansi_(data, n, (uint16_t*)(w))
+#define DSP_PORT_FFT_KERNELS(X)            X(dsps_fft2r_fc32_ansi_) X(dsps_fft2r_sc16_ansi_)
+#endif
+
+// Kernels que corren en cada frame, para dsp_placement_list. linker.lf
+// los lleva a IRAM.
+#define DSP_PORT_HOT_KERNELS(X) \
+    DSP_PORT_FFT_KERNELS(X) \
+    X(dsps_dotprod_s16) X(dsps_mul_s16) X(dsps_fird_f32) X(dsps_fird_s16)
+
+#define dsp_port_aligned_alloc(align, bytes, caps)  heap_caps_aligned_alloc(align, bytes, caps)
+#define dsp_port_free(ptr)                          heap_caps_free(ptr)
+
+#else
+
+void dsp_port_gen_w_r2_fc32(float* w, int n);
+void dsp_port_bit_rev_fc32(float* data, int n);
+void dsp_port_fft2r_fc32(float* data, int n, const float* w);
+void dsp_port_gen_w_r2_sc16(int16_t* w, int n);
+void dsp_port_bit_rev_sc16(int16_t* data, int n);
+void dsp_port_fft2r_sc16(int16_t* data, int n, const int16_t* w);
+void dsp_port_dotprod_s16(const int16_t* a, const int16_t* b, int16_t* dest, int len, int8_t shift);
+void dsp_port_mul_s16(const int16_t* a, const int16_t* b, int16_t* out, int len, int shift);
+void dsp_port_fird_init_f32(dsp_fir_f32_t* fir, float* coeffs, float* delay, int n, int decim);
+int dsp_port_fird_f32(dsp_fir_f32_t* fir, const float* in, float* out, int len);
+void dsp_port_fird_init_s16(dsp_fir_s16_t* fir, int16_t* coeffs, int16_t* delay, int n, int decim);
+int dsp_port_fird_s16(dsp_fir_s16_t* fir, const int16_t* in, int16_t* out, int len);
+
+#define DSP_PORT_HOT_KERNELS(X) \
+    X(dsp_port_fft2r_fc32) X(dsp_port_fft2r_sc16) X(dsp_port_dotprod_s16) \
+    X(dsp_port_mul_s16) X(dsp_port_fird_f32) X(dsp_port_fird_s16)
+
+// Las capacidades de heap_caps no existen en el host
+void* dsp_port_aligned_alloc(size_t align, size_t bytes, uint32_t caps);
+void dsp_port_free(void* ptr);
+
+#endif
+
+#endif // DSP_PORT_H
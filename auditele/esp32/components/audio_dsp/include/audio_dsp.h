@@ -0,0 +1,591 @@
+/*
+ * Pipeline DSP de fingerprints de audio
+ * Pre-énfasis, STFT, MFCC, landmarks y fingerprints sin FreeRTOS ni drivers
+ *
+ * Compila en el ESP32 (kernels de esp-dsp) y en el host con versiones
+ * portables de esos kernels, de modo que el mismo código se puede perfilar
+ * y comparar fuera del dispositivo (ver bench/). Toda la configuración
+ * llega por parámetros: el componente no conoce audio_config.
+ */
+
+#ifndef AUDIO_DSP_H
+#define AUDIO_DSP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_err.h"
+#include "dsps_fir.h"
+#include "sdkconfig.h"
+#else
+typedef int esp_err_t;
+#define ESP_OK                 0
+#define ESP_FAIL               -1
+#define ESP_ERR_NO_MEM         0x101
+#define ESP_ERR_INVALID_SIZE   0x104
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Ruta DSP en punto fijo Q15 (kernels sc16/s16). Con 0 sólo se compila la
+// ruta en punto flotante y DSP_MODE_FIXED se trata como DSP_MODE_FLOAT.
+#ifndef AUDIO_DSP_ENABLE_FIXED_POINT
+#define AUDIO_DSP_ENABLE_FIXED_POINT 1
+#endif
+
+// Spans por etapa hacia dsp_span_hook (0 = sin código de medición)
+#ifndef AUDIO_PERF_ENABLE
+#define AUDIO_PERF_ENABLE 1
+#endif
+
+// Núcleos por frame en IRAM: un fallo de la caché de flash, que comparte el
+// bus SPI con la PSRAM, no mete latencia en el frame. Las tablas y buffers
+// ya van al heap interno (ver dsp_placement_list). Con 0 el código queda en
+// flash.
+#ifndef AUDIO_DSP_HOT_IRAM
+#define AUDIO_DSP_HOT_IRAM 1
+#endif
+
+#if defined(ESP_PLATFORM) && AUDIO_DSP_HOT_IRAM
+#include "esp_attr.h"
+#define DSP_HOT_FN  IRAM_ATTR
+#else
+#define DSP_HOT_FN
+#endif
+
+#ifdef CONFIG_DSP_MAX_FFT_SIZE
+#define AUDIO_DSP_MAX_FFT_SIZE  CONFIG_DSP_MAX_FFT_SIZE
+#else
+#define AUDIO_DSP_MAX_FFT_SIZE  2048
+#endif
+
+#define MAX_MEL_BANDS  32
+#define MAX_MFCC_COEFFS 32
+
+// Firma compacta para detectar cambios: media y desviación de los MFCC 1..n
+#define SIGNATURE_MAX_LEN  (2 * MAX_MFCC_COEFFS)
+
+// Frecuencia fija del I2S. Cada preset analiza a una fracción entera de
+// ella, tras el diezmador (ver DIEZMADO).
+#define DSP_CAPTURE_RATE   48000
+
+// Aritmética usada por el pipeline DSP
+typedef enum {
+    DSP_MODE_FLOAT = 0,        // float32 con FPU
+    DSP_MODE_FIXED = 1         // Q15 con instrucciones MAC enteras
+} dsp_mode_t;
+
+// Contenido de cada fingerprint enviado
+typedef enum {
+    FINGERPRINT_MODE_MFCC = 0,      // Matriz MFCC completa
+    FINGERPRINT_MODE_LANDMARKS = 1  // Hashes de pares de picos espectrales
+} fingerprint_mode_t;
+
+// ================================
+// PARÁMETROS
+// ================================
+
+// Parámetros de las tablas y del analizador STFT
+typedef struct {
+    uint32_t sample_rate;      // Hz
+    uint16_t fft_size;         // Puntos FFT (potencia de 2)
+    uint16_t hop_length;       // Salto entre ventanas
+    uint16_t n_mels;           // Número de filtros mel
+    uint16_t n_mfcc;           // Coeficientes MFCC por frame (<= n_mels)
+    float min_freq;            // Hz
+    float max_freq;            // Hz
+    dsp_mode_t mode;
+} dsp_params_t;
+
+// Parámetros de la sesión de fingerprint
+typedef struct {
+    fingerprint_mode_t mode;
+    bool continuous;           // Ventana deslizante en lugar de capturas sueltas
+    uint16_t window_seconds;   // Segundos de la captura o de la ventana
+    uint16_t interval_seconds; // Segundos entre sub-fingerprints (modo continuo)
+    float noise_threshold;     // Energía media por debajo de la cual es ruido
+} fingerprint_params_t;
+
+// Parte DSP de los presets de calidad 1-5, común al firmware y a los benchmarks.
+// Todos analizan a 16 kHz: la banda útil llega a 8 kHz.
+typedef struct {
+    uint32_t sample_rate;
+    uint16_t fft_size;
+    uint16_t n_mels;
+    uint16_t n_mfcc;
+    dsp_mode_t mode;
+} dsp_preset_t;
+
+#define DSP_PRESET_COUNT  5
+
+// Preset del nivel 1..DSP_PRESET_COUNT, NULL fuera de rango
+const dsp_preset_t* dsp_preset(uint8_t level);
+
+// Los hashes de landmarks empaquetan bins de FFT y dt en frames: sólo
+// coinciden entre análisis con la misma FFT y aritmética. En modo landmarks
+// todos los niveles (y el servidor) usan el análisis de este preset y sólo
+// cambia el ritmo de captura; en MFCC cada nivel usa el suyo.
+#define DSP_LANDMARK_PRESET  3
+
+// Análisis del nivel `level` en modo `mode`, NULL fuera de rango
+const dsp_preset_t* dsp_preset_analysis(uint8_t level, fingerprint_mode_t mode);
+
+// ================================
+// MEDICIÓN POR ETAPAS
+// ================================
+
+typedef enum {
+    DSP_STAGE_PREEMPHASIS = 0, // Pre-énfasis de un bloque
+    DSP_STAGE_FFT,             // Ventana, FFT y espectro de potencia de un frame
+    DSP_STAGE_MFCC,            // Banco mel y DCT de un frame
+    DSP_STAGE_HASHING,         // Landmarks de un frame
+    DSP_STAGE_FINGERPRINT,     // Cierre del fingerprint (linealizado y MD5)
+    DSP_STAGE_COUNT
+} dsp_stage_t;
+
+// Recibe la duración de cada span en ciclos de dsp_cycles()
+typedef void (*dsp_span_hook_t)(dsp_stage_t stage, uint32_t cycles);
+
+// NULL desactiva la medición
+void dsp_set_span_hook(dsp_span_hook_t hook);
+
+// Contador de ciclos de la CPU (CCOUNT en Xtensa, TSC o reloj en el host)
+uint32_t dsp_cycles(void);
+
+// ================================
+// ARENAS DE MEMORIA
+// ================================
+
+// Los buffers del pipeline se reparten desde arenas reservadas una sola
+// vez. Cada reconfiguración sólo mueve punteros; el heap se toca únicamente
+// si la nueva configuración necesita más memoria que cualquiera anterior,
+// así que no se fragmenta con el tiempo.
+
+#define ARENA_ALIGN    16
+#define ARENA_GRANULE  4096
+
+typedef struct {
+    const char* name;
+    uint32_t caps;             // Capacidades preferidas (heap_caps; ignoradas en el host)
+    uint32_t fallback_caps;    // Alternativa si no hay memoria con `caps` (0 = ninguna)
+    uint8_t* base;
+    size_t capacity;
+    size_t used;
+    size_t high_water;         // Máximo de `used` desde el arranque
+    uint32_t epoch;            // Se incrementa en cada arena_prepare
+    uint32_t grows;            // Veces que hubo que reservar del heap
+} arena_t;
+
+static inline size_t arena_align(size_t bytes) {
+    return (bytes + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+// Vaciar la arena garantizando al menos `bytes`. Invalida todo lo repartido.
+esp_err_t arena_prepare(arena_t* arena, size_t bytes);
+
+// Repartir `bytes` alineados a ARENA_ALIGN; NULL si no caben
+void* arena_alloc(arena_t* arena, size_t bytes);
+
+// Devolver la memoria al heap
+void arena_release(arena_t* arena);
+
+// ================================
+// CONTEXTO DSP PRECALCULADO
+// ================================
+
+// Banda del banco de filtros mel en representación dispersa
+typedef struct {
+    uint16_t start_bin;        // Primer bin con peso no nulo
+    uint16_t n_bins;           // Bins consecutivos cubiertos por el triángulo
+    uint16_t weight_offset;    // Índice del primer peso en mel_weights
+    uint8_t q15_headroom;      // log2 de la suma de pesos (ruta Q15)
+} mel_band_t;
+
+typedef struct dsp_context dsp_context_t;
+
+// Bits de dsp_kernels_t.specialized
+#define DSP_KERNELS_FFT  0x01      // Ventana y espectro con fft_size constante
+#define DSP_KERNELS_MEL  0x02      // Banco mel con n_mels constante
+#define DSP_KERNELS_DCT  0x04      // DCT con n_mels y n_mfcc constantes
+#define DSP_KERNELS_ALL  (DSP_KERNELS_FFT | DSP_KERNELS_MEL | DSP_KERNELS_DCT)
+
+// Núcleos por frame elegidos al construir el contexto: instancias con los
+// tamaños como constantes para las formas de los presets, o genéricas
+typedef struct {
+    void (*window)(const dsp_context_t* ctx, const float* in, float* out);
+    void (*power_spectrum)(const dsp_context_t* ctx, float* data, float* power);
+    void (*mel)(const dsp_context_t* ctx, const float* power, float* log_mel);
+    void (*dct)(const dsp_context_t* ctx, const float* log_mel, float* mfcc);
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+    int (*power_spectrum_q15)(const dsp_context_t* ctx, int16_t* data, uint32_t* power);
+    void (*mel_q15)(const dsp_context_t* ctx, const uint32_t* power, int exponent,
+                    int16_t* scratch, float* log_mel);
+#endif
+    uint8_t specialized;       // DSP_KERNELS_*
+} dsp_kernels_t;
+
+// Tablas derivadas de dsp_params_t. Se construyen una vez por
+// configuración para que ningún frame ejecute funciones trascendentes.
+// Viven en la arena del analizador STFT junto con sus buffers.
+struct dsp_context {
+    dsp_params_t params;       // Parámetros pedidos al construir
+    dsp_mode_t mode;           // Modo efectivo
+    uint32_t sample_rate;
+    uint16_t fft_size;
+    uint16_t n_mels;
+    uint16_t n_mfcc;
+    float min_freq;
+    float max_freq;
+
+    float* window;             // fft_size coeficientes de Hamming
+    uint16_t fft_points;       // Puntos de la FFT compleja (fft_size / 2)
+    uint8_t fft_log2;          // log2(fft_points)
+    uint16_t n_bins;           // Bins del espectro real (fft_size / 2 + 1)
+    float* twiddles;           // Tabla (cos, sin) en orden bit-reverso de esp-dsp
+    uint16_t* bitrev_pairs;    // Pares (i, j) a intercambiar tras la FFT
+    uint16_t n_bitrev_pairs;
+    float* split_twiddles;     // (cos, sin)(2*pi*k/fft_size), k = 0..fft_points/2
+
+    uint16_t band_start_bin;   // Rango min_freq..max_freq en bins
+    uint16_t band_end_bin;
+
+    mel_band_t mel_bands[MAX_MEL_BANDS];
+    float* mel_weights;        // Pesos de todos los triángulos, concatenados
+    float* dct;                // Matriz DCT-II ortonormal n_mfcc x n_mels
+
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+    // Tablas Q15, sólo en DSP_MODE_FIXED
+    int16_t* window_q15;
+    int16_t* twiddles_q15;     // Formato de dsps_gen_w_r2_sc16, bit-reverso
+    int16_t* split_twiddles_q15;
+    int16_t* mel_weights_q15;  // Pesos escalados por 2^-q15_headroom de cada banda
+#endif
+    dsp_kernels_t kernels;
+    bool valid;
+};
+
+// Bytes de arena que ocupan las tablas de una configuración
+size_t dsp_context_bytes(uint16_t fft_size, uint16_t n_mels, uint16_t n_mfcc, dsp_mode_t mode);
+
+// Construir todas las tablas para `params`. La arena se vacía y se
+// dimensiona para las tablas más `extra_bytes`, que el llamante reparte
+// después (buffers por frame).
+esp_err_t dsp_context_build(dsp_context_t* ctx, const dsp_params_t* params,
+                            arena_t* arena, size_t extra_bytes);
+
+// Reconstruir sólo si los parámetros cambiaron desde la última vez
+esp_err_t dsp_context_update(dsp_context_t* ctx, const dsp_params_t* params,
+                             arena_t* arena, size_t extra_bytes);
+
+// Olvidar las tablas; su memoria pertenece a la arena
+void dsp_context_free(dsp_context_t* ctx);
+
+void dsp_context_power_spectrum(const dsp_context_t* ctx, float* data, float* power);
+void dsp_context_mel(const dsp_context_t* ctx, const float* power, float* log_mel);
+void dsp_context_dct(const dsp_context_t* ctx, const float* log_mel, float* mfcc);
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+int dsp_context_power_spectrum_q15(const dsp_context_t* ctx, int16_t* data, uint32_t* power);
+void dsp_context_mel_q15(const dsp_context_t* ctx, const uint32_t* power, int exponent,
+                         int16_t* scratch, float* log_mel);
+#endif
+
+// ================================
+// PRIMITIVAS
+// ================================
+
+void build_hamming_window(float* window, size_t length);
+void pre_emphasis(const float* in, float* out, size_t length, float alpha, float* prev);
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+void pre_emphasis_q15(const int16_t* in, int16_t* out, size_t length, int16_t* prev);
+#endif
+bool is_noise(const float* data, size_t length, float threshold);
+
+// MD5 de `len` bytes como 32 caracteres hexadecimales y NUL
+void calculate_md5(const void* data, size_t len, char* output);
+
+// ================================
+// DIEZMADO
+// ================================
+
+// El I2S captura siempre a DSP_CAPTURE_RATE y un FIR antialiasing baja la
+// señal a la frecuencia de análisis antes de la STFT. El kernel diezmador
+// (dsps_fird de esp-dsp) sólo calcula las muestras que se conservan, así
+// que cuesta lo mismo que un banco polifásico: DECIMATOR_TAPS_PER_PHASE
+// productos por muestra de entrada, sea cual sea el factor.
+
+#define DECIMATOR_MAX_FACTOR      6
+#define DECIMATOR_TAPS_PER_PHASE  32
+#define DECIMATOR_MAX_TAPS        (DECIMATOR_MAX_FACTOR * DECIMATOR_TAPS_PER_PHASE)
+
+#ifdef ESP_PLATFORM
+typedef fir_f32_t dsp_fir_f32_t;
+typedef fir_s16_t dsp_fir_s16_t;
+#else
+// Estado equivalente a fir_f32_t y fir_s16_t de esp-dsp
+typedef struct {
+    float* coeffs;
+    float* delay;
+    int N;
+    int pos;
+    int decim;
+} dsp_fir_f32_t;
+
+typedef struct {
+    int16_t* coeffs;
+    int16_t* delay;
+    int16_t coeffs_len;
+    int16_t pos;
+    int16_t decim;
+    int16_t shift;
+} dsp_fir_s16_t;
+#endif
+
+// Filtro y líneas de retardo de las dos rutas; la tabla de coeficientes se
+// calcula una vez por pareja de frecuencias
+typedef struct {
+    uint32_t input_rate;
+    uint32_t output_rate;
+    uint8_t factor;            // Muestras de entrada por muestra de salida
+    uint16_t n_taps;
+    dsp_fir_f32_t fir;
+    float coeffs[DECIMATOR_MAX_TAPS];
+    float delay[DECIMATOR_MAX_TAPS];
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+    dsp_fir_s16_t fir_q15;
+    int16_t coeffs_q15[DECIMATOR_MAX_TAPS];
+    int16_t delay_q15[DECIMATOR_MAX_TAPS];
+#endif
+} decimator_t;
+
+// Diseñar el filtro (sinc con ventana de Kaiser, corte algo por debajo del
+// Nyquist de salida). ESP_ERR_INVALID_SIZE si output_rate no divide a
+// input_rate con un factor entre 2 y DECIMATOR_MAX_FACTOR.
+esp_err_t decimator_init(decimator_t* dec, uint32_t input_rate, uint32_t output_rate);
+
+// Vaciar las líneas de retardo antes de un flujo nuevo
+void decimator_reset(decimator_t* dec);
+
+// Instante que representa la salida j de un flujo, en muestras de entrada
+// desde la primera: j * factor + decimator_phase(dec). Es negativo porque el
+// FIR de fase lineal retrasa (n_taps - 1) / 2 muestras.
+static inline float decimator_phase(const decimator_t* dec) {
+    return (float)(dec->factor - 1) - (dec->n_taps - 1) * 0.5f;
+}
+
+// Diezmar `length` muestras (múltiplo de factor) y devolver las escritas en `out`
+size_t decimator_process(decimator_t* dec, const float* in, float* out, size_t length);
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+size_t decimator_process_q15(decimator_t* dec, const int16_t* in, int16_t* out, size_t length);
+#endif
+
+// ================================
+// ANALIZADOR STFT INCREMENTAL
+// ================================
+
+// Características de un frame entregadas al consumidor
+typedef struct {
+    uint32_t index;            // Frame dentro de la captura
+    const float* mfcc;
+    uint16_t n_mfcc;
+    const float* log_power;    // ln|X[k]|^2 por bin, NULL si no se pidió
+    uint16_t first_bin;        // Rango válido de log_power: [first_bin, end_bin)
+    uint16_t end_bin;
+} stft_frame_t;
+
+// Callback invocado con las características de cada frame
+typedef void (*stft_frame_cb_t)(const stft_frame_t* frame, void* ctx);
+
+// Se alimenta con bloques de cualquier tamaño y emite un frame cada
+// hop_length muestras. Sólo conserva fft_size muestras de historia.
+typedef struct {
+    dsp_context_t* ctx;
+    arena_t* arena;            // Compartida con las tablas de ctx
+    uint32_t arena_epoch;      // Época de la arena en que se repartieron los buffers
+    uint16_t fft_size;
+    uint16_t hop_length;
+    // Los buffers se reservan para float y se reinterpretan en la ruta Q15
+    union {
+        float* history;        // Últimas fft_size muestras pre-enfatizadas
+        int16_t* history_q15;
+    };
+    size_t fill;               // Muestras válidas en history
+    union {
+        float* fft_buffer;
+        int16_t* fft_buffer_q15;
+    };
+    union {
+        float* power_spectrum;
+        uint32_t* power_spectrum_q15;
+    };
+    float prev_sample;         // Estado del filtro de pre-énfasis
+    int16_t prev_sample_q15;
+    double energy;             // Energía acumulada (detección de ruido)
+    uint64_t n_samples;
+    uint32_t n_frames;
+    bool want_spectrum;        // Entregar también el espectro logarítmico
+    stft_frame_cb_t on_frame;
+    void* cb_ctx;
+} stft_stream_t;
+
+// Los buffers se reparten en stft_stream_reset, con el tamaño de FFT real
+void stft_stream_init(stft_stream_t* stft, dsp_context_t* dsp, arena_t* arena,
+                      stft_frame_cb_t on_frame, void* ctx);
+
+// Preparar el analizador para una nueva captura con `params`
+esp_err_t stft_stream_reset(stft_stream_t* stft, const dsp_params_t* params);
+
+// Alimentar el analizador con un bloque de audio
+void stft_stream_feed(stft_stream_t* stft, const float* block, size_t length);
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+void stft_stream_feed_q15(stft_stream_t* stft, const int16_t* block, size_t length);
+#endif
+
+// ================================
+// GENERACIÓN DE FINGERPRINTS
+// ================================
+
+#define LANDMARK_PEAKS_PER_FRAME  3      // Picos aceptados como máximo por frame
+#define LANDMARK_FANOUT           3      // Pares por pico, como ancla y como destino
+#define LANDMARK_MAX_PER_FRAME    (LANDMARK_PEAKS_PER_FRAME * LANDMARK_FANOUT)
+#define LANDMARK_RECENT_PEAKS     128    // Potencia de 2 >= PEAKS_PER_FRAME * MAX_DT
+
+// Landmark: hash de un par de picos (f1:10 | f2:10 | dt:12) y el frame del
+// pico ancla dentro de la captura
+typedef struct {
+    uint32_t hash;
+    uint32_t offset;
+} landmark_t;
+
+typedef struct {
+    char hash[33];          // MD5 hash como string
+    uint64_t timestamp;
+    float confidence;
+    uint16_t duration;
+    uint8_t mode;           // fingerprint_mode_t
+    const float* mfcc;      // Matriz tiempo x coeficiente (fila por frame)
+    uint16_t n_frames;
+    uint16_t n_coeffs;
+    const landmark_t* landmarks;
+    uint32_t n_landmarks;
+    float signature[SIGNATURE_MAX_LEN];
+    uint16_t signature_len;
+} fingerprint_t;
+
+// Resultado de generate_fingerprint
+typedef enum {
+    FINGERPRINT_OK = 0,
+    FINGERPRINT_NOISE,         // Energía por debajo de noise_threshold
+    FINGERPRINT_NO_PEAKS       // Modo landmarks sin picos espectrales
+} fingerprint_status_t;
+
+typedef struct {
+    uint32_t frame;
+    uint16_t bin;
+    uint8_t fanout;            // Pares ya generados con este pico como ancla
+} landmark_peak_t;
+
+// Extractor en línea: un umbral por bin que decae con el tiempo y se eleva
+// alrededor de cada pico aceptado. Al trabajar en dominio logarítmico una
+// ganancia constante (volumen) no cambia qué picos se eligen.
+typedef struct {
+    float threshold[AUDIO_DSP_MAX_FFT_SIZE/2 + 1];
+    landmark_peak_t recent[LANDMARK_RECENT_PEAKS];
+    uint32_t n_recent;         // Picos acumulados (índice del ring)
+} landmark_extractor_t;
+
+void landmark_extractor_reset(landmark_extractor_t* ex);
+
+// Procesar un frame: elegir picos y emparejarlos con anclas recientes.
+// Escribe como máximo max_out landmarks en `out` y devuelve cuántos.
+size_t landmark_extractor_frame(landmark_extractor_t* ex, const stft_frame_t* frame,
+                                landmark_t* out, size_t max_out);
+
+// Características acumuladas de la captura en curso: matriz MFCC
+// (frames x coeficientes) o landmarks según fingerprint_mode. En modo
+// continuo ambos buffers son anillos que cubren sólo la ventana deslizante,
+// así que memoria y coste por sub-fingerprint no crecen con el tiempo.
+typedef struct {
+    fingerprint_mode_t mode;
+    bool continuous;
+    uint16_t window_seconds;   // Duración declarada en cada fingerprint
+    float noise_threshold;
+    float* mfcc;               // Anillo de max_frames filas
+    uint16_t n_coeffs;
+    uint16_t max_frames;       // Frames de la captura o de la ventana
+    uint16_t interval_frames;  // Frames entre sub-fingerprints
+    uint32_t n_frames;         // Frames recibidos desde el reset
+    uint32_t last_emit_frame;
+    float mfcc_sum[MAX_MFCC_COEFFS];   // Confianza y firma: frames desde la última emisión
+    float mfcc_sq_sum[MAX_MFCC_COEFFS];
+    uint32_t sum_frames;
+
+    landmark_extractor_t extractor;
+    landmark_t* landmarks;     // Anillo de landmarks_allocated entradas
+    size_t landmarks_allocated;
+    arena_t* arena;            // Todos los buffers salen de aquí
+    uint32_t n_landmarks;      // Landmarks generados desde el reset
+
+    // Copia lineal de la ventana para el envío (sólo modo continuo)
+    float* window_mfcc;
+    landmark_t* window_landmarks;
+} fingerprint_session_t;
+
+// Callback de stft_stream_t que alimenta la sesión (ctx = la sesión)
+void fingerprint_session_on_frame(const stft_frame_t* frame, void* ctx);
+
+// Dimensionar los buffers para una captura completa (o una ventana en modo
+// continuo). `stft` ya debe estar preparado con stft_stream_reset.
+esp_err_t fingerprint_session_reset(fingerprint_session_t* session, const stft_stream_t* stft,
+                                    const fingerprint_params_t* params);
+
+// Modo continuo: la ventana está llena y pasó un intervalo desde la última emisión
+static inline bool fingerprint_session_window_ready(const fingerprint_session_t* session) {
+    return session->continuous && session->n_frames >= session->max_frames &&
+           session->n_frames - session->last_emit_frame >= session->interval_frames;
+}
+
+// Frame de la captura al que se refiere el offset 0 de los landmarks del
+// próximo fingerprint: el más antiguo de la ventana en modo continuo
+static inline uint32_t fingerprint_session_window_start(const fingerprint_session_t* session) {
+    return (session->continuous && session->n_frames > session->max_frames) ?
+           session->n_frames - session->max_frames : 0;
+}
+
+// Empezar a acumular el siguiente intervalo tras emitir (o descartar) uno
+void fingerprint_session_mark_emitted(fingerprint_session_t* session, stft_stream_t* stft);
+
+// Generar fingerprint a partir de la captura (o ventana) analizada. Los
+// buffers de `fingerprint` apuntan a la sesión hasta el siguiente frame.
+fingerprint_status_t generate_fingerprint(stft_stream_t* stft, fingerprint_session_t* session,
+                                          uint64_t timestamp, fingerprint_t* fingerprint);
+
+// ================================
+// COLOCACIÓN EN MEMORIA
+// ================================
+
+// Código o buffer del pipeline y dónde debería vivir. Los `hot` se tocan en
+// cada frame y deben quedar en IRAM o RAM interna; el resto puede ir a
+// flash o PSRAM.
+typedef struct {
+    const char* name;
+    const void* addr;
+    size_t bytes;              // 0 en el código
+    bool code;
+    bool hot;
+} dsp_placement_t;
+
+// Rellenar `out` con el código por frame (núcleos elegidos y kernels de
+// esp-dsp), las tablas de stft->ctx y los buffers de `stft` y `session`,
+// ya preparados con sus reset. Devuelve cuántas entradas escribió (<= max).
+size_t dsp_placement_list(const stft_stream_t* stft, const fingerprint_session_t* session,
+                          dsp_placement_t* out, size_t max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // AUDIO_DSP_H
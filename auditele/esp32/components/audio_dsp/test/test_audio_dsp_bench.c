@@ -0,0 +1,126 @@
+/*
+ * Ciclos por frame de cada preset en el ESP32
+ * Misma señal sintética y parámetros que bench/dsp_bench.c
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "unity.h"
+#include "esp_heap_caps.h"
+#include "audio_dsp.h"
+
+#define BENCH_HOP_LENGTH      512
+#define BENCH_BLOCK_SAMPLES   960    // A DSP_CAPTURE_RATE
+#define BENCH_SECONDS         5
+
+static uint64_t stage_cycles[DSP_STAGE_COUNT];
+
+static void bench_span(dsp_stage_t stage, uint32_t cycles) {
+    stage_cycles[stage] += cycles;
+}
+
+static arena_t hot_arena = {
+    .name = "hot",
+    .caps = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT
+};
+static arena_t bulk_arena = {
+    .name = "bulk",
+    .caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT,
+    .fallback_caps = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT
+};
+static dsp_context_t dsp_ctx;
+static stft_stream_t stft;
+static fingerprint_session_t session;
+static decimator_t decimator;
+
+// Bloque de dos tonos con ruido, el mismo para todos los presets
+static void synth_block(float* out, int16_t* out_q15, size_t n, size_t offset, uint32_t rate) {
+    for (size_t i = 0; i < n; i++) {
+        float t = (float)(offset + i) / rate;
+        uint32_t r = (uint32_t)(offset + i) * 1664525u + 1013904223u;
+        float v = 0.3f * sinf(2.0f * (float)M_PI * 440.0f * t) +
+                  0.2f * sinf(2.0f * (float)M_PI * 1500.0f * t) +
+                  0.02f * ((int32_t)r >> 8) / 8388608.0f;
+        out[i] = v;
+        out_q15[i] = (int16_t)(v * 32767.0f);
+    }
+}
+
+static void bench_preset(uint8_t level, fingerprint_mode_t mode) {
+    const dsp_preset_t* preset = dsp_preset_analysis(level, mode);
+    dsp_params_t params = {
+        .sample_rate = preset->sample_rate,
+        .fft_size = preset->fft_size,
+        .hop_length = BENCH_HOP_LENGTH,
+        .n_mels = preset->n_mels,
+        .n_mfcc = preset->n_mfcc,
+        .min_freq = 300.0f,
+        .max_freq = 8000.0f,
+        .mode = preset->mode,
+    };
+    fingerprint_params_t fp_params = {
+        .mode = mode,
+        .window_seconds = BENCH_SECONDS,
+        .interval_seconds = BENCH_SECONDS,
+        .noise_threshold = 0.0001f,
+    };
+    static float native[BENCH_BLOCK_SAMPLES];
+    static int16_t native_q15[BENCH_BLOCK_SAMPLES];
+    static float block[BENCH_BLOCK_SAMPLES];
+    static int16_t block_q15[BENCH_BLOCK_SAMPLES];
+
+    dsp_context_free(&dsp_ctx);
+    stft_stream_init(&stft, &dsp_ctx, &hot_arena, fingerprint_session_on_frame, &session);
+    session.arena = &bulk_arena;
+    TEST_ASSERT_EQUAL(ESP_OK, stft_stream_reset(&stft, &params));
+    TEST_ASSERT_EQUAL(ESP_OK, fingerprint_session_reset(&session, &stft, &fp_params));
+    stft.want_spectrum = (mode == FINGERPRINT_MODE_LANDMARKS);
+    TEST_ASSERT_EQUAL(ESP_OK, decimator_init(&decimator, DSP_CAPTURE_RATE, preset->sample_rate));
+
+    memset(stage_cycles, 0, sizeof(stage_cycles));
+    size_t total = (size_t)DSP_CAPTURE_RATE * BENCH_SECONDS;
+    uint64_t feed_cycles = 0, decimate_cycles = 0;
+    for (size_t i = 0; i < total; i += BENCH_BLOCK_SAMPLES) {
+        size_t n = (total - i < BENCH_BLOCK_SAMPLES) ? total - i : BENCH_BLOCK_SAMPLES;
+        synth_block(native, native_q15, n, i, DSP_CAPTURE_RATE);
+        uint32_t start = dsp_cycles();
+        if (dsp_ctx.mode == DSP_MODE_FIXED) {
+            n = decimator_process_q15(&decimator, native_q15, block_q15, n);
+            decimate_cycles += dsp_cycles() - start;
+            start = dsp_cycles();
+            stft_stream_feed_q15(&stft, block_q15, n);
+        } else {
+            n = decimator_process(&decimator, native, block, n);
+            decimate_cycles += dsp_cycles() - start;
+            start = dsp_cycles();
+            stft_stream_feed(&stft, block, n);
+        }
+        feed_cycles += dsp_cycles() - start;
+    }
+    fingerprint_t fingerprint;
+    TEST_ASSERT_EQUAL(FINGERPRINT_OK, generate_fingerprint(&stft, &session, 0, &fingerprint));
+    TEST_ASSERT_GREATER_THAN(0, stft.n_frames);
+
+    printf("Calidad %d %-9s: %u frames, %u ciclos/frame "
+           "(diezmado %u, preemph %u, fft %u, mfcc %u, hashing %u), fingerprint %u ciclos\n",
+           level, mode == FINGERPRINT_MODE_LANDMARKS ? "landmarks" : "mfcc",
+           (unsigned)stft.n_frames, (unsigned)(feed_cycles / stft.n_frames),
+           (unsigned)(decimate_cycles / stft.n_frames),
+           (unsigned)(stage_cycles[DSP_STAGE_PREEMPHASIS] / stft.n_frames),
+           (unsigned)(stage_cycles[DSP_STAGE_FFT] / stft.n_frames),
+           (unsigned)(stage_cycles[DSP_STAGE_MFCC] / stft.n_frames),
+           (unsigned)(stage_cycles[DSP_STAGE_HASHING] / stft.n_frames),
+           (unsigned)stage_cycles[DSP_STAGE_FINGERPRINT]);
+}
+
+TEST_CASE("Ciclos por frame de cada preset", "[audio_dsp][bench]")
+{
+    dsp_set_span_hook(bench_span);
+    for (uint8_t level = 1; level <= DSP_PRESET_COUNT; level++) {
+        bench_preset(level, FINGERPRINT_MODE_MFCC);
+        bench_preset(level, FINGERPRINT_MODE_LANDMARKS);
+    }
+    dsp_set_span_hook(NULL);
+}
+
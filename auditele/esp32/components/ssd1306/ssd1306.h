@@ -6,18 +6,28 @@
 #ifndef SSD1306_H
 #define SSD1306_H
 
+#include <string.h>
 #include "driver/i2c.h"
 #include "esp_log.h"
 
 #define SSD1306_I2C_ADDR    0x3C
 #define SSD1306_I2C_PORT    I2C_NUM_0
 #define SSD1306_I2C_FREQ    400000
+#define SSD1306_MAX_WIDTH   128
+#define SSD1306_MAX_PAGES   8           // 64 filas / 8
+#define SSD1306_FONT_WIDTH  8
+#define SSD1306_FLUSH_TIMEOUT_MS  100
 
 typedef struct {
     i2c_port_t i2c_port;
     uint8_t width;
     uint8_t height;
     uint8_t pages;
+    // Framebuffer en RAM (1 KB): una fila de bytes por página, cada byte es
+    // una columna de 8 píxeles. Se dibuja aquí y ssd1306_fb_flush envía
+    // sólo las páginas marcadas en `dirty`.
+    uint8_t framebuffer[SSD1306_MAX_PAGES][SSD1306_MAX_WIDTH];
+    volatile uint8_t dirty;             // Bit n = página n modificada
 } SSD1306_t;
 
 // Funciones principales
@@ -30,6 +40,9 @@ void ssd1306_display_text(SSD1306_t* dev, int page, char* text, int text_len, bo
 // Comandos SSD1306
 #define SSD1306_CONTROL_CMD_STREAM    0x00
 #define SSD1306_CONTROL_DATA_STREAM   0x40
+#define SSD1306_CMD_SET_PAGE          0xB0
+#define SSD1306_CMD_SET_COLUMN_LOW    0x00
+#define SSD1306_CMD_SET_COLUMN_HIGH   0x10
 
 // Implementación básica inline para reducir dependencias
 static inline esp_err_t ssd1306_write_command(SSD1306_t* dev, uint8_t command) {
@@ -59,4 +72,82 @@ static inline esp_err_t ssd1306_write_data(SSD1306_t* dev, uint8_t* data, size_t
 // Font básico 8x8
 extern const uint8_t font8x8_basic[128][8];
 
+// ================================
+// Framebuffer: dibujo en RAM y envío por páginas
+// ================================
+
+// Reemplazar una página completa; sólo se marca si el contenido cambió
+static inline void ssd1306_fb_set_page(SSD1306_t* dev, int page, const uint8_t* columns) {
+    if (page < 0 || page >= dev->pages) {
+        return;
+    }
+    if (memcmp(dev->framebuffer[page], columns, dev->width) != 0) {
+        memcpy(dev->framebuffer[page], columns, dev->width);
+        dev->dirty |= (1 << page);
+    }
+}
+
+static inline void ssd1306_fb_clear(SSD1306_t* dev) {
+    uint8_t blank[SSD1306_MAX_WIDTH] = { 0 };
+    for (int page = 0; page < dev->pages; page++) {
+        ssd1306_fb_set_page(dev, page, blank);
+    }
+}
+
+// Escribir una línea de texto (hasta width/8 caracteres) en una página.
+// El resto de la página se borra.
+static inline void ssd1306_fb_text(SSD1306_t* dev, int page, const char* text, bool invert) {
+    uint8_t columns[SSD1306_MAX_WIDTH] = { 0 };
+    int max_chars = dev->width / SSD1306_FONT_WIDTH;
+    for (int i = 0; i < max_chars && text[i] != '\0'; i++) {
+        const uint8_t* glyph = font8x8_basic[(uint8_t)text[i] & 0x7F];
+        memcpy(&columns[i * SSD1306_FONT_WIDTH], glyph, SSD1306_FONT_WIDTH);
+    }
+    if (invert) {
+        for (int x = 0; x < dev->width; x++) {
+            columns[x] = ~columns[x];
+        }
+    }
+    ssd1306_fb_set_page(dev, page, columns);
+}
+
+// Enviar las páginas modificadas en una sola transacción I2C: por página,
+// direccionamiento (página y columna 0) y sus `width` bytes con start repetido
+static inline esp_err_t ssd1306_fb_flush(SSD1306_t* dev) {
+    uint8_t dirty = dev->dirty;
+    if (dirty == 0) {
+        return ESP_OK;
+    }
+    dev->dirty &= ~dirty;   // Lo que se dibuje durante el envío queda para el siguiente
+    
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+    if (cmd == NULL) {
+        dev->dirty |= dirty;
+        return ESP_ERR_NO_MEM;
+    }
+    for (int page = 0; page < dev->pages; page++) {
+        if (!(dirty & (1 << page))) {
+            continue;
+        }
+        i2c_master_start(cmd);
+        i2c_master_write_byte(cmd, (SSD1306_I2C_ADDR << 1) | I2C_MASTER_WRITE, true);
+        i2c_master_write_byte(cmd, SSD1306_CONTROL_CMD_STREAM, true);
+        i2c_master_write_byte(cmd, SSD1306_CMD_SET_PAGE | page, true);
+        i2c_master_write_byte(cmd, SSD1306_CMD_SET_COLUMN_LOW, true);
+        i2c_master_write_byte(cmd, SSD1306_CMD_SET_COLUMN_HIGH, true);
+        i2c_master_start(cmd);
+        i2c_master_write_byte(cmd, (SSD1306_I2C_ADDR << 1) | I2C_MASTER_WRITE, true);
+        i2c_master_write_byte(cmd, SSD1306_CONTROL_DATA_STREAM, true);
+        i2c_master_write(cmd, dev->framebuffer[page], dev->width, true);
+    }
+    i2c_master_stop(cmd);
+    esp_err_t ret = i2c_master_cmd_begin(dev->i2c_port, cmd,
+                                         SSD1306_FLUSH_TIMEOUT_MS / portTICK_RATE_MS);
+    i2c_cmd_link_delete(cmd);
+    if (ret != ESP_OK) {
+        dev->dirty |= dirty;   // Reintentar en el próximo flush
+    }
+    return ret;
+}
+
 #endif // SSD1306_H
\ No newline at end of file
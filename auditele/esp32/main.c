@@ -12,26 +12,37 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <math.h>
+#include <stdatomic.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "freertos/event_groups.h"
+#include "freertos/timers.h"
 #include "driver/i2s.h"
 #include "driver/gpio.h"
 #include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "soc/soc_memory_layout.h"
+#include "esp_cpu.h"
+#include "esp_rom_sys.h"
+#include "esp_partition.h"
+#include "esp_crc.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
 #include "esp_http_client.h"
 #include "esp_sntp.h"
+#include "esp_pm.h"
 #include "nvs_flash.h"
 #include "lwip/err.h"
 #include "lwip/sys.h"
 #include "cJSON.h"
-#include "esp_dsp.h"
+#include "audio_dsp.h"
 #include "ssd1306.h"
-#include "md5.h"
+#include "audimeter_wire.h"
 
 static const char *TAG = "TV_AUDIENCE";
 
@@ -53,18 +64,59 @@ static const char *TAG = "TV_AUDIENCE";
 #define BUTTON_1_PIN   32  // Configuración
 #define BUTTON_2_PIN   33  // Info/Modo
 
+// Buffers DMA del I2S, siempre a DSP_CAPTURE_RATE: la captura lee bloques
+// completos de este tamaño. 960 es múltiplo de todos los factores de diezmado.
+#define I2S_DMA_BUF_COUNT      4
+#define I2S_DMA_BUF_LEN        960                 // Frames por buffer DMA (20 ms)
+#define CAPTURE_BLOCK_SAMPLES  I2S_DMA_BUF_LEN     // Muestras por bloque capturado
+
+// Ring SPSC de bloques PCM entre captura (core 1) y procesamiento (core 0).
+// Los bloques ya diezmados ocupan como mucho la mitad del bloque capturado.
+#define PCM_BLOCK_SAMPLES      (CAPTURE_BLOCK_SAMPLES / 2)
+#define PCM_RING_BLOCKS        128  // Bloques en PSRAM (~2,5 s a 16 kHz)
+#define PCM_RING_HOT_BLOCKS    8    // Ventana mínima en RAM interna si no hay PSRAM
+
+// Codificación de los envíos al servidor
+typedef enum {
+    WIRE_FORMAT_JSON = 0,           // application/json con características en Base64
+    WIRE_FORMAT_BINARY = 1          // AUDIMETER_WIRE_CONTENT_TYPE (audimeter_wire.h)
+} wire_format_t;
+
+// Estrategia de captura
+typedef enum {
+    CAPTURE_MODE_DUTY_CYCLE = 0,    // capture_duration s cada capture_interval s
+    CAPTURE_MODE_CONTINUOUS = 1     // Ventana deslizante sin huecos
+} capture_mode_t;
+
 // Configuraciones de audio por defecto
 typedef struct {
     uint32_t sample_rate;       // Hz
     uint16_t fft_size;         // Puntos FFT
     uint16_t hop_length;       // Salto entre ventanas
     uint16_t n_mels;           // Número de filtros mel
+    uint16_t n_mfcc;           // Coeficientes MFCC por frame (<= n_mels)
     float min_freq;            // Frecuencia mínima
     float max_freq;            // Frecuencia máxima
     uint16_t capture_duration; // Segundos de captura
     uint16_t capture_interval; // Segundos entre capturas
     float noise_threshold;     // Umbral de ruido
     uint8_t quality_level;     // 1-5 (1=básica, 5=alta)
+    uint8_t dsp_mode;          // dsp_mode_t, lo fija el preset de calidad
+    uint8_t fingerprint_mode;  // fingerprint_mode_t
+    uint8_t capture_mode;      // capture_mode_t, lo fija el preset de calidad
+    uint16_t stream_window;    // Segundos cubiertos por cada sub-fingerprint
+    uint16_t stream_interval;  // Segundos entre sub-fingerprints (modo continuo)
+    float change_threshold;    // Distancia coseno mínima para reenviar (0 = siempre)
+    uint16_t heartbeat_interval; // Segundos entre heartbeats sin cambios (0 = ninguno)
+    uint8_t batch_size;        // Registros por envío (1 = sin lotes)
+    uint16_t batch_linger;     // Segundos máximos de espera de un registro en el lote
+    uint8_t wire_format;       // wire_format_t
+    uint8_t mfcc_bits;         // Cuantización MFCC en binario: 8, 16 o 32 (float)
+    uint32_t config_version;   // Última configuración remota aplicada (0 = local)
+    uint16_t telemetry_interval; // Segundos entre registros de telemetría (0 = ninguno)
+    uint8_t adaptive_quality;  // El planificador puede cambiar de preset (0 = nivel fijo)
+    uint8_t active_quality;    // Preset en uso: quality_level o el del planificador
+    uint8_t power_save;        // DFS, light sleep, modem sleep y sondeo de TV (0 = siempre activo)
 } audio_config_t;
 
 // Configuración por defecto
@@ -73,12 +125,28 @@ audio_config_t audio_config = {
     .fft_size = 1024,
     .hop_length = 512,
     .n_mels = 13,
+    .n_mfcc = 12,
     .min_freq = 300.0,
     .max_freq = 8000.0,
     .capture_duration = 30,
     .capture_interval = 60,
     .noise_threshold = 0.01,
-    .quality_level = 3
+    .quality_level = 3,
+    .dsp_mode = DSP_MODE_FLOAT,
+    .fingerprint_mode = FINGERPRINT_MODE_LANDMARKS,
+    .capture_mode = CAPTURE_MODE_CONTINUOUS,
+    .stream_window = 10,
+    .stream_interval = 5,
+    .change_threshold = 0.02,
+    .heartbeat_interval = 60,
+    .batch_size = 4,
+    .batch_linger = 30,
+    .wire_format = WIRE_FORMAT_BINARY,
+    .mfcc_bits = 16,
+    .telemetry_interval = 300,
+    .adaptive_quality = 1,
+    .active_quality = 3,
+    .power_save = 1
 };
 
 // Estados del sistema
@@ -93,9 +161,8 @@ typedef enum {
 } system_state_t;
 
 // Variables globales
-static system_state_t current_state = STATE_INIT;
+static volatile system_state_t current_state = STATE_INIT;   // Sólo la escribe display_task
 static SSD1306_t display;
-static QueueHandle_t audio_queue;
 static EventGroupHandle_t wifi_event_group;
 static bool wifi_connected = false;
 static uint32_t samples_processed = 0;
@@ -105,22 +172,195 @@ static uint32_t config_menu_index = 0;
 const int WIFI_CONNECTED_BIT = BIT0;
 
 // ================================
-// ESTRUCTURAS DE DATOS
+// INSTRUMENTACIÓN
 // ================================
 
+// Spans en ciclos de CPU (esp_cpu_get_ccount) alrededor de cada etapa del
+// pipeline. Cada etapa la registra una sola tarea fijada a un core, así que
+// no hacen falta cerrojos: el lector sólo pide el reinicio y el escritor lo
+// aplica en su siguiente muestra. Con AUDIO_PERF_ENABLE a 0 (audio_dsp.h)
+// los spans no generan código.
+
+typedef enum {
+    PERF_STAGE_CAPTURE = AUDIMETER_STAGE_CAPTURE,
+    PERF_STAGE_PREEMPHASIS = AUDIMETER_STAGE_PREEMPHASIS,
+    PERF_STAGE_FFT = AUDIMETER_STAGE_FFT,
+    PERF_STAGE_MFCC = AUDIMETER_STAGE_MFCC,
+    PERF_STAGE_HASHING = AUDIMETER_STAGE_HASHING,
+    PERF_STAGE_FINGERPRINT = AUDIMETER_STAGE_FINGERPRINT,
+    PERF_STAGE_ENCODING = AUDIMETER_STAGE_ENCODING,
+    PERF_STAGE_HTTP = AUDIMETER_STAGE_HTTP,
+    PERF_STAGE_COUNT
+} perf_stage_id_t;
+
+static const char* const perf_stage_names[PERF_STAGE_COUNT] = {
+    "capture", "preemphasis", "fft", "mfcc", "hashing", "fingerprint", "encoding", "http"
+};
+
+// Histograma logarítmico: 4 cubetas por octava (error del p99 < 25 %)
+#define PERF_HIST_SUB_BITS  2
+#define PERF_HIST_BUCKETS   (32 << PERF_HIST_SUB_BITS)
+
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    uint16_t buckets[PERF_HIST_BUCKETS];   // Saturan en UINT16_MAX
+    volatile bool reset;       // Lo pide el lector; lo aplica el escritor
+} perf_stage_t;
+
+static perf_stage_t perf_stages[PERF_STAGE_COUNT];
+
+static inline uint32_t perf_bucket(uint32_t cycles) {
+    if (cycles < (1u << PERF_HIST_SUB_BITS)) {
+        return cycles;
+    }
+    uint32_t e = 31 - __builtin_clz(cycles);
+    uint32_t mantissa = (cycles >> (e - PERF_HIST_SUB_BITS)) & ((1u << PERF_HIST_SUB_BITS) - 1);
+    return ((e - PERF_HIST_SUB_BITS + 1) << PERF_HIST_SUB_BITS) | mantissa;
+}
+
+// Mayor valor que cae en la cubeta `bucket`
+static uint32_t perf_bucket_upper(uint32_t bucket) {
+    if (bucket < (1u << PERF_HIST_SUB_BITS)) {
+        return bucket;
+    }
+    uint32_t e = (bucket >> PERF_HIST_SUB_BITS) + PERF_HIST_SUB_BITS - 1;
+    uint64_t step = 1ull << (e - PERF_HIST_SUB_BITS);
+    uint64_t upper = ((uint64_t)(bucket & ((1u << PERF_HIST_SUB_BITS) - 1)) +
+                      (1u << PERF_HIST_SUB_BITS) + 1) * step - 1;
+    return upper > UINT32_MAX ? UINT32_MAX : (uint32_t)upper;
+}
+
+static inline void perf_record(perf_stage_id_t id, uint32_t cycles) {
+    perf_stage_t* stage = &perf_stages[id];
+    if (stage->reset) {
+        memset((void*)stage, 0, sizeof(*stage));
+    }
+    if (stage->count == 0 || cycles < stage->min) {
+        stage->min = cycles;
+    }
+    if (cycles > stage->max) {
+        stage->max = cycles;
+    }
+    stage->count++;
+    stage->total += cycles;
+    uint16_t* bucket = &stage->buckets[perf_bucket(cycles)];
+    if (*bucket < UINT16_MAX) {
+        (*bucket)++;
+    }
+}
+
+#if AUDIO_PERF_ENABLE
+#define PERF_SPAN_BEGIN(span)        uint32_t span = esp_cpu_get_ccount()
+#define PERF_SPAN_END(span, stage)   perf_record(stage, esp_cpu_get_ccount() - span)
+#else
+#define PERF_SPAN_BEGIN(span)        do { } while (0)
+#define PERF_SPAN_END(span, stage)   do { } while (0)
+#endif
+
 typedef struct {
-    float *data;
-    size_t length;
-    uint64_t timestamp;
-} audio_sample_t;
+    uint32_t count;
+    uint32_t min;
+    uint32_t mean;
+    uint32_t p99;
+    uint32_t max;
+} perf_summary_t;
+
+// Resumir una etapa y pedir su reinicio. Una etapa con el reinicio aún
+// pendiente no registró nada desde el último resumen.
+static void perf_stage_take(perf_stage_id_t id, perf_summary_t* out) {
+    static perf_stage_t copy;
+    perf_stage_t* stage = &perf_stages[id];
+    memset(out, 0, sizeof(*out));
+    if (stage->reset) {
+        return;
+    }
+    memcpy(&copy, (const void*)stage, sizeof(copy));
+    stage->reset = true;
+    if (copy.count == 0) {
+        return;
+    }
+    
+    uint32_t in_buckets = 0;
+    for (int b = 0; b < PERF_HIST_BUCKETS; b++) {
+        in_buckets += copy.buckets[b];
+    }
+    uint32_t target = in_buckets - in_buckets / 100;
+    uint32_t seen = 0;
+    int b = 0;
+    while (b < PERF_HIST_BUCKETS - 1 && (seen += copy.buckets[b]) < target) {
+        b++;
+    }
+    
+    out->count = copy.count;
+    out->min = copy.min;
+    out->max = copy.max;
+    out->mean = (uint32_t)(copy.total / copy.count);
+    uint32_t p99 = perf_bucket_upper(b);
+    out->p99 = p99 < copy.max ? p99 : copy.max;
+}
+
+// Pila mínima libre y uso de CPU de cada tarea desde la muestra anterior.
+// Con max == 0 sólo se toma la referencia para la siguiente muestra.
+#define PERF_MAX_TASKS  24
 
 typedef struct {
-    char hash[33];          // MD5 hash como string
-    uint64_t timestamp;
-    float confidence;
-    uint16_t duration;
-    char features[256];     // Features codificados en base64
-} fingerprint_t;
+    char name[AUDIMETER_TASK_NAME_LEN];
+    uint32_t stack_free;       // Bytes
+    uint16_t cpu_permille;     // De un core
+} perf_task_t;
+
+static int perf_tasks_sample(perf_task_t* out, int max) {
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+    static struct {
+        UBaseType_t number;
+        uint32_t runtime;
+    } previous[PERF_MAX_TASKS];
+    static int n_previous = 0;
+    static uint32_t previous_total = 0;
+    
+    UBaseType_t capacity = uxTaskGetNumberOfTasks() + 2;
+    TaskStatus_t* status = malloc(capacity * sizeof(TaskStatus_t));
+    if (status == NULL) {
+        return 0;
+    }
+    uint32_t total = 0;
+    int n = uxTaskGetSystemState(status, capacity, &total);
+    uint32_t elapsed = total - previous_total;
+    if (n > PERF_MAX_TASKS) {
+        n = PERF_MAX_TASKS;
+    }
+    int n_out = n < max ? n : max;
+    
+    for (int i = 0; i < n_out; i++) {
+        // Cada tarea corre en un core: su tiempo se mide contra el total
+        uint32_t runtime = status[i].ulRunTimeCounter;
+        uint32_t ran = runtime;
+        for (int j = 0; j < n_previous; j++) {
+            if (previous[j].number == status[i].xTaskNumber) {
+                ran = runtime - previous[j].runtime;
+                break;
+            }
+        }
+        strncpy(out[i].name, status[i].pcTaskName, AUDIMETER_TASK_NAME_LEN - 1);
+        out[i].name[AUDIMETER_TASK_NAME_LEN - 1] = '\0';
+        out[i].stack_free = status[i].usStackHighWaterMark;
+        out[i].cpu_permille = elapsed ? (uint16_t)(((uint64_t)ran * 1000) / elapsed) : 0;
+    }
+    for (int i = 0; i < n; i++) {
+        previous[i].number = status[i].xTaskNumber;
+        previous[i].runtime = status[i].ulRunTimeCounter;
+    }
+    n_previous = n;
+    previous_total = total;
+    free(status);
+    return n_out;
+#else
+    return 0;
+#endif
+}
 
 // ================================
 // FUNCIONES DE UTILIDAD
@@ -133,21 +373,6 @@ uint64_t get_timestamp() {
     return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
 }
 
-// Función para calcular MD5
-void calculate_md5(const char* data, size_t len, char* output) {
-    unsigned char digest[16];
-    MD5_CTX ctx;
-    
-    MD5_Init(&ctx);
-    MD5_Update(&ctx, (unsigned char*)data, len);
-    MD5_Final(digest, &ctx);
-    
-    for(int i = 0; i < 16; i++) {
-        sprintf(output + i*2, "%02x", digest[i]);
-    }
-    output[32] = '\0';
-}
-
 // Codificación Base64 simple
 static const char base64_chars[] = 
     "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
@@ -167,7 +392,7 @@ void base64_encode(const unsigned char* data, size_t len, char* output) {
     }
     
     // Padding
-    int padding = 3 - ((len - 1) % 3);
+    int padding = (3 - len % 3) % 3;
     for (int k = 0; k < padding; k++) {
         output[j - 1 - k] = '=';
     }
@@ -175,128 +400,156 @@ void base64_encode(const unsigned char* data, size_t len, char* output) {
 }
 
 // ================================
-// FUNCIONES DE PROCESAMIENTO DE AUDIO
+// PIPELINE DSP
 // ================================
 
-// Aplicar ventana de Hamming
-void apply_hamming_window(float* data, size_t length) {
-    for (size_t i = 0; i < length; i++) {
-        float w = 0.54 - 0.46 * cosf(2.0 * M_PI * i / (length - 1));
-        data[i] *= w;
-    }
+// El pipeline (tablas, STFT, landmarks y fingerprints) vive en el componente
+// audio_dsp; aquí sólo se le pasa la configuración y la memoria.
+
+// Los buffers del pipeline se reparten desde dos arenas: "hot" en RAM
+// interna (tablas DSP y buffers por frame) y "bulk" en PSRAM (historia de
+// la ventana).
+static arena_t hot_arena = {
+    .name = "hot",
+    .caps = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT
+};
+static arena_t bulk_arena = {
+    .name = "bulk",
+    .caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT,
+    .fallback_caps = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT
+};
+
+// Se incrementa cada vez que cambia un parámetro que afecta a las tablas
+static volatile uint32_t dsp_config_generation = 0;
+
+// Modo DSP efectivo: sin la ruta Q15 compilada siempre se usa float
+static inline dsp_mode_t dsp_active_mode(void) {
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+    return (audio_config.dsp_mode == DSP_MODE_FIXED) ? DSP_MODE_FIXED : DSP_MODE_FLOAT;
+#else
+    return DSP_MODE_FLOAT;
+#endif
 }
 
-// Pre-énfasis para mejorar altas frecuencias
-void pre_emphasis(float* data, size_t length, float alpha) {
-    for (int i = length - 1; i > 0; i--) {
-        data[i] = data[i] - alpha * data[i-1];
-    }
+static dsp_params_t dsp_params_from_config(const audio_config_t* config) {
+    dsp_params_t params = {
+        .sample_rate = config->sample_rate,
+        .fft_size = config->fft_size,
+        .hop_length = config->hop_length,
+        .n_mels = config->n_mels,
+        .n_mfcc = config->n_mfcc,
+        .min_freq = config->min_freq,
+        .max_freq = config->max_freq,
+        .mode = config->dsp_mode,
+    };
+    return params;
 }
 
-// Detectar si la muestra contiene principalmente ruido
-bool is_noise(float* data, size_t length) {
-    float energy = 0.0;
-    for (size_t i = 0; i < length; i++) {
-        energy += data[i] * data[i];
-    }
-    energy /= length;
-    return (energy < audio_config.noise_threshold);
+static fingerprint_params_t fingerprint_params_from_config(const audio_config_t* config) {
+    bool continuous = (config->capture_mode == CAPTURE_MODE_CONTINUOUS);
+    fingerprint_params_t params = {
+        .mode = config->fingerprint_mode,
+        .continuous = continuous,
+        .window_seconds = continuous ? config->stream_window : config->capture_duration,
+        .interval_seconds = config->stream_interval,
+        .noise_threshold = config->noise_threshold,
+    };
+    return params;
 }
 
-// Extraer características MFCC simplificadas
-void extract_mfcc_features(float* audio_data, size_t length, float* features) {
-    // Implementación simplificada de MFCC
-    // En producción, usar librerías especializadas como librosa-equivalent
-    
-    size_t n_frames = (length - audio_config.fft_size) / audio_config.hop_length + 1;
-    float* fft_buffer = malloc(audio_config.fft_size * sizeof(float));
-    float* power_spectrum = malloc(audio_config.fft_size/2 * sizeof(float));
-    
-    // Inicializar DSP
-    dsps_fft2r_init_fc32(NULL, audio_config.fft_size);
-    
-    for (size_t frame = 0; frame < n_frames && frame < audio_config.n_mels; frame++) {
-        size_t start = frame * audio_config.hop_length;
-        
-        // Copiar ventana de audio
-        memcpy(fft_buffer, &audio_data[start], audio_config.fft_size * sizeof(float));
-        
-        // Aplicar ventana
-        apply_hamming_window(fft_buffer, audio_config.fft_size);
-        
-        // FFT
-        dsps_fft2r_fc32(fft_buffer, audio_config.fft_size);
-        dsps_bit_rev_fc32(fft_buffer, audio_config.fft_size);
-        
-        // Calcular espectro de potencia
-        for (int i = 0; i < audio_config.fft_size/2; i++) {
-            float real = fft_buffer[i*2];
-            float imag = fft_buffer[i*2 + 1];
-            power_spectrum[i] = real*real + imag*imag;
-        }
-        
-        // Filtros Mel simplificados - promedio de bandas
-        float mel_energy = 0.0;
-        int start_bin = (audio_config.min_freq * audio_config.fft_size) / audio_config.sample_rate;
-        int end_bin = (audio_config.max_freq * audio_config.fft_size) / audio_config.sample_rate;
-        
-        for (int i = start_bin; i < end_bin; i++) {
-            mel_energy += power_spectrum[i];
-        }
-        
-        // Log y DCT simplificado
-        features[frame] = logf(mel_energy + 1e-10);
+#if AUDIO_PERF_ENABLE
+// Etapas del componente en la numeración de la telemetría
+static const perf_stage_id_t perf_dsp_stages[DSP_STAGE_COUNT] = {
+    [DSP_STAGE_PREEMPHASIS] = PERF_STAGE_PREEMPHASIS,
+    [DSP_STAGE_FFT] = PERF_STAGE_FFT,
+    [DSP_STAGE_MFCC] = PERF_STAGE_MFCC,
+    [DSP_STAGE_HASHING] = PERF_STAGE_HASHING,
+    [DSP_STAGE_FINGERPRINT] = PERF_STAGE_FINGERPRINT,
+};
+
+static void DSP_HOT_FN perf_dsp_span(dsp_stage_t stage, uint32_t cycles) {
+    perf_record(perf_dsp_stages[stage], cycles);
+}
+#endif
+
+// ================================
+// DETECCIÓN DE CAMBIOS
+// ================================
+
+#define CHANGE_FORCE_SEND_S  600   // Reenviar completo al menos cada 10 minutos
+
+typedef enum {
+    CHANGE_SEND_FULL,          // Contenido nuevo: fingerprint completo
+    CHANGE_SEND_HEARTBEAT,     // Sin cambios: aviso ligero
+    CHANGE_SKIP                // Sin cambios y heartbeat reciente
+} change_action_t;
+
+// Firma del último fingerprint enviado
+typedef struct {
+    bool valid;
+    uint8_t mode;
+    uint16_t signature_len;
+    float signature[SIGNATURE_MAX_LEN];
+    char hash[33];
+    uint64_t sent_at;          // Timestamp del último envío completo
+    uint64_t heartbeat_at;     // Timestamp del último heartbeat
+    uint64_t changed_at;       // Timestamp del último cambio de contenido
+    uint32_t suppressed;       // Fingerprints no enviados desde el último completo
+} change_detector_t;
+
+static change_detector_t change_detector;
+
+// Distancia coseno (1 - cos) entre dos firmas de igual longitud
+static float signature_distance(const float* a, const float* b, uint16_t len) {
+    float dot = 0.0f, na = 0.0f, nb = 0.0f;
+    for (int i = 0; i < len; i++) {
+        dot += a[i] * b[i];
+        na += a[i] * a[i];
+        nb += b[i] * b[i];
     }
-    
-    free(fft_buffer);
-    free(power_spectrum);
+    if (na <= 0.0f || nb <= 0.0f) {
+        return 1.0f;
+    }
+    return 1.0f - dot / sqrtf(na * nb);
 }
 
-// Generar fingerprint de la muestra de audio
-void generate_fingerprint(audio_sample_t* sample, fingerprint_t* fingerprint) {
-    if (is_noise(sample->data, sample->length)) {
-        ESP_LOGW(TAG, "Muestra descartada: ruido detectado");
-        fingerprint->confidence = 0.0;
-        return;
+// Decidir qué enviar comparando con el último fingerprint enviado
+// El reenvío periódico no cuenta como cambio de contenido (changed_at)
+change_action_t change_detector_check(change_detector_t* det, const fingerprint_t* fp) {
+    if (!det->valid || det->mode != fp->mode || det->signature_len != fp->signature_len) {
+        det->changed_at = fp->timestamp;
+        return CHANGE_SEND_FULL;
     }
-    
-    // Pre-procesamiento
-    pre_emphasis(sample->data, sample->length, 0.97);
-    
-    // Extraer características
-    float* mfcc_features = malloc(audio_config.n_mels * sizeof(float));
-    extract_mfcc_features(sample->data, sample->length, mfcc_features);
-    
-    // Codificar características en Base64
-    base64_encode((unsigned char*)mfcc_features, 
-                  audio_config.n_mels * sizeof(float), 
-                  fingerprint->features);
-    
-    // Generar hash único de las características
-    calculate_md5(fingerprint->features, strlen(fingerprint->features), fingerprint->hash);
-    
-    // Calcular confianza basada en energía y varianza
-    float energy = 0.0, variance = 0.0, mean = 0.0;
-    for (int i = 0; i < audio_config.n_mels; i++) {
-        energy += mfcc_features[i] * mfcc_features[i];
-        mean += mfcc_features[i];
+    if (audio_config.change_threshold <= 0.0f ||
+        fp->timestamp - det->sent_at >= (uint64_t)CHANGE_FORCE_SEND_S * 1000000ULL) {
+        return CHANGE_SEND_FULL;
     }
-    mean /= audio_config.n_mels;
     
-    for (int i = 0; i < audio_config.n_mels; i++) {
-        float diff = mfcc_features[i] - mean;
-        variance += diff * diff;
+    float distance = signature_distance(det->signature, fp->signature, fp->signature_len);
+    if (distance > audio_config.change_threshold) {
+        ESP_LOGI(TAG, "Cambio de contenido detectado (distancia %.3f)", distance);
+        det->changed_at = fp->timestamp;
+        return CHANGE_SEND_FULL;
     }
-    variance /= audio_config.n_mels;
     
-    fingerprint->confidence = fminf(1.0, sqrtf(energy) * sqrtf(variance) * 10.0);
-    fingerprint->timestamp = sample->timestamp;
-    fingerprint->duration = audio_config.capture_duration;
-    
-    free(mfcc_features);
-    
-    ESP_LOGI(TAG, "Fingerprint generado - Hash: %.8s..., Confianza: %.2f", 
-             fingerprint->hash, fingerprint->confidence);
+    det->suppressed++;
+    if (audio_config.heartbeat_interval > 0 &&
+        fp->timestamp - det->heartbeat_at >= (uint64_t)audio_config.heartbeat_interval * 1000000ULL) {
+        return CHANGE_SEND_HEARTBEAT;
+    }
+    return CHANGE_SKIP;
+}
+
+// Registrar un envío completo como nueva referencia
+void change_detector_commit(change_detector_t* det, const fingerprint_t* fp) {
+    det->valid = true;
+    det->mode = fp->mode;
+    det->signature_len = fp->signature_len;
+    memcpy(det->signature, fp->signature, fp->signature_len * sizeof(float));
+    strcpy(det->hash, fp->hash);
+    det->sent_at = fp->timestamp;
+    det->heartbeat_at = fp->timestamp;
+    det->suppressed = 0;
 }
 
 // ================================
@@ -307,13 +560,13 @@ void generate_fingerprint(audio_sample_t* sample, fingerprint_t* fingerprint) {
 void init_i2s() {
     i2s_config_t i2s_config = {
         .mode = I2S_MODE_MASTER | I2S_MODE_RX,
-        .sample_rate = audio_config.sample_rate,
+        .sample_rate = DSP_CAPTURE_RATE,
         .bits_per_sample = I2S_BITS_PER_SAMPLE_32BIT,
         .channel_format = I2S_CHANNEL_FMT_ONLY_LEFT,
         .communication_format = I2S_COMM_FORMAT_I2S,
         .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
-        .dma_buf_count = 4,
-        .dma_buf_len = 1024,
+        .dma_buf_count = I2S_DMA_BUF_COUNT,
+        .dma_buf_len = I2S_DMA_BUF_LEN,
         .use_apll = false,
         .tx_desc_auto_clear = false,
         .fixed_mclk = 0
@@ -336,12 +589,15 @@ void init_display() {
     ssd1306_init(&display, 128, 64);
     ssd1306_clear_screen(&display, false);
     ssd1306_contrast(&display, 0xFF);
+    memset(display.framebuffer, 0, sizeof(display.framebuffer));   // Igual que la pantalla
+    display.dirty = 0;
 }
 
 // Configurar botones
+// Interrupción en ambos flancos: la pulsación larga se mide hasta soltar
 void init_buttons() {
     gpio_config_t io_conf = {
-        .intr_type = GPIO_INTR_POSEDGE,
+        .intr_type = GPIO_INTR_ANYEDGE,
         .mode = GPIO_MODE_INPUT,
         .pin_bit_mask = (1ULL << BUTTON_1_PIN) | (1ULL << BUTTON_2_PIN),
         .pull_down_en = 0,
@@ -351,475 +607,2800 @@ void init_buttons() {
 }
 
 // ================================
-// INTERFAZ HMI
+// GESTIÓN DE ENERGÍA
 // ================================
 
-void update_display() {
-    ssd1306_clear_screen(&display, false);
-    
-    char line1[32], line2[32], line3[32], line4[32];
-    
-    switch(current_state) {
-        case STATE_INIT:
-            strcpy(line1, "TV Audience Monitor");
-            strcpy(line2, "Inicializando...");
-            sprintf(line3, "Calidad: %d/5", audio_config.quality_level);
-            strcpy(line4, "");
-            break;
-            
-        case STATE_CONNECTING:
-            strcpy(line1, "Conectando WiFi");
-            strcpy(line2, "Espere...");
-            strcpy(line3, "");
-            strcpy(line4, "");
-            break;
-            
-        case STATE_SAMPLING:
-            strcpy(line1, "Capturando Audio");
-            sprintf(line2, "SR: %dkHz", audio_config.sample_rate/1000);
-            sprintf(line3, "Muestras: %lu", samples_processed);
-            sprintf(line4, "Enviadas: %lu", transmissions_sent);
-            break;
-            
-        case STATE_PROCESSING:
-            strcpy(line1, "Procesando...");
-            sprintf(line2, "FFT: %d pts", audio_config.fft_size);
-            sprintf(line3, "MFCC: %d coef", audio_config.n_mels);
-            strcpy(line4, "Generando hash");
-            break;
-            
-        case STATE_TRANSMITTING:
-            strcpy(line1, "Transmitiendo");
-            strcpy(line2, "Enviando datos");
-            strcpy(line3, "al servidor");
-            strcpy(line4, "");
-            break;
-            
-        case STATE_CONFIG:
-            strcpy(line1, "CONFIGURACION");
-            switch(config_menu_index % 8) {
-                case 0:
-                    sprintf(line2, ">Sample Rate");
-                    sprintf(line3, " %d Hz", audio_config.sample_rate);
-                    break;
-                case 1:
-                    sprintf(line2, ">FFT Size");
-                    sprintf(line3, " %d puntos", audio_config.fft_size);
-                    break;
-                case 2:
-                    sprintf(line2, ">MFCC Coeffs");
-                    sprintf(line3, " %d coef", audio_config.n_mels);
-                    break;
-                case 3:
-                    sprintf(line2, ">Duracion Cap");
-                    sprintf(line3, " %d seg", audio_config.capture_duration);
-                    break;
-                case 4:
-                    sprintf(line2, ">Intervalo");
-                    sprintf(line3, " %d seg", audio_config.capture_interval);
-                    break;
-                case 5:
-                    sprintf(line2, ">Umbral Ruido");
-                    sprintf(line3, " %.3f", audio_config.noise_threshold);
-                    break;
-                case 6:
-                    sprintf(line2, ">Calidad");
-                    sprintf(line3, " %d/5", audio_config.quality_level);
-                    break;
-                case 7:
-                    strcpy(line2, ">Salir Config");
-                    strcpy(line3, " Presionar B2");
-                    break;
-            }
-            strcpy(line4, "B1:Nav B2:Edit/Exit");
-            break;
-            
-        case STATE_ERROR:
-            strcpy(line1, "ERROR");
-            strcpy(line2, "Revisar conexion");
-            strcpy(line3, "o configuracion");
-            strcpy(line4, "B1: Reintentar");
-            break;
-    }
-    
-    ssd1306_display_text(&display, 0, line1, strlen(line1), false);
-    ssd1306_display_text(&display, 1, line2, strlen(line2), false);
-    ssd1306_display_text(&display, 2, line3, strlen(line3), false);
-    ssd1306_display_text(&display, 3, line4, strlen(line4), false);
-}
+// Con power_save la frecuencia de CPU baja a PM_MIN_FREQ_MHZ y el sistema
+// entra en light sleep (tickless idle) cuando ninguna tarea lo impide: el
+// I2S en marcha, el procesamiento de un flujo y los envíos toman cerrojos.
+// En la práctica sólo se duerme entre capturas por ciclos, con el I2S
+// parado. La radio queda en modem sleep máximo entre lotes y escucha uno
+// de cada RADIO_LISTEN_INTERVAL beacons; durante un envío pasa al mínimo.
 
-void handle_button_press(int button) {
-    if (button == BUTTON_1_PIN) {
-        if (current_state == STATE_CONFIG) {
-            config_menu_index++;
-        } else if (current_state == STATE_ERROR) {
-            current_state = STATE_INIT;
+#define PM_MIN_FREQ_MHZ           80     // APB a 80 MHz: I2S e I2C no cambian de reloj
+#define RADIO_LISTEN_INTERVAL     10     // Beacons entre escuchas en WIFI_PS_MAX_MODEM
+#define TV_PROBE_SETTLE_BLOCKS    2      // Bloques descartados al rearrancar el I2S
+#define TV_PROBE_BLOCKS           4      // Bloques del sondeo de TV (~0.25 s a 16 kHz)
+#define TV_PROBE_THRESHOLD_RATIO  0.5f   // Umbral del sondeo frente a noise_threshold
+
+static esp_pm_lock_handle_t pm_dsp_lock = NULL;      // Procesamiento de un flujo
+static esp_pm_lock_handle_t pm_uplink_lock = NULL;   // TLS y envío
+
+static void pm_lock_take(esp_pm_lock_handle_t lock, bool take) {
+    if (lock) {
+        if (take) {
+            esp_pm_lock_acquire(lock);
         } else {
-            current_state = STATE_CONFIG;
-            config_menu_index = 0;
-        }
-    } else if (button == BUTTON_2_PIN) {
-        if (current_state == STATE_CONFIG) {
-            // Editar parámetro actual o salir
-            switch(config_menu_index % 8) {
-                case 0: // Sample Rate
-                    audio_config.sample_rate = (audio_config.sample_rate == 16000) ? 22050 : 
-                                               (audio_config.sample_rate == 22050) ? 44100 : 16000;
-                    break;
-                case 1: // FFT Size
-                    audio_config.fft_size = (audio_config.fft_size == 512) ? 1024 : 
-                                            (audio_config.fft_size == 1024) ? 2048 : 512;
-                    break;
-                case 2: // MFCC
-                    audio_config.n_mels = (audio_config.n_mels + 2) % 20 + 10;
-                    break;
-                case 3: // Duración
-                    audio_config.capture_duration = (audio_config.capture_duration % 60) + 15;
-                    break;
-                case 4: // Intervalo
-                    audio_config.capture_interval = (audio_config.capture_interval % 300) + 30;
-                    break;
-                case 5: // Umbral
-                    audio_config.noise_threshold += 0.01;
-                    if (audio_config.noise_threshold > 0.1) audio_config.noise_threshold = 0.001;
-                    break;
-                case 6: // Calidad
-                    audio_config.quality_level = (audio_config.quality_level % 5) + 1;
-                    break;
-                case 7: // Salir
-                    current_state = STATE_SAMPLING;
-                    break;
-            }
+            esp_pm_lock_release(lock);
         }
     }
-    update_display();
+}
+
+// Aplicar audio_config.power_save. Se llama tras iniciar la WiFi y al
+// cambiar la configuración.
+void power_configure(void) {
+    bool save = audio_config.power_save;
+#if CONFIG_PM_ENABLE
+    if (pm_dsp_lock == NULL) {
+        esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "dsp", &pm_dsp_lock);
+        esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "uplink", &pm_uplink_lock);
+    }
+    esp_pm_config_esp32_t pm_config = {
+        .max_freq_mhz = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = save ? PM_MIN_FREQ_MHZ : CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ,
+        .light_sleep_enable = save
+    };
+    esp_err_t err = esp_pm_configure(&pm_config);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Error configurando gestión de energía: %s", esp_err_to_name(err));
+    }
+#endif
+    esp_wifi_set_ps(save ? WIFI_PS_MAX_MODEM : WIFI_PS_MIN_MODEM);
+    ESP_LOGI(TAG, "Ahorro de energía %s", save ? "activado" : "desactivado");
+}
+
+// Radio y CPU al máximo mientras dura un envío
+static void power_uplink_begin(void) {
+    pm_lock_take(pm_uplink_lock, true);
+    if (audio_config.power_save) {
+        esp_wifi_set_ps(WIFI_PS_MIN_MODEM);
+    }
+}
+
+static void power_uplink_end(void) {
+    if (audio_config.power_save) {
+        esp_wifi_set_ps(WIFI_PS_MAX_MODEM);
+    }
+    pm_lock_take(pm_uplink_lock, false);
 }
 
 // ================================
-// FUNCIONES DE RED
+// BASE DE TIEMPOS DE CAPTURA
 // ================================
 
-static void event_handler(void* arg, esp_event_base_t event_base,
-                         int32_t event_id, void* event_data) {
-    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
-        esp_wifi_connect();
-    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        esp_wifi_connect();
-        wifi_connected = false;
-        ESP_LOGI(TAG, "Reintentando conexión WiFi");
-    } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
-        wifi_connected = true;
-        xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_BIT);
-        ESP_LOGI(TAG, "WiFi conectado exitosamente");
+// Cada muestra I2S tiene su instante: la cuenta de muestras desde el
+// arranque se ancla al reloj monótono (esp_timer) y éste a UTC. El ancla
+// monótona es el mínimo de (fin de lectura - duración de lo leído): i2s_read
+// sólo puede volver después de que el DMA complete el buffer, así que el
+// retardo de planificación sólo suma y el mínimo se queda con la lectura más
+// puntual. UTC = monótono + desfase, y los ajustes de SNTP mueven ese desfase
+// poco a poco, sin saltos hacia atrás.
+
+#define TIMEBASE_SLEW_PPM      500        // Corrección máxima del desfase UTC
+#define TIMEBASE_STEP_US       1000000    // Con más error se salta directamente
+#define TIMEBASE_CREEP_US      1          // Subida máxima del ancla por lectura
+
+typedef struct {
+    portMUX_TYPE lock;
+    // Muestras I2S -> reloj monótono
+    uint64_t anchor_sample;    // Cuenta de muestras de referencia
+    int64_t anchor_us;         // esp_timer_get_time() estimado de anchor_sample
+    double us_per_sample;      // Periodo real del I2S (i2s_get_clk)
+    bool anchored;
+    // Reloj monótono -> UTC
+    int64_t offset_us;         // UTC - monótono, ya corregido hasta slewed_at
+    int64_t target_offset_us;  // Desfase medido en el último ajuste de SNTP
+    int64_t slewed_at;
+    bool synced;               // SNTP respondió al menos una vez
+    uint32_t steps;            // Ajustes aplicados de golpe
+} capture_timebase_t;
+
+static capture_timebase_t capture_timebase = {
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+    .us_per_sample = 1e6 / DSP_CAPTURE_RATE
+};
+
+// El I2S (re)arranca en `sample`: el ancla anterior ya no vale
+static void timebase_restart(capture_timebase_t* tb, uint64_t sample) {
+    float rate = i2s_get_clk(I2S_NUM_0);
+    taskENTER_CRITICAL(&tb->lock);
+    tb->anchor_sample = sample;
+    tb->us_per_sample = 1e6 / ((rate > 0) ? rate : DSP_CAPTURE_RATE);
+    tb->anchored = false;
+    taskEXIT_CRITICAL(&tb->lock);
+}
+
+// Lectura completada en now_us con la cuenta ya en end_sample
+static void timebase_observe(capture_timebase_t* tb, uint64_t end_sample, int64_t now_us) {
+    taskENTER_CRITICAL(&tb->lock);
+    int64_t candidate = now_us - (int64_t)((end_sample - tb->anchor_sample) * tb->us_per_sample);
+    if (!tb->anchored || candidate < tb->anchor_us) {
+        tb->anchor_us = candidate;
+        tb->anchored = true;
+    } else {
+        // Deriva entre el reloj del I2S y esp_timer, o muestras perdidas por el DMA
+        tb->anchor_us += (candidate - tb->anchor_us > TIMEBASE_CREEP_US) ?
+                         TIMEBASE_CREEP_US : candidate - tb->anchor_us;
     }
+    taskEXIT_CRITICAL(&tb->lock);
 }
 
-void init_wifi() {
-    wifi_event_group = xEventGroupCreate();
-    
-    ESP_ERROR_CHECK(esp_netif_init());
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
-    esp_netif_create_default_wifi_sta();
+// Desfase UTC en el instante monótono `mono_us`, acercándolo al de SNTP
+// como mucho TIMEBASE_SLEW_PPM. Llamar con el cerrojo tomado.
+static int64_t timebase_offset_locked(capture_timebase_t* tb, int64_t mono_us) {
+    if (mono_us > tb->slewed_at) {
+        int64_t max_step = (mono_us - tb->slewed_at) * TIMEBASE_SLEW_PPM / 1000000;
+        int64_t error = tb->target_offset_us - tb->offset_us;
+        if (error > max_step) {
+            error = max_step;
+        } else if (error < -max_step) {
+            error = -max_step;
+        }
+        tb->offset_us += error;
+        tb->slewed_at = mono_us;
+    }
+    return tb->offset_us;
+}
+
+// Nuevo desfase medido por SNTP: `utc_us` es la hora recibida ahora.
+// Devuelve el error que queda por corregir poco a poco (0 si se saltó).
+static int64_t timebase_sync(capture_timebase_t* tb, int64_t utc_us) {
+    int64_t mono_us = esp_timer_get_time();
+    taskENTER_CRITICAL(&tb->lock);
+    int64_t offset = timebase_offset_locked(tb, mono_us);
+    tb->target_offset_us = utc_us - mono_us;
+    int64_t error = tb->target_offset_us - offset;
+    if (!tb->synced || llabs(error) > TIMEBASE_STEP_US) {
+        tb->offset_us = tb->target_offset_us;
+        tb->steps++;
+        error = 0;
+    }
+    tb->synced = true;
+    taskEXIT_CRITICAL(&tb->lock);
+    return error;
+}
+
+// Hora UTC (µs) de la muestra I2S `sample`, con fracción
+static uint64_t timebase_sample_utc(capture_timebase_t* tb, double sample) {
+    taskENTER_CRITICAL(&tb->lock);
+    int64_t mono_us = tb->anchor_us +
+                      (int64_t)((sample - (double)tb->anchor_sample) * tb->us_per_sample);
+    int64_t utc_us = mono_us + timebase_offset_locked(tb, mono_us);
+    taskEXIT_CRITICAL(&tb->lock);
+    return (uint64_t)utc_us;
+}
+
+// Antes del primer SNTP el desfase sale del reloj del sistema (RTC)
+static void timebase_init(capture_timebase_t* tb) {
+    int64_t mono_us = esp_timer_get_time();
+    tb->offset_us = tb->target_offset_us = (int64_t)get_timestamp() - mono_us;
+    tb->slewed_at = mono_us;
+}
+
+// ================================
+// MOTOR DE CAPTURA POR BLOQUES
+// ================================
+
+typedef struct {
+    int32_t raw[CAPTURE_BLOCK_SAMPLES];   // Bloque leído del DMA (RAM interna)
+    union {                               // Bloque convertido, antes de diezmar
+        float native[CAPTURE_BLOCK_SAMPLES];
+        int16_t native_q15[CAPTURE_BLOCK_SAMPLES];
+    };
+    decimator_t decimator;     // DSP_CAPTURE_RATE -> sample_rate
+    uint64_t samples_captured; // A DSP_CAPTURE_RATE
+    uint64_t block_sample;     // Cuenta de la primera muestra del último bloque
+    uint32_t probes_silent;    // Capturas omitidas por el sondeo
+    bool running;              // I2S en marcha (i2s_driver_install lo arranca)
+} capture_engine_t;
+
+static capture_engine_t capture_engine;
+
+void capture_engine_init(capture_engine_t* engine) {
+    engine->samples_captured = 0;
+    engine->probes_silent = 0;
+    engine->running = true;
+    timebase_init(&capture_timebase);
+    timebase_restart(&capture_timebase, 0);
+}
+
+// Convertir un bloque int32 a float en un único bucle
+static inline void convert_block_i32_to_f32(const int32_t* in, float* out, size_t length) {
+    const float scale = 1.0f / (float)INT32_MAX;
+    for (size_t i = 0; i < length; i++) {
+        out[i] = (float)in[i] * scale;
+    }
+}
+
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+// El INMP441 entrega 24 bits justificados a la izquierda: Q15 = 16 bits altos
+static inline void convert_block_i32_to_q15(const int32_t* in, int16_t* out, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        out[i] = (int16_t)(in[i] >> 16);
+    }
+}
+#endif
+
+// Preparar el diezmador para un flujo nuevo a `sample_rate`. El filtro sólo
+// se rediseña si cambió la frecuencia; si no, basta con vaciar su historia.
+esp_err_t capture_engine_begin(capture_engine_t* engine, uint32_t sample_rate) {
+    if (engine->decimator.output_rate == sample_rate) {
+        decimator_reset(&engine->decimator);
+        return ESP_OK;
+    }
+    esp_err_t err = decimator_init(&engine->decimator, DSP_CAPTURE_RATE, sample_rate);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Sin diezmador de %d a %lu Hz", DSP_CAPTURE_RATE, sample_rate);
+    }
+    return err;
+}
+
+// Leer un buffer DMA completo a DSP_CAPTURE_RATE en engine->raw.
+// Devuelve el número de muestras leídas (0 en caso de error).
+static size_t capture_engine_read_raw(capture_engine_t* engine) {
+    size_t bytes_read = 0;
+    esp_err_t err = i2s_read(I2S_NUM_0, engine->raw, sizeof(engine->raw),
+                             &bytes_read, portMAX_DELAY);
+    int64_t read_at = esp_timer_get_time();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error leyendo I2S: %s", esp_err_to_name(err));
+        return 0;
+    }
+    size_t length = bytes_read / sizeof(int32_t);
+    engine->block_sample = engine->samples_captured;
+    engine->samples_captured += length;
+    timebase_observe(&capture_timebase, engine->samples_captured, read_at);
+    return length;
+}
+
+// Hora UTC (µs) de la primera muestra de análisis del último bloque leído,
+// descontando el retardo del diezmador
+uint64_t capture_engine_block_time(capture_engine_t* engine) {
+    return timebase_sample_utc(&capture_timebase,
+                               (double)engine->block_sample + decimator_phase(&engine->decimator));
+}
+
+// Leer un buffer DMA completo, convertirlo al formato indicado (float o
+// Q15) y diezmarlo directamente en `out` a la frecuencia de
+// capture_engine_begin. Con out == NULL el bloque se descarta.
+// Devuelve el número de muestras de análisis (0 en caso de error).
+size_t DSP_HOT_FN capture_engine_read_block(capture_engine_t* engine, void* out, dsp_mode_t format) {
+    size_t length = capture_engine_read_raw(engine);
+    if (out == NULL) {
+        return length / engine->decimator.factor;
+    }
+
+    PERF_SPAN_BEGIN(span);
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+    if (format == DSP_MODE_FIXED) {
+        convert_block_i32_to_q15(engine->raw, engine->native_q15, length);
+        length = decimator_process_q15(&engine->decimator, engine->native_q15, out, length);
+    } else
+#endif
+    {
+        convert_block_i32_to_f32(engine->raw, engine->native, length);
+        length = decimator_process(&engine->decimator, engine->native, out, length);
+    }
+    PERF_SPAN_END(span, PERF_STAGE_CAPTURE);
+    return length;
+}
+
+// Parar el I2S entre capturas: libera su cerrojo de APB y permite el light sleep
+void capture_engine_stop(capture_engine_t* engine) {
+    if (engine->running) {
+        i2s_stop(I2S_NUM_0);
+        engine->running = false;
+    }
+}
+
+// Rearrancar el I2S descartando lo que tarda el micrófono en estabilizarse
+void capture_engine_start(capture_engine_t* engine) {
+    if (engine->running) {
+        return;
+    }
+    i2s_zero_dma_buffer(I2S_NUM_0);
+    i2s_start(I2S_NUM_0);
+    engine->running = true;
+    for (int i = 0; i < TV_PROBE_SETTLE_BLOCKS; i++) {
+        capture_engine_read_raw(engine);
+    }
+    // Anclar tras descartar lo que quedara en el DMA de antes de la parada
+    timebase_restart(&capture_timebase, engine->samples_captured);
+}
+
+// Sondeo barato antes de una captura por ciclos: sólo la energía de unos
+// pocos bloques (is_noise, a la frecuencia nativa y sin diezmar), con margen
+// para no perder escenas tranquilas. Devuelve true si algún bloque tiene sonido.
+bool capture_engine_probe(capture_engine_t* engine) {
+    capture_engine_start(engine);
+    float threshold = audio_config.noise_threshold * TV_PROBE_THRESHOLD_RATIO;
+    for (int i = 0; i < TV_PROBE_BLOCKS; i++) {
+        size_t length = capture_engine_read_raw(engine);
+        convert_block_i32_to_f32(engine->raw, engine->native, length);
+        if (length > 0 && !is_noise(engine->native, length, threshold)) {
+            return true;
+        }
+    }
+    engine->probes_silent++;
+    return false;
+}
+
+// ================================
+// RING SPSC DE BLOQUES PCM
+// ================================
+
+#define PCM_BLOCK_FLAG_START   0x01  // Primer bloque de una captura
+#define PCM_BLOCK_FLAG_END     0x02  // Último bloque de una captura
+#define PCM_BLOCK_FLAG_GAP     0x04  // Se perdieron bloques antes de éste
+
+typedef struct {
+    union {
+        float* samples;      // Payload (PSRAM o RAM interna)
+        int16_t* samples_q15;
+    };
+    uint16_t length;
+    uint8_t flags;
+    uint8_t format;          // dsp_mode_t: DSP_MODE_FIXED = samples_q15
+    uint64_t timestamp;      // UTC (µs) de la primera muestra, ver capture_engine_block_time
+} pcm_block_t;
+
+// Un único productor (audio_capture_task) y un único consumidor
+// (audio_processing_task). Cada índice lo escribe sólo su dueño, por lo
+// que basta con acquire/release: sin mutex ni copias del payload.
+typedef struct {
+    pcm_block_t blocks[PCM_RING_BLOCKS];  // Descriptores en RAM interna
+    uint32_t capacity;                    // Potencia de 2 <= PCM_RING_BLOCKS
+    _Atomic uint32_t head;                // Próximo bloque a escribir
+    _Atomic uint32_t tail;                // Próximo bloque a leer
+    TaskHandle_t _Atomic consumer;        // Tarea a despertar al publicar
+    uint32_t overruns;                    // Bloques descartados por ring lleno
+} pcm_ring_t;
+
+static pcm_ring_t pcm_ring;
+
+esp_err_t pcm_ring_init(pcm_ring_t* ring) {
+    size_t block_bytes = PCM_BLOCK_SAMPLES * sizeof(float);
+    uint32_t capacity = PCM_RING_BLOCKS;
+    
+    // Payload en PSRAM: se escribe y se lee de forma secuencial
+    float* storage = heap_caps_malloc(capacity * block_bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (storage == NULL) {
+        capacity = PCM_RING_HOT_BLOCKS;
+        storage = heap_caps_malloc(capacity * block_bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        ESP_LOGW(TAG, "PSRAM no disponible, ring PCM reducido a %lu bloques", capacity);
+    }
+    if (storage == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    
+    memset(ring, 0, sizeof(*ring));
+    ring->capacity = capacity;
+    for (uint32_t i = 0; i < capacity; i++) {
+        ring->blocks[i].samples = storage + i * PCM_BLOCK_SAMPLES;
+    }
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->consumer, NULL);
+    return ESP_OK;
+}
+
+// Productor: obtener el siguiente bloque libre, NULL si el ring está lleno
+static inline pcm_block_t* pcm_ring_acquire(pcm_ring_t* ring) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail >= ring->capacity) {
+        return NULL;
+    }
+    return &ring->blocks[head & (ring->capacity - 1)];
+}
+
+// Productor: publicar el bloque obtenido con pcm_ring_acquire
+static inline void pcm_ring_commit(pcm_ring_t* ring) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    
+    TaskHandle_t consumer = atomic_load_explicit(&ring->consumer, memory_order_relaxed);
+    if (consumer) {
+        xTaskNotifyGive(consumer);
+    }
+}
+
+// Consumidor: bloque más antiguo pendiente, NULL si el ring está vacío
+static inline pcm_block_t* pcm_ring_peek(pcm_ring_t* ring) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail == head) {
+        return NULL;
+    }
+    return &ring->blocks[tail & (ring->capacity - 1)];
+}
+
+// Consumidor: devolver al productor el bloque obtenido con pcm_ring_peek
+static inline void pcm_ring_release(pcm_ring_t* ring) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+// ================================
+// RECONFIGURACIÓN EN CALIENTE
+// ================================
+
+// El menú y el servidor no escriben audio_config: dejan una petición que
+// aplica la tarea de captura entre dos flujos. Allí se cierra el flujo, se
+// espera a que el procesamiento lo termine, se persiste en NVS y se
+// reanuda. El I2S no se toca: el diezmador se rediseña al empezar el
+// siguiente flujo y tablas DSP y arenas al recibir su bloque START.
+
+#define PIPELINE_QUIESCE_TIMEOUT_MS  2000
+
+void save_config();
+void apply_quality_preset(audio_config_t* config);
+void quality_analysis_fill(audio_config_t* config, uint8_t level);
+
+static audio_config_t config_request;
+static volatile bool config_request_pending = false;
+static bool config_request_persist = false;   // Guardar en NVS al aplicarla
+static portMUX_TYPE config_request_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t capture_task_handle = NULL;
+static _Atomic uint32_t pipeline_streams_closed = 0;   // Flujos END ya procesados
+
+// Comprobar que una configuración es utilizable antes de aplicarla. Cubre
+// también la remota y la de NVS: un modo o formato desconocido no llega al
+// pipeline. max_freq puede pasar de Nyquist (el banco mel la recorta), pero
+// la banda debe empezar por debajo.
+bool config_validate(const audio_config_t* config) {
+    uint32_t rate = config->sample_rate;
+    uint16_t fft = config->fft_size;
+    return rate > 0 && DSP_CAPTURE_RATE % rate == 0 && DSP_CAPTURE_RATE / rate >= 2 &&
+           DSP_CAPTURE_RATE / rate <= DECIMATOR_MAX_FACTOR &&
+           fft >= 256 && fft <= CONFIG_DSP_MAX_FFT_SIZE && (fft & (fft - 1)) == 0 &&
+           config->hop_length > 0 && config->hop_length <= fft &&
+           config->n_mels >= 4 && config->n_mels <= MAX_MEL_BANDS &&
+           config->n_mfcc > 0 && config->n_mfcc <= config->n_mels &&
+           config->min_freq >= 0.0f && config->min_freq < config->max_freq &&
+           config->min_freq < rate / 2.0f &&
+           config->capture_duration > 0 && config->capture_interval > 0 &&
+           config->stream_interval > 0 && config->stream_interval <= config->stream_window &&
+           config->quality_level >= 1 && config->quality_level <= 5 &&
+           config->active_quality >= 1 && config->active_quality <= 5 &&
+           config->batch_size > 0 &&
+           (config->capture_mode == CAPTURE_MODE_DUTY_CYCLE ||
+            config->capture_mode == CAPTURE_MODE_CONTINUOUS) &&
+           (config->fingerprint_mode == FINGERPRINT_MODE_MFCC ||
+            config->fingerprint_mode == FINGERPRINT_MODE_LANDMARKS) &&
+           (config->wire_format == WIRE_FORMAT_JSON || config->wire_format == WIRE_FORMAT_BINARY) &&
+           (config->mfcc_bits == 8 || config->mfcc_bits == 16 || config->mfcc_bits == 32) &&
+           config->power_save <= 1 && config->adaptive_quality <= 1;
+}
+
+// La configuración que verá el pipeline tras la petición pendiente, si la hay
+static void config_current(audio_config_t* config) {
+    taskENTER_CRITICAL(&config_request_lock);
+    *config = config_request_pending ? config_request : audio_config;
+    taskEXIT_CRITICAL(&config_request_lock);
+}
+
+// Pedir que se aplique `config`. Los cambios del planificador no se
+// persisten, salvo que reemplacen una petición que sí debía guardarse.
+static bool config_request_post(const audio_config_t* config, bool persist) {
+    if (!config_validate(config)) {
+        ESP_LOGW(TAG, "Configuración rechazada: parámetros fuera de rango");
+        return false;
+    }
+    taskENTER_CRITICAL(&config_request_lock);
+    config_request = *config;
+    config_request_persist = persist || (config_request_pending && config_request_persist);
+    config_request_pending = true;
+    taskEXIT_CRITICAL(&config_request_lock);
+    
+    // Despertar la captura si espera el siguiente ciclo
+    if (capture_task_handle) {
+        xTaskNotifyGive(capture_task_handle);
+    }
+    return true;
+}
+
+// Pedir que se aplique y guarde `config`. Puede llamarse desde cualquier tarea.
+bool config_request_submit(const audio_config_t* config) {
+    return config_request_post(config, true);
+}
+
+// Cambios que obligan a reconstruir las tablas DSP
+static bool config_dsp_differs(const audio_config_t* a, const audio_config_t* b) {
+    return a->sample_rate != b->sample_rate || a->fft_size != b->fft_size ||
+           a->n_mels != b->n_mels || a->n_mfcc != b->n_mfcc ||
+           a->min_freq != b->min_freq || a->max_freq != b->max_freq ||
+           a->dsp_mode != b->dsp_mode;
+}
+
+// Configuración remota en la respuesta del servidor:
+// {"config": {"version": 7, "quality_level": 4, "fft_size": 2048, ...}}
+// quality_level aplica primero su preset y los demás campos lo ajustan.
+void remote_config_handle(const cJSON* json) {
+    const cJSON* remote = cJSON_GetObjectItem(json, "config");
+    const cJSON* version = cJSON_GetObjectItem(remote, "version");
+    audio_config_t config;
+    config_current(&config);
+    
+    if (!cJSON_IsNumber(version) ||
+        !(version->valuedouble >= 0 && version->valuedouble <= UINT32_MAX) ||
+        (uint32_t)version->valuedouble == config.config_version) {
+        return;
+    }
+    config.config_version = (uint32_t)version->valuedouble;
+    
+    // Convertir a entero un double que no cabe en el campo es indefinido y
+    // podría dar un valor que config_validate aceptara: comprobar el rango
+    // contra el tipo antes de asignar y rechazar la configuración entera
+    const char* invalid = NULL;
+    uint8_t mode_before = config.fingerprint_mode;
+    const cJSON* item = cJSON_GetObjectItem(remote, "quality_level");
+    if (cJSON_IsNumber(item)) {
+        if (!(item->valuedouble >= 1 && item->valuedouble <= 5)) {
+            invalid = "quality_level";
+        } else {
+            config.quality_level = item->valuedouble;
+            apply_quality_preset(&config);
+        }
+    }
+    
+#define REMOTE_UINT(name, max)                                  \
+    item = cJSON_GetObjectItem(remote, #name);                  \
+    if (invalid == NULL && cJSON_IsNumber(item)) {              \
+        if (!(item->valuedouble >= 0 && item->valuedouble <= (max))) { \
+            invalid = #name;                                    \
+        } else {                                                \
+            config.name = item->valuedouble;                    \
+        }                                                       \
+    }
+#define REMOTE_FLOAT(name)                                      \
+    item = cJSON_GetObjectItem(remote, #name);                  \
+    if (invalid == NULL && cJSON_IsNumber(item)) {              \
+        if (!isfinite(item->valuedouble)) {                     \
+            invalid = #name;                                    \
+        } else {                                                \
+            config.name = item->valuedouble;                    \
+        }                                                       \
+    }
+    REMOTE_UINT(sample_rate, UINT32_MAX)
+    REMOTE_UINT(fft_size, UINT16_MAX)
+    REMOTE_UINT(hop_length, UINT16_MAX)
+    REMOTE_UINT(n_mels, UINT16_MAX)
+    REMOTE_UINT(n_mfcc, UINT16_MAX)
+    REMOTE_FLOAT(min_freq)
+    REMOTE_FLOAT(max_freq)
+    REMOTE_UINT(capture_duration, UINT16_MAX)
+    REMOTE_UINT(capture_interval, UINT16_MAX)
+    REMOTE_UINT(capture_mode, UINT8_MAX)
+    REMOTE_UINT(stream_window, UINT16_MAX)
+    REMOTE_UINT(stream_interval, UINT16_MAX)
+    REMOTE_UINT(fingerprint_mode, UINT8_MAX)
+    REMOTE_FLOAT(noise_threshold)
+    REMOTE_FLOAT(change_threshold)
+    REMOTE_UINT(heartbeat_interval, UINT16_MAX)
+    REMOTE_UINT(wire_format, UINT8_MAX)
+    REMOTE_UINT(telemetry_interval, UINT16_MAX)
+    REMOTE_UINT(adaptive_quality, UINT8_MAX)
+    REMOTE_UINT(power_save, UINT8_MAX)
+#undef REMOTE_UINT
+#undef REMOTE_FLOAT
+    
+    if (invalid != NULL) {
+        ESP_LOGW(TAG, "Configuración remota v%lu rechazada: %s fuera de rango",
+                 config.config_version, invalid);
+        return;
+    }
+    // Otro modo de huella sin FFT explícita: el análisis de ese modo
+    if (config.fingerprint_mode != mode_before && !cJSON_GetObjectItem(remote, "fft_size")) {
+        quality_analysis_fill(&config, config.active_quality);
+    }
+    
+    if (config_request_submit(&config)) {
+        ESP_LOGI(TAG, "Configuración remota v%lu recibida", config.config_version);
+    }
+}
+
+// Tarea de captura: aplicar la petición pendiente. `streams_ended` es el
+// número de bloques END publicados; el último ya cerró el flujo en curso.
+void pipeline_reconfigure(uint32_t streams_ended) {
+    audio_config_t next;
+    taskENTER_CRITICAL(&config_request_lock);
+    next = config_request;
+    bool persist = config_request_persist;
+    config_request_pending = false;
+    config_request_persist = false;
+    taskEXIT_CRITICAL(&config_request_lock);
+    
+    // Esperar a que el procesamiento consuma el flujo cerrado
+    TickType_t start = xTaskGetTickCount();
+    while (atomic_load(&pipeline_streams_closed) != streams_ended) {
+        if (xTaskGetTickCount() - start > pdMS_TO_TICKS(PIPELINE_QUIESCE_TIMEOUT_MS)) {
+            ESP_LOGW(TAG, "Procesamiento no respondió, reconfigurando igualmente");
+            break;
+        }
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+    }
+    
+    bool dsp_changed = config_dsp_differs(&next, &audio_config);
+    bool power_changed = (next.power_save != audio_config.power_save);
+    audio_config = next;
+    if (dsp_changed) {
+        dsp_config_generation++;
+    }
+    if (power_changed) {
+        power_configure();
+    }
+    if (persist) {
+        save_config();
+    }
+    ESP_LOGI(TAG, "Configuración aplicada: %lu Hz, FFT %d, calidad %d, %s",
+             audio_config.sample_rate, audio_config.fft_size, audio_config.active_quality,
+             audio_config.capture_mode == CAPTURE_MODE_CONTINUOUS ? "continuo" : "ciclos");
+}
+
+// ================================
+// PLANIFICADOR DE CALIDAD
+// ================================
+
+// Con adaptive_quality el preset en uso (active_quality) se elige tras cada
+// ventana partiendo de quality_level, el nivel elegido en el menú o por el
+// servidor:
+// - varias ventanas seguidas de ruido (TV apagada): preset 1, en ciclos largos
+// - los primeros minutos tras un cambio de canal o de contenido: un nivel más
+// - una sesión larga en el mismo canal: un nivel menos
+// - sin margen de CPU no se sube de nivel, y si el DSP se satura se baja
+// El canal lo da el servidor cuando compara los fingerprints; si no, el
+// detector de cambios. Los cambios de preset pasan por la reconfiguración
+// en caliente y no se guardan en NVS.
+
+#define SCHED_NOISE_WINDOWS  3       // Ventanas de ruido seguidas para dar la TV por apagada
+#define SCHED_BOOST_S        120     // Segundos con un nivel más tras un cambio
+#define SCHED_STABLE_S       900     // Segundos sin cambios para bajar un nivel
+#define SCHED_MATCH_VALID_S  600     // Vigencia del último canal identificado por el servidor
+#define SCHED_MIN_DWELL_S    60      // Segundos mínimos en un preset antes de bajar por estabilidad
+#define SCHED_LOAD_RAISE     0.50f   // Carga DSP máxima para subir de nivel
+#define SCHED_LOAD_DROP      0.85f   // Carga DSP a partir de la que se baja
+
+// Estado de la tarea de procesamiento
+typedef struct {
+    uint8_t base;              // quality_level de la última evaluación
+    uint8_t ceiling;           // Nivel más bajo que saturó el DSP (6 = ninguno)
+    uint64_t ceiling_at;       // Timestamp de la saturación; caduca tras SCHED_STABLE_S
+    bool base_saved;
+    audio_config_t base_config; // Ajustes del usuario mientras se usa otro preset
+    uint32_t noise_windows;    // Ventanas de ruido seguidas
+    uint64_t resumed_at;       // Timestamp de la primera ventana con sonido tras el ruido
+    uint64_t switched_at;      // Timestamp del último cambio de preset
+    uint64_t busy_cycles;      // Ciclos de procesamiento desde la última evaluación
+    uint64_t audio_cycles;     // Ciclos que dura el audio procesado en ese tiempo
+} quality_scheduler_t;
+
+static quality_scheduler_t scheduler = { .ceiling = 6 };
+
+// Último canal identificado por el servidor, escrito por la tarea de envío
+static portMUX_TYPE scheduler_match_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t scheduler_channel_hash = 0;
+static uint64_t scheduler_channel_changed_at = 0;   // Timestamps de fingerprint
+static uint64_t scheduler_match_at = 0;
+
+void quality_preset_fill(audio_config_t* config, uint8_t level);
+
+// Campos que fija un preset de calidad
+static void quality_fields_copy(audio_config_t* dst, const audio_config_t* src) {
+    dst->sample_rate = src->sample_rate;
+    dst->fft_size = src->fft_size;
+    dst->n_mels = src->n_mels;
+    dst->n_mfcc = src->n_mfcc;
+    dst->dsp_mode = src->dsp_mode;
+    dst->capture_duration = src->capture_duration;
+    dst->capture_interval = src->capture_interval;
+    dst->capture_mode = src->capture_mode;
+    dst->stream_window = src->stream_window;
+    dst->stream_interval = src->stream_interval;
+}
+
+// Resultados de la respuesta del servidor:
+// {"results": [{"timestamp": ..., "status": "match", "channel": "la1", ...}]}
+static void quality_scheduler_note_matches(const cJSON* json) {
+    const cJSON* results = cJSON_GetObjectItem(json, "results");
+    const cJSON* result;
+    cJSON_ArrayForEach(result, results) {
+        const cJSON* status = cJSON_GetObjectItem(result, "status");
+        const cJSON* channel = cJSON_GetObjectItem(result, "channel");
+        const cJSON* timestamp = cJSON_GetObjectItem(result, "timestamp");
+        if (!cJSON_IsString(status) || strcmp(status->valuestring, "match") != 0 ||
+            !cJSON_IsString(channel) || !cJSON_IsNumber(timestamp)) {
+            continue;
+        }
+        // FNV-1a del nombre: basta con saber si el canal cambió
+        uint32_t hash = 2166136261u;
+        for (const char* c = channel->valuestring; *c; c++) {
+            hash = (hash ^ (uint8_t)*c) * 16777619u;
+        }
+        uint64_t at = (uint64_t)timestamp->valuedouble;
+        taskENTER_CRITICAL(&scheduler_match_lock);
+        if (hash != scheduler_channel_hash) {
+            scheduler_channel_hash = hash;
+            scheduler_channel_changed_at = at;
+        }
+        if (at > scheduler_match_at) {
+            scheduler_match_at = at;
+        }
+        taskEXIT_CRITICAL(&scheduler_match_lock);
+    }
+}
+
+// Ciclos de CPU empleados en `samples` muestras de audio
+static inline void quality_scheduler_note_load(uint32_t cycles, size_t samples) {
+    scheduler.busy_cycles += cycles;
+    scheduler.audio_cycles += (uint64_t)samples * esp_rom_get_cpu_ticks_per_us() * 1000000ULL /
+                              audio_config.sample_rate;
+}
+
+// Elegir el preset tras una ventana con resultado `status`
+static void quality_scheduler_window(fingerprint_status_t status, uint64_t timestamp) {
+    quality_scheduler_t* s = &scheduler;
+    audio_config_t config;
+    config_current(&config);
+    
+    if (config.quality_level != s->base) {
+        // Nivel nuevo desde el menú o el servidor: sus ajustes son la base
+        s->base = config.quality_level;
+        s->ceiling = 6;
+        s->base_saved = false;
+        s->switched_at = timestamp;
+    }
+    float load = s->audio_cycles ? (float)s->busy_cycles / s->audio_cycles : 0.0f;
+    s->busy_cycles = 0;
+    s->audio_cycles = 0;
+    
+    bool was_off = (s->noise_windows >= SCHED_NOISE_WINDOWS);
+    s->noise_windows = (status == FINGERPRINT_NOISE) ? s->noise_windows + 1 : 0;
+    if (was_off && s->noise_windows == 0) {
+        s->resumed_at = timestamp;
+    }
+    
+    // Si el servidor identifica el canal, la publicidad o un cambio de
+    // programa no cuentan como cambio
+    uint64_t changed_at = change_detector.changed_at;
+    taskENTER_CRITICAL(&scheduler_match_lock);
+    if (scheduler_match_at && timestamp - scheduler_match_at < SCHED_MATCH_VALID_S * 1000000ULL) {
+        changed_at = scheduler_channel_changed_at;
+    }
+    taskEXIT_CRITICAL(&scheduler_match_lock);
+    if (s->resumed_at > changed_at) {
+        changed_at = s->resumed_at;
+    }
+    uint64_t since = (timestamp > changed_at) ? timestamp - changed_at : 0;
+    
+    uint8_t active = config.active_quality;
+    uint8_t level = config.quality_level;
+    const char* reason = "nivel base";
+    if (!config.adaptive_quality) {
+        reason = "planificador desactivado";
+    } else if (s->noise_windows >= SCHED_NOISE_WINDOWS) {
+        level = 1;
+        reason = "TV apagada";
+    } else if (since < SCHED_BOOST_S * 1000000ULL) {
+        level = (level < 5) ? level + 1 : 5;
+        reason = "cambio reciente";
+    } else if (since >= SCHED_STABLE_S * 1000000ULL) {
+        level = (level > 1) ? level - 1 : 1;
+        reason = "sesión estable";
+    }
+    
+    if (config.adaptive_quality && s->noise_windows < SCHED_NOISE_WINDOWS) {
+        if (load > SCHED_LOAD_DROP && active > 1) {
+            s->ceiling = active;
+            s->ceiling_at = timestamp;
+            reason = "DSP saturado";
+        } else if (timestamp - s->ceiling_at >= SCHED_STABLE_S * 1000000ULL) {
+            s->ceiling = 6;
+        }
+        if (level >= s->ceiling) {
+            level = s->ceiling - 1;
+        }
+        if (level > active && load > SCHED_LOAD_RAISE) {
+            level = active;
+        }
+        if (level < active && load <= SCHED_LOAD_DROP &&
+            timestamp - s->switched_at < SCHED_MIN_DWELL_S * 1000000ULL) {
+            level = active;
+        }
+    }
+    if (level == active) {
+        return;
+    }
+    
+    if (active == config.quality_level) {
+        s->base_config = config;
+        s->base_saved = true;
+    }
+    if (level == config.quality_level && s->base_saved) {
+        quality_fields_copy(&config, &s->base_config);
+    } else {
+        quality_preset_fill(&config, level);
+    }
+    config.active_quality = level;
+    s->switched_at = timestamp;
+    ESP_LOGI(TAG, "Planificador: calidad %d -> %d (%s, carga DSP %.0f%%)",
+             active, level, reason, load * 100.0f);
+    config_request_post(&config, false);
+}
+
+// ================================
+// INTERFAZ HMI
+// ================================
+
+// Copia editada en el menú; se aplica al salir
+static audio_config_t menu_config;
+
+// Las tareas no dibujan ni tocan current_state: publican eventos sin
+// bloquear y display_task, dueña del SSD1306 y del estado de la interfaz,
+// los agrupa y redibuja como mucho una vez por frame.
+#define UI_QUEUE_LEN  16
+#define UI_FRAME_MS   100
+
+typedef enum {
+    UI_EVENT_STATE,            // value: system_state_t del pipeline
+    UI_EVENT_BUTTON,           // value: GPIO del botón (pulsación corta)
+    UI_EVENT_BUTTON_LONG,      // value: GPIO del botón (pulsación larga)
+    UI_EVENT_REFRESH           // Redibujar (contadores, configuración)
+} ui_event_type_t;
+
+typedef struct {
+    uint8_t type;              // ui_event_type_t
+    uint8_t value;
+} ui_event_t;
+
+static QueueHandle_t ui_queue;
+static uint32_t ui_events_dropped = 0;
+
+// Publicar un evento para display_task; nunca bloquea
+static void ui_post(ui_event_type_t type, uint8_t value) {
+    ui_event_t event = { .type = type, .value = value };
+    if (ui_queue == NULL || xQueueSend(ui_queue, &event, 0) != pdTRUE) {
+        ui_events_dropped++;
+    }
+}
+
+// Dibujar el estado actual en el framebuffer (sólo desde display_task, que
+// después envía las páginas que cambiaron)
+void update_display() {
+    char line1[32], line2[32], line3[32], line4[32];
+    
+    switch(current_state) {
+        case STATE_INIT:
+            strcpy(line1, "TV Audience Monitor");
+            strcpy(line2, "Inicializando...");
+            sprintf(line3, "Calidad: %d/5", audio_config.active_quality);
+            strcpy(line4, "");
+            break;
+            
+        case STATE_CONNECTING:
+            strcpy(line1, "Conectando WiFi");
+            strcpy(line2, "Espere...");
+            strcpy(line3, "");
+            strcpy(line4, "");
+            break;
+            
+        case STATE_SAMPLING:
+            strcpy(line1, "Capturando Audio");
+            sprintf(line2, "SR: %dkHz Q%d%s", audio_config.sample_rate/1000,
+                    audio_config.active_quality, audio_config.adaptive_quality ? " auto" : "");
+            sprintf(line3, "Muestras: %lu", samples_processed);
+            sprintf(line4, "Enviadas: %lu", transmissions_sent);
+            break;
+            
+        case STATE_PROCESSING:
+            strcpy(line1, "Procesando...");
+            sprintf(line2, "FFT: %d pts", audio_config.fft_size);
+            sprintf(line3, "MFCC: %d coef", audio_config.n_mfcc);
+            strcpy(line4, "Generando hash");
+            break;
+            
+        case STATE_TRANSMITTING:
+            strcpy(line1, "Transmitiendo");
+            strcpy(line2, "Enviando datos");
+            strcpy(line3, "al servidor");
+            strcpy(line4, "");
+            break;
+            
+        case STATE_CONFIG:
+            strcpy(line1, "CONFIGURACION");
+            switch(config_menu_index % 9) {
+                case 0:
+                    sprintf(line2, ">Sample Rate");
+                    sprintf(line3, " %d Hz", menu_config.sample_rate);
+                    break;
+                case 1:
+                    sprintf(line2, ">FFT Size");
+                    sprintf(line3, " %d puntos", menu_config.fft_size);
+                    break;
+                case 2:
+                    sprintf(line2, ">Bandas Mel");
+                    sprintf(line3, " %d bandas", menu_config.n_mels);
+                    break;
+                case 3:
+                    sprintf(line2, ">Duracion Cap");
+                    sprintf(line3, " %d seg", menu_config.capture_duration);
+                    break;
+                case 4:
+                    sprintf(line2, ">Intervalo");
+                    sprintf(line3, " %d seg", menu_config.capture_interval);
+                    break;
+                case 5:
+                    sprintf(line2, ">Umbral Ruido");
+                    sprintf(line3, " %.3f", menu_config.noise_threshold);
+                    break;
+                case 6:
+                    sprintf(line2, ">Calidad");
+                    sprintf(line3, " %d/5%s", menu_config.quality_level,
+                            menu_config.adaptive_quality ? " auto" : "");
+                    break;
+                case 7:
+                    sprintf(line2, ">Modo Huella");
+                    sprintf(line3, " %s", menu_config.fingerprint_mode == FINGERPRINT_MODE_MFCC ?
+                                          "MFCC" : "Landmarks");
+                    break;
+                case 8:
+                    strcpy(line2, ">Salir Config");
+                    strcpy(line3, " Presionar B2");
+                    break;
+            }
+            strcpy(line4, "B1:Nav B2:Edit/Exit");
+            break;
+            
+        case STATE_ERROR:
+            strcpy(line1, "ERROR");
+            strcpy(line2, "Revisar conexion");
+            strcpy(line3, "o configuracion");
+            strcpy(line4, "B1: Reintentar");
+            break;
+    }
+    
+    ssd1306_fb_text(&display, 0, line1, false);
+    ssd1306_fb_text(&display, 1, line2, false);
+    ssd1306_fb_text(&display, 2, line3, false);
+    ssd1306_fb_text(&display, 3, line4, false);
+}
+
+// Salir del menú, aplicando o descartando la copia editada
+static void menu_exit(bool apply) {
+    audio_config_t current;
+    config_current(&current);
+    if (apply && memcmp(&current, &menu_config, sizeof(menu_config)) != 0) {
+        config_request_submit(&menu_config);
+    }
+    current_state = STATE_SAMPLING;
+}
+
+void handle_button_press(int button) {
+    if (button == BUTTON_1_PIN) {
+        if (current_state == STATE_CONFIG) {
+            config_menu_index++;
+        } else if (current_state == STATE_ERROR) {
+            current_state = STATE_INIT;
+        } else {
+            config_current(&menu_config);
+            current_state = STATE_CONFIG;
+            config_menu_index = 0;
+        }
+    } else if (button == BUTTON_2_PIN) {
+        if (current_state == STATE_CONFIG) {
+            // Editar parámetro actual o salir
+            switch(config_menu_index % 9) {
+                case 0: // Sample Rate
+                    menu_config.sample_rate = (menu_config.sample_rate == 8000) ? 16000 : 
+                                               (menu_config.sample_rate == 16000) ? 24000 : 8000;
+                    break;
+                case 1: // FFT Size
+                    menu_config.fft_size = (menu_config.fft_size == 512) ? 1024 : 
+                                            (menu_config.fft_size == 1024) ? 2048 : 512;
+                    break;
+                case 2: // MFCC
+                    menu_config.n_mels = (menu_config.n_mels + 2) % 20 + 10;
+                    if (menu_config.n_mfcc > menu_config.n_mels) {
+                        menu_config.n_mfcc = menu_config.n_mels;
+                    }
+                    break;
+                case 3: // Duración
+                    menu_config.capture_duration = (menu_config.capture_duration % 60) + 15;
+                    break;
+                case 4: // Intervalo
+                    menu_config.capture_interval = (menu_config.capture_interval % 300) + 30;
+                    break;
+                case 5: // Umbral
+                    menu_config.noise_threshold += 0.01;
+                    if (menu_config.noise_threshold > 0.1) menu_config.noise_threshold = 0.001;
+                    break;
+                case 6: // Calidad
+                    menu_config.quality_level = (menu_config.quality_level % 5) + 1;
+                    apply_quality_preset(&menu_config);
+                    break;
+                case 7: // Modo de fingerprint
+                    menu_config.fingerprint_mode = (menu_config.fingerprint_mode == FINGERPRINT_MODE_MFCC) ?
+                                                    FINGERPRINT_MODE_LANDMARKS : FINGERPRINT_MODE_MFCC;
+                    quality_analysis_fill(&menu_config, menu_config.active_quality);
+                    break;
+                case 8: // Salir: aplicar los cambios sin reiniciar
+                    menu_exit(true);
+                    break;
+            }
+        }
+    }
+}
+
+// Pulsación larga en el menú: B1 sale descartando cambios, B2 aplica y sale
+void handle_button_long_press(int button) {
+    if (current_state != STATE_CONFIG) {
+        return;
+    }
+    menu_exit(button == BUTTON_2_PIN);
+}
+
+// ================================
+// BOTONES POR INTERRUPCIÓN
+// ================================
+
+// Cada flanco reinicia desde la ISR el temporizador de antirrebote del
+// botón; al vencer se lee el nivel estable. No hay tarea de sondeo: el
+// core sólo despierta cuando se pulsa algo.
+#define BUTTON_DEBOUNCE_MS    30
+#define BUTTON_LONG_PRESS_MS  1000
+
+typedef struct {
+    gpio_num_t pin;
+    TimerHandle_t debounce;
+    TimerHandle_t long_press;
+    bool pressed;              // Estado estable tras el antirrebote
+    bool long_sent;            // Ya se notificó la pulsación larga
+} button_t;
+
+static button_t buttons[] = {
+    { .pin = BUTTON_1_PIN },
+    { .pin = BUTTON_2_PIN }
+};
+
+static void IRAM_ATTR button_isr(void* arg) {
+    button_t* button = (button_t*)arg;
+    BaseType_t woken = pdFALSE;
+    xTimerResetFromISR(button->debounce, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+// Tarea de temporizadores: nivel estable tras BUTTON_DEBOUNCE_MS sin flancos
+static void button_debounce_cb(TimerHandle_t timer) {
+    button_t* button = (button_t*)pvTimerGetTimerID(timer);
+    bool pressed = (gpio_get_level(button->pin) == 0);   // Activo bajo
+    if (pressed == button->pressed) {
+        return;
+    }
+    button->pressed = pressed;
+    if (pressed) {
+        button->long_sent = false;
+        xTimerReset(button->long_press, 0);
+    } else {
+        xTimerStop(button->long_press, 0);
+        if (!button->long_sent) {
+            ui_post(UI_EVENT_BUTTON, button->pin);
+            ESP_LOGI(TAG, "Botón %d presionado", button->pin);
+        }
+    }
+}
+
+static void button_long_press_cb(TimerHandle_t timer) {
+    button_t* button = (button_t*)pvTimerGetTimerID(timer);
+    if (button->pressed) {
+        button->long_sent = true;
+        ui_post(UI_EVENT_BUTTON_LONG, button->pin);
+        ESP_LOGI(TAG, "Botón %d mantenido", button->pin);
+    }
+}
+
+// Instalar las ISR de los botones (tras crear ui_queue)
+esp_err_t buttons_start(void) {
+    esp_err_t err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {   // Ya instalado
+        return err;
+    }
+    for (size_t i = 0; i < sizeof(buttons) / sizeof(buttons[0]); i++) {
+        button_t* button = &buttons[i];
+        button->debounce = xTimerCreate("btn_debounce", pdMS_TO_TICKS(BUTTON_DEBOUNCE_MS),
+                                        pdFALSE, button, button_debounce_cb);
+        button->long_press = xTimerCreate("btn_long", pdMS_TO_TICKS(BUTTON_LONG_PRESS_MS),
+                                          pdFALSE, button, button_long_press_cb);
+        if (button->debounce == NULL || button->long_press == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+        err = gpio_isr_handler_add(button->pin, button_isr, button);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
+// ================================
+// FUNCIONES DE RED
+// ================================
+
+// Sesión de transmisión persistente: un único cliente HTTP/1.1 keep-alive
+// reutilizado entre envíos. El handshake TLS sólo se repite al perder la
+// conexión y, con tickets de sesión, se reanuda sin intercambio completo.
+#define UPLINK_RESPONSE_MAX  1024
+
+typedef struct {
+    esp_http_client_handle_t client;
+    volatile bool reset_pending;   // La WiFi cayó: cerrar el socket antes de usarlo
+    char response[UPLINK_RESPONSE_MAX];   // Cuerpo de la última respuesta (truncado)
+    size_t response_len;
+    uint32_t connections;          // Conexiones (handshakes) establecidas
+    uint32_t requests;             // Peticiones sobre la conexión actual
+    bool rejected;                 // La última petición se rechazó de forma definitiva
+    uint32_t rejections;           // Peticiones rechazadas (4xx salvo 408/429)
+} uplink_session_t;
+
+static uplink_session_t uplink;
+
+static void event_handler(void* arg, esp_event_base_t event_base,
+                         int32_t event_id, void* event_data) {
+    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
+        esp_wifi_connect();
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+        esp_wifi_connect();
+        wifi_connected = false;
+        // El socket TLS quedó muerto; lo cierra la tarea que transmite
+        uplink.reset_pending = true;
+        ESP_LOGI(TAG, "Reintentando conexión WiFi");
+    } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+        wifi_connected = true;
+        xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_BIT);
+        ESP_LOGI(TAG, "WiFi conectado exitosamente");
+        // Reconexión con el pipeline ya en marcha: salir de la pantalla de red
+        if (capture_task_handle &&
+            (current_state == STATE_CONNECTING || current_state == STATE_ERROR)) {
+            ui_post(UI_EVENT_STATE, STATE_SAMPLING);
+        }
+    }
+}
+
+void init_wifi() {
+    wifi_event_group = xEventGroupCreate();
+    
+    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    esp_netif_create_default_wifi_sta();
 
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
 
-    esp_event_handler_instance_t instance_any_id;
-    esp_event_handler_instance_t instance_got_ip;
-    ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
-                                                        ESP_EVENT_ANY_ID,
-                                                        &event_handler,
-                                                        NULL,
-                                                        &instance_any_id));
-    ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT,
-                                                        IP_EVENT_STA_GOT_IP,
-                                                        &event_handler,
-                                                        NULL,
-                                                        &instance_got_ip));
+    esp_event_handler_instance_t instance_any_id;
+    esp_event_handler_instance_t instance_got_ip;
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
+                                                        ESP_EVENT_ANY_ID,
+                                                        &event_handler,
+                                                        NULL,
+                                                        &instance_any_id));
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT,
+                                                        IP_EVENT_STA_GOT_IP,
+                                                        &event_handler,
+                                                        NULL,
+                                                        &instance_got_ip));
+
+    wifi_config_t wifi_config = {
+        .sta = {
+            .ssid = WIFI_SSID,
+            .password = WIFI_PASS,
+            .threshold.authmode = WIFI_AUTH_WPA2_PSK,
+            .listen_interval = RADIO_LISTEN_INTERVAL,   // Sólo en WIFI_PS_MAX_MODEM
+        },
+    };
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+    ESP_ERROR_CHECK(esp_wifi_start());
+}
+
+// Callback para manejo de respuesta HTTP
+esp_err_t http_event_handler(esp_http_client_event_t *evt) {
+    switch(evt->event_id) {
+        case HTTP_EVENT_ERROR:
+            ESP_LOGD(TAG, "HTTP_EVENT_ERROR");
+            break;
+        case HTTP_EVENT_ON_CONNECTED:
+            ESP_LOGD(TAG, "HTTP_EVENT_ON_CONNECTED");
+            uplink.connections++;
+            uplink.requests = 0;
+            break;
+        case HTTP_EVENT_HEADER_SENT:
+            ESP_LOGD(TAG, "HTTP_EVENT_HEADER_SENT");
+            break;
+        case HTTP_EVENT_ON_HEADER:
+            ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
+            break;
+        case HTTP_EVENT_ON_DATA:
+            ESP_LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
+            if (uplink.response_len + evt->data_len < UPLINK_RESPONSE_MAX) {
+                memcpy(&uplink.response[uplink.response_len], evt->data, evt->data_len);
+                uplink.response_len += evt->data_len;
+            }
+            break;
+        case HTTP_EVENT_ON_FINISH:
+            ESP_LOGD(TAG, "HTTP_EVENT_ON_FINISH");
+            break;
+        case HTTP_EVENT_DISCONNECTED:
+            ESP_LOGI(TAG, "HTTP_EVENT_DISCONNECTED");
+            break;
+    }
+    return ESP_OK;
+}
+
+// Enviar fingerprint al servidor
+// Crear el cliente persistente la primera vez que se transmite
+static esp_err_t uplink_open(uplink_session_t* session) {
+    if (session->client) {
+        return ESP_OK;
+    }
+    
+    esp_http_client_config_t config = {
+        .url = SERVER_URL,
+        .event_handler = http_event_handler,
+        .timeout_ms = 10000,
+        .keep_alive_enable = true,     // Sondas TCP para detectar conexiones muertas
+        .keep_alive_idle = 30,
+        .keep_alive_interval = 5,
+        .keep_alive_count = 3,
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        .save_client_session = true,   // Reanudar TLS con el ticket guardado
+#endif
+    };
+    
+    session->client = esp_http_client_init(&config);
+    if (session->client == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_http_client_set_method(session->client, HTTP_METHOD_POST);
+    return ESP_OK;
+}
+
+// Enviar un cuerpo al servidor reutilizando la conexión abierta.
+// Devuelve true con status 200/201.
+// Un 4xx distinto de 408 (timeout) y 429 (límite de peticiones) no cambia
+// al reintentar: formato no aceptado, cuerpo inválido o demasiado grande
+static bool uplink_status_final(int status_code) {
+    return status_code >= 400 && status_code < 500 && status_code != 408 && status_code != 429;
+}
+
+// Devuelve true si la petición terminó: aceptada o, con session->rejected,
+// rechazada de forma definitiva. Con false el llamante debe reintentar.
+static bool uplink_post(uplink_session_t* session, const char* content_type,
+                        const char* body, size_t length) {
+    if (uplink_open(session) != ESP_OK) {
+        ESP_LOGE(TAG, "Sin memoria para el cliente HTTP");
+        return false;
+    }
+    if (session->reset_pending) {
+        // Cerrar sólo el transporte: el ticket TLS sigue disponible
+        esp_http_client_close(session->client);
+        session->reset_pending = false;
+    }
+    
+    esp_http_client_set_header(session->client, "Content-Type", content_type);
+    esp_http_client_set_post_field(session->client, body, length);
+    session->response_len = 0;
+    
+    power_uplink_begin();
+    PERF_SPAN_BEGIN(span);
+    esp_err_t err = esp_http_client_perform(session->client);
+    PERF_SPAN_END(span, PERF_STAGE_HTTP);
+    power_uplink_end();
+    bool success = false;
+    session->rejected = false;
+    
+    if (err == ESP_OK) {
+        int status_code = esp_http_client_get_status_code(session->client);
+        session->requests++;
+        if (status_code == 200 || status_code == 201) {
+            ESP_LOGI(TAG, "Datos enviados exitosamente. Status: %d (petición %lu, conexión %lu)",
+                     status_code, session->requests, session->connections);
+            success = true;
+            
+            // El servidor puede devolver una configuración nueva y, si
+            // compara los fingerprints, el canal identificado
+            if (session->response_len > 0) {
+                session->response[session->response_len] = '\0';
+                cJSON* json = cJSON_Parse(session->response);
+                remote_config_handle(json);
+                quality_scheduler_note_matches(json);
+                cJSON_Delete(json);
+            }
+        } else if (uplink_status_final(status_code)) {
+            ESP_LOGE(TAG, "Petición rechazada por el servidor. Status: %d, no se reintenta",
+                     status_code);
+            session->rejected = true;
+            session->rejections++;
+            success = true;
+        } else {
+            ESP_LOGW(TAG, "Error en servidor. Status: %d", status_code);
+        }
+    } else {
+        ESP_LOGE(TAG, "Error HTTP: %s", esp_err_to_name(err));
+        // Forzar una conexión nueva en el próximo envío
+        esp_http_client_close(session->client);
+    }
+    
+    return success;
+}
+
+// Enviar un cuerpo JSON al servidor
+static bool http_post_json(const char* body) {
+    return uplink_post(&uplink, "application/json", body, strlen(body));
+}
+
+// Registro ya serializado (texto JSON terminado en NUL o binario)
+typedef struct {
+    void* data;
+    uint32_t length;
+} uplink_record_t;
+
+// Registro en la cola de la tarea de envío, con la configuración con la
+// que se generó (la cabecera del lote depende de ella)
+typedef struct {
+    uplink_record_t record;
+    uint32_t sample_rate;
+    uint8_t quality_level;
+    uint8_t wire_format;
+} uplink_item_t;
+
+// Serializar un fingerprint como registro JSON de lote. Los campos comunes
+// (device_id, sample_rate, quality_level) van una sola vez en la cabecera.
+static char* fingerprint_record_json(const fingerprint_t* fingerprint) {
+    // Codificar la matriz MFCC o los landmarks en Base64
+    bool landmarks = (fingerprint->mode == FINGERPRINT_MODE_LANDMARKS);
+    const void* feature_data = landmarks ? (const void*)fingerprint->landmarks
+                                         : (const void*)fingerprint->mfcc;
+    size_t feature_bytes = landmarks ? fingerprint->n_landmarks * sizeof(landmark_t)
+                                     : fingerprint->n_frames * fingerprint->n_coeffs * sizeof(float);
+    char *features_b64 = malloc(4 * ((feature_bytes + 2) / 3) + 1);
+    if (features_b64 == NULL) {
+        ESP_LOGE(TAG, "Sin memoria para codificar características");
+        return NULL;
+    }
+    base64_encode((const unsigned char*)feature_data, feature_bytes, features_b64);
+    
+    // Crear registro JSON
+    cJSON *json = cJSON_CreateObject();
+    cJSON *timestamp = cJSON_CreateNumber(fingerprint->timestamp);
+    cJSON *hash = cJSON_CreateString(fingerprint->hash);
+    cJSON *confidence = cJSON_CreateNumber(fingerprint->confidence);
+    cJSON *duration = cJSON_CreateNumber(fingerprint->duration);
+    cJSON *mode = cJSON_CreateString(landmarks ? "landmarks" : "mfcc");
+    cJSON *features = cJSON_CreateString(features_b64);
+    cJSON *frames = cJSON_CreateNumber(fingerprint->n_frames);
+    
+    cJSON_AddStringToObject(json, "type", "fingerprint");
+    cJSON_AddItemToObject(json, "timestamp", timestamp);
+    cJSON_AddItemToObject(json, "hash", hash);
+    cJSON_AddItemToObject(json, "confidence", confidence);
+    cJSON_AddItemToObject(json, "duration", duration);
+    cJSON_AddItemToObject(json, "mode", mode);
+    cJSON_AddItemToObject(json, "features", features);
+    cJSON_AddItemToObject(json, "frames", frames);
+    if (landmarks) {
+        cJSON_AddNumberToObject(json, "landmarks", fingerprint->n_landmarks);
+        cJSON_AddNumberToObject(json, "hop_length", audio_config.hop_length);
+        cJSON_AddNumberToObject(json, "fft_size", audio_config.fft_size);
+    } else {
+        cJSON_AddNumberToObject(json, "coeffs", fingerprint->n_coeffs);
+    }
+    
+    char *record = cJSON_PrintUnformatted(json);
+    free(features_b64);
+    cJSON_Delete(json);
+    return record;
+}
+
+// Registro ligero de "mismo contenido": referencia al último fingerprint completo
+static char* heartbeat_record_json(const fingerprint_t* fingerprint, const change_detector_t* det) {
+    cJSON *json = cJSON_CreateObject();
+    cJSON_AddStringToObject(json, "type", "heartbeat");
+    cJSON_AddNumberToObject(json, "timestamp", fingerprint->timestamp);
+    cJSON_AddStringToObject(json, "hash", det->hash);
+    cJSON_AddNumberToObject(json, "since", det->sent_at);
+    cJSON_AddNumberToObject(json, "suppressed", det->suppressed);
+    cJSON_AddNumberToObject(json, "confidence", fingerprint->confidence);
+    
+    char *record = cJSON_PrintUnformatted(json);
+    cJSON_Delete(json);
+    return record;
+}
+
+// Convertir el MD5 en texto hexadecimal a sus 16 bytes
+static void md5_hex_to_bytes(const char* hex, uint8_t* out) {
+    for (int i = 0; i < 16; i++) {
+        unsigned int byte = 0;
+        sscanf(&hex[i*2], "%2x", &byte);
+        out[i] = (uint8_t)byte;
+    }
+}
+
+static void wire_record_header(audimeter_record_header_t* header, uint32_t size, uint8_t type,
+                               const fingerprint_t* fingerprint, const char* hash) {
+    memset(header, 0, sizeof(*header));
+    header->record_size = size;
+    header->type = type;
+    header->timestamp = fingerprint->timestamp;
+    header->confidence = fingerprint->confidence;
+    md5_hex_to_bytes(hash, header->hash);
+}
+
+// Registro binario de un fingerprint. Los MFCC se cuantizan a mfcc_bits con
+// una escala común (max |x| / 2^(bits-1)); los landmarks van sin cambios.
+static uplink_record_t fingerprint_record_binary(const fingerprint_t* fingerprint) {
+    uplink_record_t record = { 0 };
+    bool landmarks = (fingerprint->mode == FINGERPRINT_MODE_LANDMARKS);
+    uint8_t encoding = AUDIMETER_FEATURES_LANDMARKS;
+    size_t count, elem_size;
+    
+    if (landmarks) {
+        count = fingerprint->n_landmarks;
+        elem_size = sizeof(landmark_t);
+    } else {
+        count = (size_t)fingerprint->n_frames * fingerprint->n_coeffs;
+        switch (audio_config.mfcc_bits) {
+            case 8:  encoding = AUDIMETER_FEATURES_MFCC_I8;  elem_size = sizeof(int8_t);  break;
+            case 16: encoding = AUDIMETER_FEATURES_MFCC_I16; elem_size = sizeof(int16_t); break;
+            default: encoding = AUDIMETER_FEATURES_MFCC_F32; elem_size = sizeof(float);   break;
+        }
+    }
+    
+    size_t size = sizeof(audimeter_record_header_t) + sizeof(audimeter_fingerprint_t) +
+                  count * elem_size;
+    uint8_t* buffer = malloc(size);
+    if (buffer == NULL) {
+        ESP_LOGE(TAG, "Sin memoria para codificar características");
+        return record;
+    }
+    
+    audimeter_record_header_t* header = (audimeter_record_header_t*)buffer;
+    wire_record_header(header, size, AUDIMETER_RECORD_FINGERPRINT, fingerprint, fingerprint->hash);
+    header->encoding = encoding;
+    
+    audimeter_fingerprint_t* fp = (audimeter_fingerprint_t*)(header + 1);
+    memset(fp, 0, sizeof(*fp));
+    fp->duration = fingerprint->duration;
+    fp->frames = fingerprint->n_frames;
+    fp->hop_length = audio_config.hop_length;
+    fp->fft_size = audio_config.fft_size;
+    fp->coeffs = landmarks ? 0 : fingerprint->n_coeffs;
+    fp->scale = 1.0f;
+    fp->count = count;
+    
+    void* payload = fp + 1;
+    if (landmarks || encoding == AUDIMETER_FEATURES_MFCC_F32) {
+        memcpy(payload, landmarks ? (const void*)fingerprint->landmarks
+                                  : (const void*)fingerprint->mfcc, count * elem_size);
+    } else {
+        float peak = 0.0f;
+        for (size_t i = 0; i < count; i++) {
+            peak = fmaxf(peak, fabsf(fingerprint->mfcc[i]));
+        }
+        float q_max = (encoding == AUDIMETER_FEATURES_MFCC_I8) ? 127.0f : 32767.0f;
+        fp->scale = (peak > 0.0f) ? peak / q_max : 1.0f;
+        float inv = 1.0f / fp->scale;
+        for (size_t i = 0; i < count; i++) {
+            long q = lrintf(fingerprint->mfcc[i] * inv);
+            if (encoding == AUDIMETER_FEATURES_MFCC_I8) {
+                ((int8_t*)payload)[i] = (int8_t)q;
+            } else {
+                ((int16_t*)payload)[i] = (int16_t)q;
+            }
+        }
+    }
+    
+    record.data = buffer;
+    record.length = size;
+    return record;
+}
+
+static uplink_record_t heartbeat_record_binary(const fingerprint_t* fingerprint,
+                                               const change_detector_t* det) {
+    uplink_record_t record = { 0 };
+    size_t size = sizeof(audimeter_record_header_t) + sizeof(audimeter_heartbeat_t);
+    uint8_t* buffer = malloc(size);
+    if (buffer == NULL) {
+        return record;
+    }
+    
+    audimeter_record_header_t* header = (audimeter_record_header_t*)buffer;
+    wire_record_header(header, size, AUDIMETER_RECORD_HEARTBEAT, fingerprint, det->hash);
+    audimeter_heartbeat_t* hb = (audimeter_heartbeat_t*)(header + 1);
+    hb->since = det->sent_at;
+    hb->suppressed = det->suppressed;
+    
+    record.data = buffer;
+    record.length = size;
+    return record;
+}
+
+static uplink_record_t text_record(char* text) {
+    uplink_record_t record = { .data = text, .length = text ? strlen(text) : 0 };
+    return record;
+}
+
+// Registro del fingerprint en el formato configurado
+uplink_record_t fingerprint_record(const fingerprint_t* fingerprint) {
+    PERF_SPAN_BEGIN(span);
+    uplink_record_t record = (audio_config.wire_format == WIRE_FORMAT_BINARY) ?
+                             fingerprint_record_binary(fingerprint) :
+                             text_record(fingerprint_record_json(fingerprint));
+    PERF_SPAN_END(span, PERF_STAGE_ENCODING);
+    return record;
+}
+
+uplink_record_t heartbeat_record(const fingerprint_t* fingerprint, const change_detector_t* det) {
+    if (audio_config.wire_format == WIRE_FORMAT_BINARY) {
+        return heartbeat_record_binary(fingerprint, det);
+    }
+    return text_record(heartbeat_record_json(fingerprint, det));
+}
+
+// ================================
+// ALMACENAMIENTO PERSISTENTE
+// ================================
+
+// Registros que no se pudieron enviar, en la partición "fpstore". La
+// partición es un ring de slots de un sector: cada registro ocupa uno o más
+// slots consecutivos y la escritura avanza siempre en orden, de modo que el
+// desgaste se reparte por toda la partición. Un registro enviado se marca
+// escribiendo su palabra de estado (1 -> 0) sin borrar el sector.
+
+#define FPSTORE_PARTITION_LABEL  "fpstore"
+#define FPSTORE_SLOT_SIZE        4096
+#define FPSTORE_MAGIC            0x53504641u   // "AFPS"
+#define FPSTORE_STATE_PENDING    0xFFFFFFFFu
+#define FPSTORE_STATE_SENT       0x00000000u
+#define FPSTORE_MAX_SLOTS        16            // Registro máximo: 64 KB
+#define FPSTORE_DRAIN_RECORDS    4             // Registros por lote de vaciado
+#define FPSTORE_DRAIN_INTERVAL_S 10            // Un lote de vaciado cada N segundos
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t sequence;         // Orden de escritura, creciente
+    uint16_t slots;            // Slots ocupados por el registro
+    uint8_t wire_format;       // Cabecera del lote al que pertenecía
+    uint8_t quality_level;
+    uint32_t sample_rate;
+    uint32_t length;           // Bytes de datos tras la cabecera
+    uint32_t crc;              // CRC32 de los campos anteriores y los datos
+    uint32_t state;            // FPSTORE_STATE_*, fuera del CRC
+} fpstore_header_t;
+
+typedef struct {
+    const esp_partition_t* partition;
+    uint32_t n_slots;
+    uint32_t head;             // Próximo slot a escribir
+    uint32_t tail;             // Registro pendiente más antiguo (== head si vacío)
+    uint32_t sequence;
+    uint32_t pending;
+    uint32_t dropped;          // Pendientes sobrescritos o corruptos
+    int64_t drain_at;          // No vaciar antes de este instante
+} fpstore_t;
+
+static fpstore_t fpstore;
+
+static uint32_t fpstore_crc(const fpstore_header_t* header, const void* data) {
+    uint32_t crc = esp_crc32_le(0, (const uint8_t*)header, offsetof(fpstore_header_t, crc));
+    return esp_crc32_le(crc, data, header->length);
+}
+
+static inline bool fpstore_header_valid(const fpstore_t* store, const fpstore_header_t* header) {
+    return header->magic == FPSTORE_MAGIC && header->slots > 0 &&
+           header->slots <= FPSTORE_MAX_SLOTS &&
+           header->length <= header->slots * FPSTORE_SLOT_SIZE - sizeof(fpstore_header_t);
+}
+
+static esp_err_t fpstore_read_header(const fpstore_t* store, uint32_t slot,
+                                     fpstore_header_t* header) {
+    return esp_partition_read(store->partition, slot * FPSTORE_SLOT_SIZE,
+                              header, sizeof(*header));
+}
+
+// Avanzar un cursor desde `slot` hasta el siguiente registro pendiente
+static uint32_t fpstore_next_pending(const fpstore_t* store, uint32_t slot) {
+    fpstore_header_t header;
+    while (slot != store->head) {
+        if (fpstore_read_header(store, slot, &header) == ESP_OK &&
+            fpstore_header_valid(store, &header)) {
+            if (header.state == FPSTORE_STATE_PENDING) {
+                return slot;
+            }
+            slot = (slot + header.slots) % store->n_slots;
+        } else {
+            slot = (slot + 1) % store->n_slots;
+        }
+    }
+    return slot;
+}
+
+// Montar la partición: reconstruir head, tail y pendientes desde las cabeceras
+esp_err_t fpstore_init(fpstore_t* store) {
+    memset(store, 0, sizeof(*store));
+    store->partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                                ESP_PARTITION_SUBTYPE_ANY,
+                                                FPSTORE_PARTITION_LABEL);
+    if (store->partition == NULL) {
+        ESP_LOGW(TAG, "Partición %s no encontrada, sin almacenamiento offline",
+                 FPSTORE_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+    store->n_slots = store->partition->size / FPSTORE_SLOT_SIZE;
+    
+    bool found = false;
+    uint32_t newest = 0, oldest_pending = UINT32_MAX;
+    fpstore_header_t header;
+    for (uint32_t slot = 0; slot < store->n_slots; ) {
+        if (fpstore_read_header(store, slot, &header) != ESP_OK ||
+            !fpstore_header_valid(store, &header)) {
+            slot++;
+            continue;
+        }
+        if (!found || header.sequence >= newest) {
+            newest = header.sequence;
+            store->head = (slot + header.slots) % store->n_slots;
+            found = true;
+        }
+        if (header.state == FPSTORE_STATE_PENDING) {
+            store->pending++;
+            if (header.sequence < oldest_pending) {
+                oldest_pending = header.sequence;
+                store->tail = slot;
+            }
+        }
+        slot += header.slots;
+    }
+    store->sequence = found ? newest + 1 : 0;
+    if (store->pending == 0) {
+        store->tail = store->head;
+    }
+    
+    ESP_LOGI(TAG, "fpstore: %lu slots, %lu registros pendientes",
+             store->n_slots, store->pending);
+    return ESP_OK;
+}
+
+static void fpstore_mark_sent(fpstore_t* store, uint32_t slot) {
+    uint32_t state = FPSTORE_STATE_SENT;
+    esp_partition_write(store->partition, slot * FPSTORE_SLOT_SIZE +
+                        offsetof(fpstore_header_t, state), &state, sizeof(state));
+    store->pending--;
+}
+
+// Liberar [start, start + count) para escribir: los pendientes que caigan
+// dentro se pierden (los más antiguos del ring). Se marcan en flash porque
+// el último slot reservado no se borra.
+static void fpstore_reclaim(fpstore_t* store, uint32_t start, uint32_t count) {
+    while (store->pending > 0 &&
+           (store->tail + store->n_slots - start) % store->n_slots < count) {
+        fpstore_header_t header;
+        uint32_t advance = 1;
+        if (fpstore_read_header(store, store->tail, &header) == ESP_OK &&
+            fpstore_header_valid(store, &header)) {
+            advance = header.slots;
+            if (header.state == FPSTORE_STATE_PENDING) {
+                fpstore_mark_sent(store, store->tail);
+                store->dropped++;
+            }
+        }
+        store->tail = fpstore_next_pending(store, (store->tail + advance) % store->n_slots);
+    }
+    if (store->pending == 0) {
+        store->tail = (start + count) % store->n_slots;
+    }
+}
+
+// Guardar un registro con la cabecera de su lote
+esp_err_t fpstore_append(fpstore_t* store, const uplink_record_t* record,
+                         uint32_t sample_rate, uint8_t quality_level, uint8_t wire_format) {
+    if (store->partition == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    uint32_t slots = (sizeof(fpstore_header_t) + record->length + FPSTORE_SLOT_SIZE - 1) /
+                     FPSTORE_SLOT_SIZE;
+    if (slots > FPSTORE_MAX_SLOTS || slots >= store->n_slots) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    
+    // Un registro no se parte al final de la partición: saltar al inicio
+    if (store->head + slots > store->n_slots) {
+        uint32_t skipped = store->n_slots - store->head;
+        fpstore_reclaim(store, store->head, skipped);
+        esp_partition_erase_range(store->partition, store->head * FPSTORE_SLOT_SIZE,
+                                  skipped * FPSTORE_SLOT_SIZE);
+        store->head = 0;
+        if (store->pending == 0) {
+            store->tail = 0;
+        }
+    }
+    // Un slot libre tras el registro: head nunca alcanza a tail
+    fpstore_reclaim(store, store->head, slots + 1);
+    
+    fpstore_header_t header = {
+        .magic = FPSTORE_MAGIC,
+        .sequence = store->sequence,
+        .slots = slots,
+        .wire_format = wire_format,
+        .quality_level = quality_level,
+        .sample_rate = sample_rate,
+        .length = record->length,
+        .state = FPSTORE_STATE_PENDING
+    };
+    header.crc = fpstore_crc(&header, record->data);
+    
+    // Datos antes que cabecera: un corte de alimentación no deja un
+    // registro con magic válido y datos a medias
+    size_t offset = store->head * FPSTORE_SLOT_SIZE;
+    esp_err_t ret = esp_partition_erase_range(store->partition, offset, slots * FPSTORE_SLOT_SIZE);
+    if (ret == ESP_OK) {
+        ret = esp_partition_write(store->partition, offset + sizeof(header),
+                                  record->data, record->length);
+    }
+    if (ret == ESP_OK) {
+        ret = esp_partition_write(store->partition, offset, &header, sizeof(header));
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Error escribiendo fpstore: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    
+    if (store->pending == 0) {
+        store->tail = store->head;
+    }
+    store->head = (store->head + slots) % store->n_slots;
+    store->sequence++;
+    store->pending++;
+    return ESP_OK;
+}
+
+// Leer el registro pendiente en `slot`. Devuelve ESP_ERR_INVALID_CRC si
+// está dañado; el llamante debe marcarlo igualmente para saltarlo.
+static esp_err_t fpstore_read(const fpstore_t* store, uint32_t slot,
+                              fpstore_header_t* header, uplink_record_t* record) {
+    esp_err_t ret = fpstore_read_header(store, slot, header);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    record->length = header->length;
+    record->data = malloc(header->length + 1);
+    if (record->data == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    ret = esp_partition_read(store->partition, slot * FPSTORE_SLOT_SIZE + sizeof(*header),
+                             record->data, header->length);
+    ((char*)record->data)[header->length] = '\0';   // Registros JSON
+    if (ret == ESP_OK && fpstore_crc(header, record->data) != header->crc) {
+        ret = ESP_ERR_INVALID_CRC;
+    }
+    if (ret != ESP_OK) {
+        free(record->data);
+        record->data = NULL;
+    }
+    return ret;
+}
+
+// ================================
+// LOTES DE TRANSMISIÓN
+// ================================
+
+#define BATCH_MAX_RECORDS    16
+
+// Registros serializados pendientes de envío. Se envían juntos al llegar a
+// batch_size o cuando el más antiguo lleva batch_linger segundos esperando.
+typedef struct {
+    uplink_record_t records[BATCH_MAX_RECORDS];
+    uint8_t count;
+    int64_t first_at;          // esp_timer_get_time() del registro más antiguo
+    uint32_t sample_rate;      // Cabecera compartida por todo el lote
+    uint8_t quality_level;
+    uint8_t wire_format;       // Todos los registros usan el mismo formato
+    uint32_t dropped;          // Registros descartados por lote lleno
+} uplink_batch_t;
+
+static uplink_batch_t uplink_batch;
+
+static void uplink_batch_clear(uplink_batch_t* batch) {
+    for (int i = 0; i < batch->count; i++) {
+        free(batch->records[i].data);
+    }
+    batch->count = 0;
+}
+
+// Pasar todos los registros del lote a flash cuando no se pueden enviar
+static void uplink_batch_spill(uplink_batch_t* batch) {
+    for (int i = 0; i < batch->count; i++) {
+        if (fpstore_append(&fpstore, &batch->records[i], batch->sample_rate,
+                           batch->quality_level, batch->wire_format) != ESP_OK) {
+            batch->dropped++;
+        }
+    }
+    if (batch->count > 0) {
+        ESP_LOGW(TAG, "Lote de %d registros guardado en flash (%lu pendientes)",
+                 batch->count, fpstore.pending);
+    }
+    uplink_batch_clear(batch);
+}
+
+// Cuerpo JSON: cabecera y registros ya serializados insertados tal cual
+static bool uplink_batch_post_json(const uplink_batch_t* batch) {
+    cJSON *json = cJSON_CreateObject();
+    cJSON_AddStringToObject(json, "device_id", DEVICE_ID);
+    cJSON_AddNumberToObject(json, "sample_rate", batch->sample_rate);
+    cJSON_AddNumberToObject(json, "quality_level", batch->quality_level);
+    cJSON_AddNumberToObject(json, "config_version", audio_config.config_version);
+    cJSON *records = cJSON_AddArrayToObject(json, "records");
+    for (int i = 0; i < batch->count; i++) {
+        cJSON_AddItemToArray(records, cJSON_CreateRaw(batch->records[i].data));
+    }
+    
+    char *body = cJSON_PrintUnformatted(json);
+    cJSON_Delete(json);
+    
+    bool success = body && http_post_json(body);
+    free(body);
+    return success;
+}
+
+// Cuerpo binario: audimeter_batch_header_t seguido de los registros
+static bool uplink_batch_post_binary(const uplink_batch_t* batch) {
+    size_t size = sizeof(audimeter_batch_header_t);
+    for (int i = 0; i < batch->count; i++) {
+        size += batch->records[i].length;
+    }
+    uint8_t* body = malloc(size);
+    if (body == NULL) {
+        ESP_LOGE(TAG, "Sin memoria para el lote binario (%u bytes)", (unsigned)size);
+        return false;
+    }
+    
+    audimeter_batch_header_t* header = (audimeter_batch_header_t*)body;
+    memset(header, 0, sizeof(*header));
+    header->magic = AUDIMETER_WIRE_MAGIC;
+    header->version = AUDIMETER_WIRE_VERSION;
+    header->header_size = sizeof(audimeter_batch_header_t);
+    header->record_count = batch->count;
+    strncpy(header->device_id, DEVICE_ID, AUDIMETER_DEVICE_ID_LEN);
+    header->sample_rate = batch->sample_rate;
+    header->quality_level = batch->quality_level;
+    
+    uint8_t* cursor = body + sizeof(*header);
+    for (int i = 0; i < batch->count; i++) {
+        memcpy(cursor, batch->records[i].data, batch->records[i].length);
+        cursor += batch->records[i].length;
+    }
+    
+    bool success = uplink_post(&uplink, AUDIMETER_WIRE_CONTENT_TYPE, (const char*)body, size);
+    free(body);
+    return success;
+}
+
+// Enviar todos los registros pendientes en una sola petición
+bool uplink_batch_flush(uplink_batch_t* batch) {
+    if (batch->count == 0) {
+        return true;
+    }
+    if (!wifi_connected) {
+        ESP_LOGW(TAG, "WiFi no conectado, lote de %d registros pendiente", batch->count);
+        return false;
+    }
+    
+    bool success = (batch->wire_format == WIRE_FORMAT_BINARY) ?
+                   uplink_batch_post_binary(batch) : uplink_batch_post_json(batch);
+    
+    if (success && uplink.rejected) {
+        // Reenviarlo sólo llenaría fpstore con registros que nunca se aceptarán
+        ESP_LOGE(TAG, "Lote de %d registros descartado (%lu rechazos)",
+                 batch->count, uplink.rejections);
+        uplink_batch_clear(batch);
+    } else if (success) {
+        ESP_LOGI(TAG, "Lote de %d registros enviado", batch->count);
+        transmissions_sent += batch->count;
+        ui_post(UI_EVENT_REFRESH, 0);
+        uplink_batch_clear(batch);
+    }
+    return success;
+}
+
+// Añadir un registro serializado; el lote toma posesión de sus datos.
+// `can_send` es falso durante el backoff: el lote anterior va a flash.
+void uplink_batch_add(uplink_batch_t* batch, const uplink_item_t* item, bool can_send) {
+    if (item->record.data == NULL) {
+        return;
+    }
+    
+    // Un cambio de configuración cierra el lote: la cabecera es común
+    if (batch->count > 0 && (batch->sample_rate != item->sample_rate ||
+                             batch->quality_level != item->quality_level ||
+                             batch->wire_format != item->wire_format) &&
+        !(can_send && uplink_batch_flush(batch))) {
+        uplink_batch_spill(batch);
+    }
+    if (batch->count == BATCH_MAX_RECORDS) {
+        // Sin conexión durante mucho tiempo: el lote entero pasa a flash
+        uplink_batch_spill(batch);
+    }
+    
+    if (batch->count == 0) {
+        batch->first_at = esp_timer_get_time();
+        batch->sample_rate = item->sample_rate;
+        batch->quality_level = item->quality_level;
+        batch->wire_format = item->wire_format;
+    }
+    batch->records[batch->count++] = item->record;
+}
+
+// Instante en que vence el lote: completo o batch_linger segundos después
+// de su registro más antiguo
+int64_t uplink_batch_deadline(const uplink_batch_t* batch) {
+    if (batch->count == 0) {
+        return INT64_MAX;
+    }
+    uint8_t target = audio_config.batch_size ? audio_config.batch_size : 1;
+    if (batch->count >= target) {
+        return 0;
+    }
+    return batch->first_at + (int64_t)audio_config.batch_linger * 1000000LL;
+}
+
+bool uplink_batch_due(const uplink_batch_t* batch) {
+    return esp_timer_get_time() >= uplink_batch_deadline(batch);
+}
+
+// Reenviar registros guardados en flash. Como mucho FPSTORE_DRAIN_RECORDS
+// cada FPSTORE_DRAIN_INTERVAL_S, y nunca mientras el lote en vivo espera
+// su envío, para que el atraso no retrase los datos actuales.
+bool fpstore_drain(fpstore_t* store, const uplink_batch_t* live) {
+    static uplink_batch_t backlog;
+    uint32_t slots[FPSTORE_DRAIN_RECORDS];
+    
+    int64_t now = esp_timer_get_time();
+    if (store->pending == 0 || !wifi_connected || now < store->drain_at ||
+        uplink_batch_due(live)) {
+        return true;
+    }
+    store->drain_at = now + FPSTORE_DRAIN_INTERVAL_S * 1000000LL;
+    
+    uint32_t cursor = store->tail;
+    while (backlog.count < FPSTORE_DRAIN_RECORDS && cursor != store->head) {
+        fpstore_header_t header;
+        uplink_record_t record;
+        esp_err_t ret = fpstore_read(store, cursor, &header, &record);
+        if (ret == ESP_ERR_NO_MEM) {
+            break;
+        }
+        if (ret != ESP_OK) {
+            // Registro dañado: saltarlo entero para no bloquear el vaciado. Con
+            // CRC inválido la cabecera sigue siendo buena y dice cuántos slots
+            // ocupa (como en reclaim); sólo sin cabecera se avanza de uno en uno.
+            ESP_LOGW(TAG, "Registro en flash descartado: %s", esp_err_to_name(ret));
+            uint32_t advance = (ret == ESP_ERR_INVALID_CRC &&
+                                fpstore_header_valid(store, &header)) ? header.slots : 1;
+            fpstore_mark_sent(store, cursor);
+            store->dropped++;
+            uint32_t next = fpstore_next_pending(store, (cursor + advance) % store->n_slots);
+            if (cursor == store->tail) {
+                store->tail = next;
+            }
+            cursor = next;
+            continue;
+        }
+        if (backlog.count > 0 && (header.sample_rate != backlog.sample_rate ||
+                                  header.quality_level != backlog.quality_level ||
+                                  header.wire_format != backlog.wire_format)) {
+            free(record.data);   // Otra cabecera: irá en el siguiente lote
+            break;
+        }
+        backlog.sample_rate = header.sample_rate;
+        backlog.quality_level = header.quality_level;
+        backlog.wire_format = header.wire_format;
+        slots[backlog.count] = cursor;
+        backlog.records[backlog.count++] = record;
+        cursor = fpstore_next_pending(store, (cursor + header.slots) % store->n_slots);
+    }
+    
+    int count = backlog.count;
+    if (count == 0 || !uplink_batch_flush(&backlog)) {
+        uplink_batch_clear(&backlog);
+        return count == 0;
+    }
+    for (int i = 0; i < count; i++) {
+        fpstore_mark_sent(store, slots[i]);
+    }
+    store->tail = (store->pending > 0) ? fpstore_next_pending(store, cursor) : store->head;
+    ESP_LOGI(TAG, "%s %d registros de flash (%lu pendientes)",
+             uplink.rejected ? "Descartados" : "Reenviados", count, store->pending);
+    return true;
+}
+
+// ================================
+// TAREAS PRINCIPALES
+// ================================
+
+// La captura depende sólo del propio pipeline: se detiene con el menú
+// abierto o con una reconfiguración pendiente, nunca por el estado de la
+// red. Sin WiFi (CONNECTING) o tras un envío fallido (ERROR) los registros
+// siguen llegando a la tarea de envío, que los guarda en flash.
+static bool capture_enabled(void) {
+    return current_state != STATE_CONFIG && !config_request_pending;
+}
+
+// Tarea de captura de audio: productor del ring PCM. En modo ciclo captura
+// capture_duration segundos y espera capture_interval; en modo continuo
+// publica bloques sin pausa hasta que cambia la configuración. Con
+// power_save, en modo ciclo cada captura va precedida de un sondeo de TV
+// encendida y el I2S se para durante la espera.
+void audio_capture_task(void *pvParameters) {
+    capture_engine_init(&capture_engine);
+    capture_task_handle = xTaskGetCurrentTaskHandle();
+    bool lost_blocks = false;
+    uint32_t streams_ended = 0;
+    
+    while (1) {
+        if (config_request_pending) {
+            pipeline_reconfigure(streams_ended);
+        }
+        
+        bool continuous = (audio_config.capture_mode == CAPTURE_MODE_CONTINUOUS);
+        bool idle_stop = !continuous && audio_config.power_save;
+        bool sampling = capture_enabled();
+        if (sampling && idle_stop && !capture_engine_probe(&capture_engine)) {
+            ESP_LOGI(TAG, "Sin sonido de TV, captura omitida (%lu seguidas)",
+                     capture_engine.probes_silent);
+            sampling = false;
+        }
+        
+        if (sampling && capture_engine_begin(&capture_engine, audio_config.sample_rate) != ESP_OK) {
+            sampling = false;
+        }
+        
+        if (sampling) {
+            capture_engine.probes_silent = 0;
+            capture_engine_start(&capture_engine);
+            ui_post(UI_EVENT_STATE, STATE_SAMPLING);
+            
+            if (continuous) {
+                ESP_LOGI(TAG, "Iniciando captura continua (ventana %d s cada %d s)",
+                         audio_config.stream_window, audio_config.stream_interval);
+            } else {
+                ESP_LOGI(TAG, "Iniciando captura de %d segundos", audio_config.capture_duration);
+            }
+            
+            // Capturar audio por bloques DMA completos directamente en el ring
+            size_t target = audio_config.sample_rate * audio_config.capture_duration;
+            size_t captured = 0;
+            dsp_mode_t format = dsp_active_mode();
+            uint32_t generation = dsp_config_generation;
+            bool first_block = true;   // Aunque el ring lleno ya haya drenado muestras
+            bool done = false;
+            while (!done) {
+                pcm_block_t* block = pcm_ring_acquire(&pcm_ring);
+                if (block == NULL) {
+                    // Procesamiento atrasado: drenar el DMA y marcar el hueco
+                    captured += capture_engine_read_block(&capture_engine, NULL, format);
+                    pcm_ring.overruns++;
+                    lost_blocks = true;
+                    continue;
+                }
+                
+                block->length = capture_engine_read_block(&capture_engine, block->samples, format);
+                block->format = format;
+                block->flags = first_block ? PCM_BLOCK_FLAG_START : 0;
+                first_block = false;
+                if (lost_blocks) {
+                    block->flags |= PCM_BLOCK_FLAG_GAP;
+                    lost_blocks = false;
+                }
+                captured += block->length;
+                
+                // El flujo continuo se cierra al cambiar modo o tablas DSP;
+                // cualquier flujo se cierra ante una reconfiguración
+                done = config_request_pending ||
+                       (continuous ? (audio_config.capture_mode != CAPTURE_MODE_CONTINUOUS ||
+                                      dsp_config_generation != generation)
+                                   : (captured >= target));
+                if (done) {
+                    block->flags |= PCM_BLOCK_FLAG_END;
+                    streams_ended++;
+                }
+                block->timestamp = capture_engine_block_time(&capture_engine);
+                pcm_ring_commit(&pcm_ring);
+            }
+            
+            if (!continuous) {
+                samples_processed++;
+                ui_post(UI_EVENT_REFRESH, 0);
+                ESP_LOGI(TAG, "Muestra capturada y enviada a procesamiento");
+            }
+        }
+        if (idle_stop) {
+            capture_engine_stop(&capture_engine);
+        }
+        
+        // Esperar intervalo entre capturas; una reconfiguración lo interrumpe
+        if (config_request_pending) {
+            continue;
+        }
+        if (audio_config.capture_mode == CAPTURE_MODE_CONTINUOUS) {
+            // Fuera de muestreo (menú): display_task avisa al cambiar de estado
+            if (!sampling) {
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            }
+        } else {
+            TickType_t until = xTaskGetTickCount() + pdMS_TO_TICKS(audio_config.capture_interval * 1000);
+            TickType_t now;
+            while (!config_request_pending && (int32_t)(until - (now = xTaskGetTickCount())) > 0) {
+                ulTaskNotifyTake(pdTRUE, until - now);
+            }
+        }
+    }
+    
+    vTaskDelete(NULL);
+}
+
+// Notificar el estado del pipeline. display_task no expulsa al usuario del
+// menú: en modo continuo el procesamiento sigue activo mientras se configura.
+static void set_pipeline_state(system_state_t state) {
+    ui_post(UI_EVENT_STATE, state);
+}
+
+// La tarea de envío es la única que toca la red y la partición fpstore.
+// El procesamiento sólo deja registros ya codificados en uplink_queue, sin
+// esperar nunca a la radio ni a TLS.
 
-    wifi_config_t wifi_config = {
-        .sta = {
-            .ssid = WIFI_SSID,
-            .password = WIFI_PASS,
-            .threshold.authmode = WIFI_AUTH_WPA2_PSK,
-        },
-    };
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
-    ESP_ERROR_CHECK(esp_wifi_start());
+#define UPLINK_QUEUE_LEN        8
+#define UPLINK_BACKOFF_BASE_S   5
+#define UPLINK_BACKOFF_MAX_S    300
+#define UPLINK_OFFLINE_POLL_S   30     // Revisión de la red con registros en flash
+#define UPLINK_MAX_SLEEP_MS     3600000
+
+static QueueHandle_t uplink_queue;
+static uint32_t uplink_queue_dropped = 0;
+
+typedef struct {
+    uint32_t failures;         // Fallos consecutivos
+    int64_t retry_at;          // No intentar ningún envío antes de este instante
+} uplink_backoff_t;
+
+// Backoff exponencial con jitter: 5 s, 10 s, 20 s... hasta 5 minutos
+static void uplink_backoff_fail(uplink_backoff_t* backoff) {
+    uint32_t shift = backoff->failures < 6 ? backoff->failures : 6;
+    int64_t delay = (int64_t)UPLINK_BACKOFF_BASE_S << shift;
+    if (delay > UPLINK_BACKOFF_MAX_S) {
+        delay = UPLINK_BACKOFF_MAX_S;
+    }
+    delay = delay * 1000000LL;
+    delay += esp_random() % (delay / 4 + 1);   // Evitar reintentos sincronizados
+    backoff->failures++;
+    backoff->retry_at = esp_timer_get_time() + delay;
+    ESP_LOGW(TAG, "Reintento de envío en %lld s (%lu fallos)",
+             delay / 1000000LL, backoff->failures);
 }
 
-// Callback para manejo de respuesta HTTP
-esp_err_t http_event_handler(esp_http_client_event_t *evt) {
-    switch(evt->event_id) {
-        case HTTP_EVENT_ERROR:
-            ESP_LOGD(TAG, "HTTP_EVENT_ERROR");
-            break;
-        case HTTP_EVENT_ON_CONNECTED:
-            ESP_LOGD(TAG, "HTTP_EVENT_ON_CONNECTED");
-            break;
-        case HTTP_EVENT_HEADER_SENT:
-            ESP_LOGD(TAG, "HTTP_EVENT_HEADER_SENT");
-            break;
-        case HTTP_EVENT_ON_HEADER:
-            ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
-            break;
-        case HTTP_EVENT_ON_DATA:
-            ESP_LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
-            break;
-        case HTTP_EVENT_ON_FINISH:
-            ESP_LOGD(TAG, "HTTP_EVENT_ON_FINISH");
-            break;
-        case HTTP_EVENT_DISCONNECTED:
-            ESP_LOGI(TAG, "HTTP_EVENT_DISCONNECTED");
-            break;
+// Entregar un registro codificado a la tarea de envío sin bloquear
+static void uplink_enqueue(uplink_record_t record) {
+    if (record.data == NULL) {
+        return;
+    }
+    uplink_item_t item = {
+        .record = record,
+        .sample_rate = audio_config.sample_rate,
+        .quality_level = audio_config.active_quality,
+        .wire_format = audio_config.wire_format
+    };
+    if (xQueueSend(uplink_queue, &item, 0) != pdTRUE) {
+        uplink_queue_dropped++;
+        ESP_LOGW(TAG, "Cola de envío llena, registro descartado (%lu)", uplink_queue_dropped);
+        free(record.data);
     }
-    return ESP_OK;
 }
 
-// Enviar fingerprint al servidor
-bool send_fingerprint(fingerprint_t* fingerprint) {
-    if (!wifi_connected) {
-        ESP_LOGW(TAG, "WiFi no conectado, fingerprint no enviado");
-        return false;
+// Enviar el lote si venció; si falla, pasa a flash y se espera al backoff.
+// Con conexión y sin lote pendiente, reenviar poco a poco lo guardado.
+static void uplink_service(uplink_backoff_t* backoff) {
+    if (esp_timer_get_time() < backoff->retry_at) {
+        return;
     }
     
-    // Crear JSON payload
+    bool success;
+    if (uplink_batch_due(&uplink_batch)) {
+        if (!wifi_connected) {
+            // Sin red no hay nada que reintentar: guardar y esperar
+            uplink_batch_spill(&uplink_batch);
+            return;
+        }
+        set_pipeline_state(STATE_TRANSMITTING);
+        success = uplink_batch_flush(&uplink_batch);
+        if (!success) {
+            ESP_LOGE(TAG, "Error al enviar lote de fingerprints");
+            uplink_batch_spill(&uplink_batch);
+        }
+        set_pipeline_state(success && !uplink.rejected ? STATE_SAMPLING : STATE_ERROR);
+    } else {
+        success = fpstore_drain(&fpstore, &uplink_batch);
+    }
+    
+    if (success) {
+        backoff->failures = 0;
+    } else {
+        uplink_backoff_fail(backoff);
+    }
+}
+
+// Telemetría periódica: estadísticas por etapa y por tarea desde el último
+// registro, enviadas en el mismo lote que los fingerprints
+typedef struct {
+    uint32_t period_ms;
+    perf_summary_t stages[PERF_STAGE_COUNT];
+    perf_task_t tasks[PERF_MAX_TASKS];
+    int n_tasks;
+} telemetry_t;
+
+static void telemetry_take(telemetry_t* telemetry, uint32_t period_ms) {
+    telemetry->period_ms = period_ms;
+    for (int i = 0; i < PERF_STAGE_COUNT; i++) {
+        perf_stage_take(i, &telemetry->stages[i]);
+        const perf_summary_t* stage = &telemetry->stages[i];
+        if (stage->count > 0) {
+            ESP_LOGI(TAG, "Etapa %s: %lu x, min %lu, media %lu, p99 %lu, max %lu ciclos",
+                     perf_stage_names[i], stage->count, stage->min, stage->mean,
+                     stage->p99, stage->max);
+        }
+    }
+    telemetry->n_tasks = perf_tasks_sample(telemetry->tasks, PERF_MAX_TASKS);
+}
+
+static char* telemetry_record_json(const telemetry_t* telemetry, uint64_t timestamp) {
     cJSON *json = cJSON_CreateObject();
-    cJSON *device_id = cJSON_CreateString(DEVICE_ID);
-    cJSON *timestamp = cJSON_CreateNumber(fingerprint->timestamp);
-    cJSON *hash = cJSON_CreateString(fingerprint->hash);
-    cJSON *confidence = cJSON_CreateNumber(fingerprint->confidence);
-    cJSON *duration = cJSON_CreateNumber(fingerprint->duration);
-    cJSON *features = cJSON_CreateString(fingerprint->features);
-    cJSON *sample_rate = cJSON_CreateNumber(audio_config.sample_rate);
-    cJSON *quality = cJSON_CreateNumber(audio_config.quality_level);
+    cJSON_AddStringToObject(json, "type", "telemetry");
+    cJSON_AddNumberToObject(json, "timestamp", timestamp);
+    cJSON_AddNumberToObject(json, "period_ms", telemetry->period_ms);
+    cJSON_AddNumberToObject(json, "cpu_mhz", esp_rom_get_cpu_ticks_per_us());
+    cJSON_AddNumberToObject(json, "free_heap", esp_get_free_heap_size());
+    cJSON_AddNumberToObject(json, "min_free_internal",
+                            heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL));
+    cJSON_AddNumberToObject(json, "largest_internal_block",
+                            heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL));
+    cJSON_AddNumberToObject(json, "queue_dropped", uplink_queue_dropped);
+    cJSON_AddNumberToObject(json, "store_pending", fpstore.pending);
     
-    cJSON_AddItemToObject(json, "device_id", device_id);
-    cJSON_AddItemToObject(json, "timestamp", timestamp);
-    cJSON_AddItemToObject(json, "hash", hash);
-    cJSON_AddItemToObject(json, "confidence", confidence);
-    cJSON_AddItemToObject(json, "duration", duration);
-    cJSON_AddItemToObject(json, "features", features);
-    cJSON_AddItemToObject(json, "sample_rate", sample_rate);
-    cJSON_AddItemToObject(json, "quality_level", quality);
+    cJSON *stages = cJSON_AddObjectToObject(json, "stages");
+    for (int i = 0; i < PERF_STAGE_COUNT; i++) {
+        const perf_summary_t* summary = &telemetry->stages[i];
+        if (summary->count == 0) {
+            continue;
+        }
+        cJSON *stage = cJSON_AddObjectToObject(stages, perf_stage_names[i]);
+        cJSON_AddNumberToObject(stage, "count", summary->count);
+        cJSON_AddNumberToObject(stage, "min", summary->min);
+        cJSON_AddNumberToObject(stage, "mean", summary->mean);
+        cJSON_AddNumberToObject(stage, "p99", summary->p99);
+        cJSON_AddNumberToObject(stage, "max", summary->max);
+    }
     
-    char *json_string = cJSON_Print(json);
+    cJSON *tasks = cJSON_AddArrayToObject(json, "tasks");
+    for (int i = 0; i < telemetry->n_tasks; i++) {
+        cJSON *task = cJSON_CreateObject();
+        cJSON_AddStringToObject(task, "name", telemetry->tasks[i].name);
+        cJSON_AddNumberToObject(task, "stack_free", telemetry->tasks[i].stack_free);
+        cJSON_AddNumberToObject(task, "cpu_permille", telemetry->tasks[i].cpu_permille);
+        cJSON_AddItemToArray(tasks, task);
+    }
     
-    // Configurar cliente HTTP
-    esp_http_client_config_t config = {
-        .url = SERVER_URL,
-        .event_handler = http_event_handler,
-        .timeout_ms = 10000,
-    };
+    char *record = cJSON_PrintUnformatted(json);
+    cJSON_Delete(json);
+    return record;
+}
+
+static uplink_record_t telemetry_record_binary(const telemetry_t* telemetry, uint64_t timestamp) {
+    uplink_record_t record = { 0 };
+    int n_stages = 0;
+    for (int i = 0; i < PERF_STAGE_COUNT; i++) {
+        n_stages += (telemetry->stages[i].count > 0);
+    }
+    size_t size = sizeof(audimeter_record_header_t) + sizeof(audimeter_telemetry_t) +
+                  n_stages * sizeof(audimeter_stage_stats_t) +
+                  telemetry->n_tasks * sizeof(audimeter_task_stats_t);
+    uint8_t* buffer = calloc(1, size);
+    if (buffer == NULL) {
+        return record;
+    }
     
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    esp_http_client_set_method(client, HTTP_METHOD_POST);
-    esp_http_client_set_header(client, "Content-Type", "application/json");
-    esp_http_client_set_post_data(client, json_string, strlen(json_string));
+    audimeter_record_header_t* header = (audimeter_record_header_t*)buffer;
+    header->record_size = size;
+    header->type = AUDIMETER_RECORD_TELEMETRY;
+    header->timestamp = timestamp;
     
-    esp_err_t err = esp_http_client_perform(client);
-    bool success = false;
+    audimeter_telemetry_t* tm = (audimeter_telemetry_t*)(header + 1);
+    tm->period_ms = telemetry->period_ms;
+    tm->cpu_mhz = esp_rom_get_cpu_ticks_per_us();
+    tm->stage_count = n_stages;
+    tm->task_count = telemetry->n_tasks;
+    tm->free_heap = esp_get_free_heap_size();
+    tm->min_free_internal = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+    tm->largest_internal_block = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
+    tm->queue_dropped = uplink_queue_dropped;
+    tm->store_pending = fpstore.pending;
     
-    if (err == ESP_OK) {
-        int status_code = esp_http_client_get_status_code(client);
-        if (status_code == 200 || status_code == 201) {
-            ESP_LOGI(TAG, "Fingerprint enviado exitosamente. Status: %d", status_code);
-            transmissions_sent++;
-            success = true;
-        } else {
-            ESP_LOGW(TAG, "Error en servidor. Status: %d", status_code);
+    audimeter_stage_stats_t* stage = (audimeter_stage_stats_t*)(tm + 1);
+    for (int i = 0; i < PERF_STAGE_COUNT; i++) {
+        const perf_summary_t* summary = &telemetry->stages[i];
+        if (summary->count == 0) {
+            continue;
         }
-    } else {
-        ESP_LOGE(TAG, "Error HTTP: %s", esp_err_to_name(err));
+        stage->stage = i;
+        stage->count = summary->count;
+        stage->min_cycles = summary->min;
+        stage->mean_cycles = summary->mean;
+        stage->p99_cycles = summary->p99;
+        stage->max_cycles = summary->max;
+        stage++;
     }
     
-    esp_http_client_cleanup(client);
-    cJSON_Delete(json);
-    free(json_string);
+    audimeter_task_stats_t* task = (audimeter_task_stats_t*)stage;
+    for (int i = 0; i < telemetry->n_tasks; i++, task++) {
+        memcpy(task->name, telemetry->tasks[i].name, AUDIMETER_TASK_NAME_LEN);
+        task->stack_free = telemetry->tasks[i].stack_free;
+        task->cpu_permille = telemetry->tasks[i].cpu_permille;
+    }
     
-    return success;
+    record.data = buffer;
+    record.length = size;
+    return record;
 }
 
-// ================================
-// TAREAS PRINCIPALES
-// ================================
+// Cerrar el periodo de telemetría y añadir su registro al lote en vivo
+static void uplink_telemetry(int64_t* last_at, bool can_send) {
+    static telemetry_t telemetry;
+    int64_t now = esp_timer_get_time();
+    telemetry_take(&telemetry, (uint32_t)((now - *last_at) / 1000));
+    *last_at = now;
+    
+    uint64_t timestamp = get_timestamp();
+    uplink_item_t item = {
+        .record = (audio_config.wire_format == WIRE_FORMAT_BINARY) ?
+                  telemetry_record_binary(&telemetry, timestamp) :
+                  text_record(telemetry_record_json(&telemetry, timestamp)),
+        .sample_rate = audio_config.sample_rate,
+        .quality_level = audio_config.active_quality,
+        .wire_format = audio_config.wire_format
+    };
+    uplink_batch_add(&uplink_batch, &item, can_send);
+}
 
-// Tarea de captura de audio
-void audio_capture_task(void *pvParameters) {
-    size_t buffer_size = audio_config.sample_rate * audio_config.capture_duration;
-    int32_t* raw_buffer = malloc(buffer_size * sizeof(int32_t));
-    float* audio_buffer = malloc(buffer_size * sizeof(float));
-    size_t bytes_read;
+// Tarea de envío: consumidor de uplink_queue
+void uplink_task(void *pvParameters) {
+    uplink_backoff_t backoff = { 0 };
+    uplink_item_t item;
+    int64_t telemetry_at = esp_timer_get_time();
+    
+    // Descartar lo medido durante el arranque
+    for (int i = 0; i < PERF_STAGE_COUNT; i++) {
+        perf_stages[i].reset = true;
+    }
+    perf_tasks_sample(NULL, 0);
     
     while (1) {
-        if (current_state == STATE_SAMPLING || current_state == STATE_PROCESSING) {
-            current_state = STATE_SAMPLING;
-            update_display();
-            
-            ESP_LOGI(TAG, "Iniciando captura de %d segundos", audio_config.capture_duration);
-            
-            // Capturar audio
-            for (int i = 0; i < buffer_size; i++) {
-                i2s_read(I2S_NUM_0, &raw_buffer[i], sizeof(int32_t), &bytes_read, portMAX_DELAY);
-                // Convertir de int32 a float y normalizar
-                audio_buffer[i] = (float)raw_buffer[i] / (float)INT32_MAX;
-            }
-            
-            // Crear muestra de audio
-            audio_sample_t sample = {
-                .data = audio_buffer,
-                .length = buffer_size,
-                .timestamp = get_timestamp()
-            };
-            
-            // Enviar a cola de procesamiento
-            if (xQueueSend(audio_queue, &sample, 100) != pdTRUE) {
-                ESP_LOGW(TAG, "Cola de audio llena, muestra descartada");
-            } else {
-                samples_processed++;
-                ESP_LOGI(TAG, "Muestra capturada y enviada a procesamiento");
-            }
+        // Dormir hasta el próximo registro, el vencimiento del lote, la
+        // telemetría, el siguiente vaciado de fpstore o el fin del backoff.
+        // Sin nada pendiente se espera sólo a la cola.
+        int64_t now = esp_timer_get_time();
+        int64_t wake = uplink_batch_deadline(&uplink_batch);
+        if (audio_config.telemetry_interval > 0) {
+            int64_t due = telemetry_at + (int64_t)audio_config.telemetry_interval * 1000000LL;
+            wake = (due < wake) ? due : wake;
+        }
+        if (fpstore.pending > 0) {
+            // Sin red no hay evento que despierte la cola: revisar cada poco
+            int64_t due = wifi_connected ? fpstore.drain_at : now + UPLINK_OFFLINE_POLL_S * 1000000LL;
+            wake = (due < wake) ? due : wake;
+        }
+        if (wake < backoff.retry_at) {
+            wake = backoff.retry_at;
+        }
+        TickType_t wait = portMAX_DELAY;
+        if (wake <= now) {
+            wait = 0;
+        } else if (wake < INT64_MAX) {
+            int64_t ms = (wake - now) / 1000;
+            wait = pdMS_TO_TICKS(ms < UPLINK_MAX_SLEEP_MS ? ms : UPLINK_MAX_SLEEP_MS) + 1;
         }
         
-        // Esperar intervalo entre capturas
-        vTaskDelay(pdMS_TO_TICKS(audio_config.capture_interval * 1000));
+        if (xQueueReceive(uplink_queue, &item, wait) == pdTRUE) {
+            uplink_batch_add(&uplink_batch, &item, esp_timer_get_time() >= backoff.retry_at);
+            ESP_LOGI(TAG, "Registro en lote (%d/%d)", uplink_batch.count, audio_config.batch_size);
+        }
+        if (audio_config.telemetry_interval > 0 && esp_timer_get_time() - telemetry_at >=
+            (int64_t)audio_config.telemetry_interval * 1000000LL) {
+            uplink_telemetry(&telemetry_at, esp_timer_get_time() >= backoff.retry_at);
+        }
+        uplink_service(&backoff);
     }
     
-    free(raw_buffer);
-    free(audio_buffer);
     vTaskDelete(NULL);
 }
 
-// Tarea de procesamiento de audio y generación de fingerprints
-void audio_processing_task(void *pvParameters) {
-    audio_sample_t sample;
+// Generar y transmitir el fingerprint de una captura completa
+static void process_capture(stft_stream_t* stft, fingerprint_session_t* session,
+                            uint64_t timestamp) {
     fingerprint_t fingerprint;
     
-    while (1) {
-        // Esperar muestra de audio de la cola
-        if (xQueueReceive(audio_queue, &sample, portMAX_DELAY) == pdTRUE) {
-            current_state = STATE_PROCESSING;
-            update_display();
-            
-            ESP_LOGI(TAG, "Procesando muestra de audio...");
+    set_pipeline_state(STATE_PROCESSING);
+    
+    ESP_LOGI(TAG, "Procesando muestra de audio (%lu frames)...", stft->n_frames);
+    
+    // Generar fingerprint
+    fingerprint_status_t status = generate_fingerprint(stft, session, timestamp, &fingerprint);
+    fingerprint_session_mark_emitted(session, stft);
+    if (status == FINGERPRINT_NOISE) {
+        ESP_LOGW(TAG, "Muestra descartada: ruido detectado");
+    } else if (status == FINGERPRINT_NO_PEAKS) {
+        ESP_LOGW(TAG, "Muestra descartada: sin picos espectrales");
+    } else if (fingerprint.mode == FINGERPRINT_MODE_LANDMARKS) {
+        ESP_LOGI(TAG, "Fingerprint generado - %d frames, %lu landmarks, Hash: %.8s..., Confianza: %.2f",
+                 fingerprint.n_frames, fingerprint.n_landmarks,
+                 fingerprint.hash, fingerprint.confidence);
+    } else {
+        ESP_LOGI(TAG, "Fingerprint generado - %d frames x %d MFCC, Hash: %.8s..., Confianza: %.2f",
+                 fingerprint.n_frames, fingerprint.n_coeffs,
+                 fingerprint.hash, fingerprint.confidence);
+    }
+    if (session->continuous) {
+        samples_processed++;
+    }
+    
+    // Solo enviar si tiene confianza suficiente y el contenido cambió
+    if (fingerprint.confidence <= 0.1) {
+        ESP_LOGW(TAG, "Fingerprint descartado por baja confianza: %.2f", 
+                 fingerprint.confidence);
+    } else switch (change_detector_check(&change_detector, &fingerprint)) {
+        case CHANGE_SKIP:
+            ESP_LOGI(TAG, "Sin cambios de contenido, envío omitido (%lu seguidos)",
+                     change_detector.suppressed);
+            break;
             
-            // Generar fingerprint
-            generate_fingerprint(&sample, &fingerprint);
+        case CHANGE_SEND_HEARTBEAT:
+            uplink_enqueue(heartbeat_record(&fingerprint, &change_detector));
+            change_detector.heartbeat_at = fingerprint.timestamp;
+            ESP_LOGI(TAG, "Heartbeat en cola (%lu fingerprints omitidos)",
+                     change_detector.suppressed);
+            break;
             
-            // Solo enviar si tiene confianza suficiente
-            if (fingerprint.confidence > 0.1) {
-                current_state = STATE_TRANSMITTING;
-                update_display();
-                
-                if (send_fingerprint(&fingerprint)) {
-                    ESP_LOGI(TAG, "Fingerprint enviado exitosamente");
-                } else {
-                    ESP_LOGE(TAG, "Error al enviar fingerprint");
-                    current_state = STATE_ERROR;
-                    update_display();
-                    vTaskDelay(pdMS_TO_TICKS(5000)); // Esperar antes de reintentar
-                }
-            } else {
-                ESP_LOGW(TAG, "Fingerprint descartado por baja confianza: %.2f", 
-                         fingerprint.confidence);
+        case CHANGE_SEND_FULL: {
+            uplink_record_t record = fingerprint_record(&fingerprint);
+            if (record.data) {
+                uplink_enqueue(record);
+                change_detector_commit(&change_detector, &fingerprint);
+                ESP_LOGI(TAG, "Fingerprint en cola de envío");
             }
-            
-            // Volver a estado de muestreo
-            current_state = STATE_SAMPLING;
-            update_display();
+            break;
         }
-        
-        vTaskDelay(pdMS_TO_TICKS(100));
     }
+    quality_scheduler_window(status, timestamp);
     
-    vTaskDelete(NULL);
+    // Volver a estado de muestreo
+    set_pipeline_state(STATE_SAMPLING);
+}
+
+// Hora de los frames del flujo en curso. Cada bloque trae la de su primera
+// muestra, así que la referencia se renueva cada bloque y no acumula la
+// deriva del reloj del I2S respecto a la frecuencia nominal.
+typedef struct {
+    uint64_t ref_sample;       // Muestra de análisis, desde el inicio del flujo, con hora conocida
+    uint64_t ref_utc;          // UTC (µs) de ref_sample
+    uint64_t samples;          // Muestras de análisis recibidas en el flujo
+    uint32_t sample_rate;
+} stream_clock_t;
+
+static void stream_clock_reset(stream_clock_t* clock, uint32_t sample_rate) {
+    memset(clock, 0, sizeof(*clock));
+    clock->sample_rate = sample_rate;
+}
+
+// Anotar un bloque antes de pasarlo al analizador
+static void stream_clock_block(stream_clock_t* clock, const pcm_block_t* block) {
+    clock->ref_sample = clock->samples;
+    clock->ref_utc = block->timestamp;
+    clock->samples += block->length;
+}
+
+// UTC (µs) de la primera muestra del frame `frame` (salto hop_length)
+static uint64_t stream_clock_frame_time(const stream_clock_t* clock, uint32_t frame,
+                                        uint16_t hop_length) {
+    int64_t delta = (int64_t)frame * hop_length - (int64_t)clock->ref_sample;
+    return clock->ref_utc + delta * 1000000 / (int64_t)clock->sample_rate;
+}
+
+// Timestamp del fingerprint: el protocolo marca el final de la ventana, así
+// que es el inicio exacto de su primer frame más la duración declarada
+static uint64_t stream_clock_window_end(const stream_clock_t* clock, const stft_stream_t* stft,
+                                        const fingerprint_session_t* session) {
+    return stream_clock_frame_time(clock, fingerprint_session_window_start(session),
+                                   stft->hop_length) +
+           (uint64_t)session->window_seconds * 1000000;
+}
+
+// ================================
+// INFORME DE COLOCACIÓN EN MEMORIA
+// ================================
+
+#define PLACEMENT_MAX_ENTRIES  48
+
+// Región de una dirección: el código fuera de IRAM se ejecuta desde flash
+static const char* memory_region(const void* ptr) {
+    if (esp_ptr_external_ram(ptr)) {
+        return "PSRAM";
+    }
+    if (esp_ptr_in_iram(ptr)) {
+        return "IRAM";
+    }
+    if (esp_ptr_in_dram(ptr)) {
+        return "DRAM";
+    }
+    return "flash";
+}
+
+// Listar dónde quedó cada pieza del pipeline y avisar de las calientes que
+// acabaron en flash o PSRAM (p. ej. arena "hot" sin RAM interna)
+static void memory_placement_report(const stft_stream_t* stft,
+                                    const fingerprint_session_t* session) {
+    static dsp_placement_t entries[PLACEMENT_MAX_ENTRIES];
+    size_t n = dsp_placement_list(stft, session, entries, PLACEMENT_MAX_ENTRIES);
+    const dsp_placement_t local[] = {
+        { "capture_engine_read_block", (const void*)capture_engine_read_block, 0, true, true },
+#if AUDIO_PERF_ENABLE
+        { "perf_dsp_span", (const void*)perf_dsp_span, 0, true, true },
+#endif
+        { "capture_engine", &capture_engine, sizeof(capture_engine), false, true },
+        { "pcm_ring.blocks", pcm_ring.blocks, sizeof(pcm_ring.blocks), false, true },
+        { "pcm_ring.storage", pcm_ring.blocks[0].samples,
+          pcm_ring.capacity * PCM_BLOCK_SAMPLES * sizeof(float), false, false },
+    };
+    for (size_t i = 0; i < sizeof(local) / sizeof(local[0]) && n < PLACEMENT_MAX_ENTRIES; i++) {
+        entries[n++] = local[i];
+    }
+    
+    int misplaced = 0;
+    for (size_t i = 0; i < n; i++) {
+        const dsp_placement_t* e = &entries[i];
+        const char* region = memory_region(e->addr);
+        bool slow = esp_ptr_external_ram(e->addr) ||
+                    (e->code ? !esp_ptr_in_iram(e->addr) : !esp_ptr_internal(e->addr));
+        if (e->hot && slow) {
+            misplaced++;
+            ESP_LOGW(TAG, "  %-28s %-5s %6u B  (debería estar en %s)", e->name, region,
+                     (unsigned)e->bytes, e->code ? "IRAM" : "RAM interna");
+        } else {
+            ESP_LOGD(TAG, "  %-28s %-5s %6u B", e->name, region, (unsigned)e->bytes);
+        }
+    }
+    ESP_LOGI(TAG, "Colocación en memoria: %u entradas, %d calientes fuera de RAM interna",
+             (unsigned)n, misplaced);
+}
+
+// Preparar analizador y sesión para una nueva captura o flujo continuo
+static bool begin_capture(stft_stream_t* stft, fingerprint_session_t* session,
+                          stream_clock_t* clock, const pcm_block_t* block) {
+    dsp_params_t dsp_params = dsp_params_from_config(&audio_config);
+    fingerprint_params_t fp_params = fingerprint_params_from_config(&audio_config);
+    uint32_t epoch = stft->arena->epoch;
+    if (stft_stream_reset(stft, &dsp_params) != ESP_OK ||
+        fingerprint_session_reset(session, stft, &fp_params) != ESP_OK) {
+        ESP_LOGE(TAG, "Sin memoria para el contexto DSP");
+        return false;
+    }
+    if (stft->arena->epoch != epoch) {
+        if (stft->ctx->kernels.specialized != DSP_KERNELS_ALL) {
+            ESP_LOGI(TAG, "FFT %d, %d mel, %d MFCC sin núcleos especializados (0x%x)",
+                     dsp_params.fft_size, dsp_params.n_mels, dsp_params.n_mfcc,
+                     stft->ctx->kernels.specialized);
+        }
+        // Las tablas se repartieron de nuevo, quizá de otra región
+        memory_placement_report(stft, session);
+    }
+    stft->want_spectrum = (session->mode == FINGERPRINT_MODE_LANDMARKS);
+    stream_clock_reset(clock, stft->ctx->sample_rate);
+    // La configuración pudo cambiar entre captura y procesamiento
+    return block->format == stft->ctx->mode;
 }
 
-// Tarea de manejo de botones
-void button_task(void *pvParameters) {
-    static uint32_t last_button1_time = 0;
-    static uint32_t last_button2_time = 0;
-    const uint32_t debounce_time = 200; // ms
+// Tarea de procesamiento de audio: consumidor del ring PCM.
+// Analiza cada bloque a medida que llega, sin esperar a la captura completa.
+void audio_processing_task(void *pvParameters) {
+    static dsp_context_t dsp_ctx;
+    static stft_stream_t stft;
+    static fingerprint_session_t session;
+    static stream_clock_t clock;
+    bool capture_valid = false;
+    bool dsp_lock_held = false;   // CPU al máximo entre START y END
+    
+    stft_stream_init(&stft, &dsp_ctx, &hot_arena, fingerprint_session_on_frame, &session);
+    session.arena = &bulk_arena;
+#if AUDIO_PERF_ENABLE
+    dsp_set_span_hook(perf_dsp_span);
+#endif
+    
+    // Dimensionar las arenas ya con la configuración actual, antes de que
+    // el resto del sistema fragmente el heap
+    dsp_params_t dsp_params = dsp_params_from_config(&audio_config);
+    fingerprint_params_t fp_params = fingerprint_params_from_config(&audio_config);
+    if (stft_stream_reset(&stft, &dsp_params) != ESP_OK ||
+        fingerprint_session_reset(&session, &stft, &fp_params) != ESP_OK) {
+        ESP_LOGE(TAG, "Sin memoria para el analizador STFT");
+        vTaskDelete(NULL);
+        return;
+    }
+    memory_placement_report(&stft, &session);
+    
+    atomic_store(&pcm_ring.consumer, xTaskGetCurrentTaskHandle());
     
     while (1) {
-        uint32_t current_time = xTaskGetTickCount() * portTICK_PERIOD_MS;
+        pcm_block_t* block = pcm_ring_peek(&pcm_ring);
+        if (block == NULL) {
+            // Esperar a que la captura publique un bloque
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
         
-        // Leer botón 1
-        if (gpio_get_level(BUTTON_1_PIN) == 0) { // Activo bajo
-            if (current_time - last_button1_time > debounce_time) {
-                handle_button_press(BUTTON_1_PIN);
-                last_button1_time = current_time;
-                ESP_LOGI(TAG, "Botón 1 presionado");
+        if (block->flags & PCM_BLOCK_FLAG_START) {
+            if (!dsp_lock_held) {
+                pm_lock_take(pm_dsp_lock, true);
+                dsp_lock_held = true;
+            }
+            capture_valid = begin_capture(&stft, &session, &clock, block);
+        } else if (block->flags & PCM_BLOCK_FLAG_GAP) {
+            if (capture_valid && session.continuous) {
+                // Flujo continuo: descartar la ventana y seguir desde este bloque
+                ESP_LOGW(TAG, "Audio perdido (%lu bloques), reiniciando ventana",
+                         pcm_ring.overruns);
+                capture_valid = begin_capture(&stft, &session, &clock, block);
+            } else {
+                capture_valid = false;
             }
         }
         
-        // Leer botón 2
-        if (gpio_get_level(BUTTON_2_PIN) == 0) { // Activo bajo
-            if (current_time - last_button2_time > debounce_time) {
-                handle_button_press(BUTTON_2_PIN);
-                last_button2_time = current_time;
-                ESP_LOGI(TAG, "Botón 2 presionado");
-            }
+        // Carga del DSP para el planificador: análisis y fingerprints frente
+        // a la duración del audio
+        uint32_t busy_start = esp_cpu_get_ccount();
+        size_t length = block->length;
+        if (capture_valid) {
+            stream_clock_block(&clock, block);
+#if AUDIO_DSP_ENABLE_FIXED_POINT
+            if (block->format == DSP_MODE_FIXED) {
+                stft_stream_feed_q15(&stft, block->samples_q15, block->length);
+            } else
+#endif
+            stft_stream_feed(&stft, block->samples, block->length);
+        }
+        
+        uint8_t flags = block->flags;
+        pcm_ring_release(&pcm_ring);
+        
+        if (capture_valid && fingerprint_session_window_ready(&session)) {
+            process_capture(&stft, &session, stream_clock_window_end(&clock, &stft, &session));
+        }
+        if (capture_valid) {
+            quality_scheduler_note_load(esp_cpu_get_ccount() - busy_start, length);
         }
         
-        vTaskDelay(pdMS_TO_TICKS(50));
+        if (flags & PCM_BLOCK_FLAG_END) {
+            if (session.continuous) {
+                ESP_LOGI(TAG, "Flujo continuo finalizado");
+            } else if (capture_valid) {
+                process_capture(&stft, &session, stream_clock_window_end(&clock, &stft, &session));
+            } else {
+                ESP_LOGW(TAG, "Captura incompleta (%lu bloques perdidos), descartada",
+                         pcm_ring.overruns);
+            }
+            capture_valid = false;
+            if (dsp_lock_held) {
+                pm_lock_take(pm_dsp_lock, false);
+                dsp_lock_held = false;
+            }
+            
+            // Flujo cerrado: la captura puede reconfigurar el pipeline
+            atomic_fetch_add(&pipeline_streams_closed, 1);
+            if (capture_task_handle) {
+                xTaskNotifyGive(capture_task_handle);
+            }
+        }
     }
     
     vTaskDelete(NULL);
 }
 
-// Tarea de actualización de display
+// Tarea de actualización de display: única que escribe current_state y el
+// bus I2C. Consume eventos y redibuja a UI_FRAME_MS si algo cambió; sin
+// nada que dibujar duerme hasta el siguiente evento.
 void display_task(void *pvParameters) {
-    static system_state_t last_state = STATE_INIT;
-    static uint32_t last_samples = 0;
-    static uint32_t last_transmissions = 0;
+    bool redraw = true;
+    TickType_t next_frame = xTaskGetTickCount();
+    ui_event_t event;
     
     while (1) {
-        // Actualizar display solo si hay cambios
-        if (current_state != last_state || 
-            samples_processed != last_samples ||
-            transmissions_sent != last_transmissions) {
-            
-            update_display();
-            last_state = current_state;
-            last_samples = samples_processed;
-            last_transmissions = transmissions_sent;
+        TickType_t now = xTaskGetTickCount();
+        TickType_t wait = portMAX_DELAY;
+        if (redraw) {
+            wait = ((int32_t)(next_frame - now) > 0) ? next_frame - now : 0;
+        }
+        system_state_t previous = current_state;
+        
+        if (xQueueReceive(ui_queue, &event, wait) == pdTRUE) {
+            switch (event.type) {
+                case UI_EVENT_STATE:
+                    // El menú tiene prioridad sobre el estado del pipeline
+                    if (current_state != STATE_CONFIG && current_state != event.value) {
+                        current_state = event.value;
+                        redraw = true;
+                    }
+                    break;
+                case UI_EVENT_BUTTON:
+                    handle_button_press(event.value);
+                    redraw = true;
+                    break;
+                case UI_EVENT_BUTTON_LONG:
+                    handle_button_long_press(event.value);
+                    redraw = true;
+                    break;
+                case UI_EVENT_REFRESH:
+                    redraw = true;
+                    break;
+            }
+        }
+        // La captura espera a que el estado vuelva a permitir muestrear
+        if (current_state != previous && capture_task_handle) {
+            xTaskNotifyGive(capture_task_handle);
         }
         
-        vTaskDelay(pdMS_TO_TICKS(500));
+        now = xTaskGetTickCount();
+        if (!redraw || (int32_t)(now - next_frame) < 0) {
+            continue;   // Seguir agrupando eventos hasta el próximo frame
+        }
+        next_frame = now + pdMS_TO_TICKS(UI_FRAME_MS);
+        update_display();
+        redraw = false;
+        ssd1306_fb_flush(&display);
     }
     
     vTaskDelete(NULL);
 }
 
-// Tarea de sincronización de tiempo
-void time_sync_task(void *pvParameters) {
-    // Configurar SNTP
+// Sincronización de tiempo: lwIP consulta el servidor cada
+// CONFIG_LWIP_SNTP_UPDATE_DELAY y avisa en cada ajuste, sin tarea propia
+static void time_sync_notification(struct timeval* tv) {
+    struct tm timeinfo;
+    localtime_r(&tv->tv_sec, &timeinfo);
+    int64_t error_us = timebase_sync(&capture_timebase,
+                                     (int64_t)tv->tv_sec * 1000000 + tv->tv_usec);
+    ESP_LOGI(TAG, "Tiempo sincronizado: %04d-%02d-%02d %02d:%02d:%02d (%s de %lld ms)",
+             timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday,
+             timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec,
+             error_us == 0 ? "salto" : "corrección gradual", (long long)(error_us / 1000));
+}
+
+void time_sync_start(void) {
     sntp_setoperatingmode(SNTP_OPMODE_POLL);
     sntp_setservername(0, "pool.ntp.org");
+    sntp_set_time_sync_notification_cb(time_sync_notification);
     sntp_init();
-    
-    while (1) {
-        if (wifi_connected) {
-            time_t now;
-            struct tm timeinfo;
-            time(&now);
-            localtime_r(&now, &timeinfo);
-            
-            if (timeinfo.tm_year > (2020 - 1900)) {
-                ESP_LOGI(TAG, "Tiempo sincronizado: %04d-%02d-%02d %02d:%02d:%02d",
-                         timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday,
-                         timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec);
-            } else {
-                ESP_LOGW(TAG, "Tiempo no sincronizado, reintentando...");
-            }
-        }
-        
-        vTaskDelay(pdMS_TO_TICKS(3600000)); // Sincronizar cada hora
-    }
-    
-    vTaskDelete(NULL);
 }
 
 // Tarea de monitoreo del sistema
@@ -834,12 +3415,24 @@ void system_monitor_task(void *pvParameters) {
         // Monitorear estado de WiFi
         if (!wifi_connected && current_state != STATE_CONNECTING) {
             ESP_LOGW(TAG, "WiFi desconectado, reintentando...");
-            current_state = STATE_CONNECTING;
+            ui_post(UI_EVENT_STATE, STATE_CONNECTING);
         }
         
         // Estadísticas del sistema
-        ESP_LOGI(TAG, "Stats - Muestras: %lu, Enviadas: %lu, Memoria libre: %zu, Estado: %d",
-                 samples_processed, transmissions_sent, free_heap, current_state);
+        ESP_LOGI(TAG, "Stats - Muestras: %lu, Enviadas: %lu, En flash: %lu, Sondeos sin TV: %lu, "
+                 "Memoria libre: %zu, Estado: %d", samples_processed, transmissions_sent,
+                 fpstore.pending, capture_engine.probes_silent, free_heap, current_state);
+        
+        // Uso de las arenas y fragmentación de la RAM interna
+        const arena_t* arenas[] = { &hot_arena, &bulk_arena };
+        for (int i = 0; i < 2; i++) {
+            ESP_LOGI(TAG, "Arena %s: %u/%u bytes, máximo %u, %lu reservas",
+                     arenas[i]->name, (unsigned)arenas[i]->used, (unsigned)arenas[i]->capacity,
+                     (unsigned)arenas[i]->high_water, arenas[i]->grows);
+        }
+        ESP_LOGI(TAG, "RAM interna: bloque libre mayor %u, mínimo libre %u",
+                 (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL),
+                 (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL));
         
         vTaskDelay(pdMS_TO_TICKS(30000)); // Monitoreo cada 30 segundos
     }
@@ -865,67 +3458,93 @@ void save_config() {
     }
 }
 
-// Cargar configuración desde NVS
-void load_config() {
+// Cargar configuración desde NVS. Devuelve false si no había una válida.
+bool load_config() {
     nvs_handle_t nvs_handle;
+    audio_config_t stored;
+    bool loaded = false;
     esp_err_t err = nvs_open("audio_config", NVS_READONLY, &nvs_handle);
     if (err == ESP_OK) {
-        size_t required_size = sizeof(audio_config);
-        err = nvs_get_blob(nvs_handle, "config", &audio_config, &required_size);
-        if (err == ESP_OK) {
-            ESP_LOGI(TAG, "Configuración cargada desde NVS");
-        } else {
-            ESP_LOGI(TAG, "Usando configuración por defecto");
-        }
+        size_t required_size = sizeof(stored);
+        err = nvs_get_blob(nvs_handle, "config", &stored, &required_size);
+        loaded = (err == ESP_OK && required_size == sizeof(stored) && config_validate(&stored));
         nvs_close(nvs_handle);
     }
+    if (loaded) {
+        audio_config = stored;
+        ESP_LOGI(TAG, "Configuración cargada desde NVS");
+    } else {
+        ESP_LOGI(TAG, "Usando configuración por defecto");
+    }
+    return loaded;
 }
 
-// Aplicar configuración de calidad predefinida
-void apply_quality_preset() {
-    switch(audio_config.quality_level) {
+// Fijar en `config` los parámetros DSP del nivel `level` para su modo de
+// huella. En landmarks todos los niveles comparten el análisis del servidor
+// (DSP_LANDMARK_PRESET): el planificador sólo cambia el ritmo de captura y
+// los fingerprints siguen siendo comparables con el índice.
+void quality_analysis_fill(audio_config_t* config, uint8_t level) {
+    // Tabla compartida con los benchmarks de audio_dsp
+    const dsp_preset_t* preset = dsp_preset_analysis(level, config->fingerprint_mode);
+    if (preset) {
+        config->sample_rate = preset->sample_rate;
+        config->fft_size = preset->fft_size;
+        config->n_mels = preset->n_mels;
+        config->n_mfcc = preset->n_mfcc;
+        config->dsp_mode = preset->mode;
+    }
+}
+
+// Fijar en `config` los parámetros DSP y el ritmo de captura del preset
+// `level`, sin tocar quality_level
+void quality_preset_fill(audio_config_t* config, uint8_t level) {
+    quality_analysis_fill(config, level);
+    
+    // Ritmo de captura
+    switch(level) {
         case 1: // Básica - bajo consumo
-            audio_config.sample_rate = 8000;
-            audio_config.fft_size = 512;
-            audio_config.n_mels = 10;
-            audio_config.capture_duration = 15;
-            audio_config.capture_interval = 120;
+            config->capture_duration = 15;
+            config->capture_interval = 120;
+            config->capture_mode = CAPTURE_MODE_DUTY_CYCLE;
             break;
             
         case 2: // Baja
-            audio_config.sample_rate = 16000;
-            audio_config.fft_size = 512;
-            audio_config.n_mels = 12;
-            audio_config.capture_duration = 20;
-            audio_config.capture_interval = 90;
+            config->capture_duration = 20;
+            config->capture_interval = 90;
+            config->capture_mode = CAPTURE_MODE_DUTY_CYCLE;
             break;
             
         case 3: // Media (por defecto)
-            audio_config.sample_rate = 16000;
-            audio_config.fft_size = 1024;
-            audio_config.n_mels = 13;
-            audio_config.capture_duration = 30;
-            audio_config.capture_interval = 60;
+            config->capture_duration = 30;
+            config->capture_interval = 60;
+            config->capture_mode = CAPTURE_MODE_CONTINUOUS;
+            config->stream_window = 10;
+            config->stream_interval = 5;
             break;
             
         case 4: // Alta
-            audio_config.sample_rate = 22050;
-            audio_config.fft_size = 1024;
-            audio_config.n_mels = 15;
-            audio_config.capture_duration = 45;
-            audio_config.capture_interval = 45;
+            config->capture_duration = 45;
+            config->capture_interval = 45;
+            config->capture_mode = CAPTURE_MODE_CONTINUOUS;
+            config->stream_window = 8;
+            config->stream_interval = 4;
             break;
             
         case 5: // Máxima - mayor precisión
-            audio_config.sample_rate = 44100;
-            audio_config.fft_size = 2048;
-            audio_config.n_mels = 20;
-            audio_config.capture_duration = 60;
-            audio_config.capture_interval = 30;
+            config->capture_duration = 60;
+            config->capture_interval = 30;
+            config->capture_mode = CAPTURE_MODE_CONTINUOUS;
+            config->stream_window = 6;
+            config->stream_interval = 3;
             break;
     }
-    
-    ESP_LOGI(TAG, "Configuración de calidad %d aplicada", audio_config.quality_level);
+}
+
+// Aplicar a `config` el preset de su quality_level
+void apply_quality_preset(audio_config_t* config) {
+    quality_preset_fill(config, config->quality_level);
+    config->active_quality = config->quality_level;
+    ESP_LOGI(TAG, "Configuración de calidad %d aplicada", config->quality_level);
 }
 
 // ================================
@@ -936,8 +3555,6 @@ void app_main() {
     ESP_LOGI(TAG, "=== Sistema de Medición de Audiencia TV ===");
     ESP_LOGI(TAG, "Iniciando sistema...");
     
-    current_state = STATE_INIT;
-    
     // Inicializar NVS
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
@@ -946,9 +3563,12 @@ void app_main() {
     }
     ESP_ERROR_CHECK(ret);
     
-    // Cargar configuración
-    load_config();
-    apply_quality_preset();
+    // Cargar configuración; el preset sólo se aplica si no había una
+    // guardada, para no pisar ajustes del menú o remotos. Un preset del
+    // planificador no sobrevive al reinicio.
+    if (!load_config() || audio_config.active_quality != audio_config.quality_level) {
+        apply_quality_preset(&audio_config);
+    }
     
     // Inicializar hardware
     ESP_LOGI(TAG, "Inicializando hardware...");
@@ -956,14 +3576,26 @@ void app_main() {
     init_display();
     init_buttons();
     
+    // La pantalla se gestiona desde el principio por su propia tarea
+    ui_queue = xQueueCreate(UI_QUEUE_LEN, sizeof(ui_event_t));
+    xTaskCreatePinnedToCore(display_task, 
+                           "display_update", 
+                           4096, 
+                           NULL, 
+                           2, 
+                           NULL,
+                           0);
+    if (buttons_start() != ESP_OK) {
+        ESP_LOGE(TAG, "Error instalando interrupciones de botones");
+    }
+    
     // Mostrar pantalla inicial
-    update_display();
+    set_pipeline_state(STATE_INIT);
     vTaskDelay(pdMS_TO_TICKS(2000));
     
     // Inicializar WiFi
     ESP_LOGI(TAG, "Configurando WiFi...");
-    current_state = STATE_CONNECTING;
-    update_display();
+    set_pipeline_state(STATE_CONNECTING);
     init_wifi();
     
     // Esperar conexión WiFi
@@ -974,20 +3606,24 @@ void app_main() {
                         portMAX_DELAY);
     
     ESP_LOGI(TAG, "WiFi conectado exitosamente");
+    power_configure();
     
-    // Inicializar DSP
-    dsps_fft2r_init_fc32(NULL, CONFIG_DSP_MAX_FFT_SIZE);
+    // Registros pendientes de sesiones anteriores y cola de envío
+    fpstore_init(&fpstore);
+    uplink_queue = xQueueCreate(UPLINK_QUEUE_LEN, sizeof(uplink_item_t));
+    if (uplink_queue == NULL) {
+        ESP_LOGE(TAG, "Error creando cola de envío");
+        return;
+    }
     
-    // Crear cola para muestras de audio
-    audio_queue = xQueueCreate(3, sizeof(audio_sample_t));
-    if (audio_queue == NULL) {
-        ESP_LOGE(TAG, "Error creando cola de audio");
+    // Crear ring de bloques PCM entre captura y procesamiento
+    if (pcm_ring_init(&pcm_ring) != ESP_OK) {
+        ESP_LOGE(TAG, "Error creando ring de audio");
         return;
     }
     
     // Cambiar a estado de muestreo
-    current_state = STATE_SAMPLING;
-    update_display();
+    set_pipeline_state(STATE_SAMPLING);
     
     // Crear tareas
     ESP_LOGI(TAG, "Creando tareas del sistema...");
@@ -1008,29 +3644,15 @@ void app_main() {
                            NULL,
                            0); // Core 0
     
-    xTaskCreatePinnedToCore(button_task, 
-                           "button_handler", 
-                           2048, 
-                           NULL, 
-                           3, 
-                           NULL,
-                           0);
-    
-    xTaskCreatePinnedToCore(display_task, 
-                           "display_update", 
-                           4096, 
+    xTaskCreatePinnedToCore(uplink_task, 
+                           "uplink", 
+                           8192, 
                            NULL, 
-                           2, 
+                           3,  // Por debajo del DSP: TLS usa la CPU sobrante
                            NULL,
                            0);
     
-    xTaskCreatePinnedToCore(time_sync_task, 
-                           "time_sync", 
-                           4096, 
-                           NULL, 
-                           1, 
-                           NULL,
-                           0);
+    time_sync_start();
     
     xTaskCreatePinnedToCore(system_monitor_task, 
                            "system_monitor", 
@@ -1044,7 +3666,8 @@ void app_main() {
     ESP_LOGI(TAG, "Configuración actual:");
     ESP_LOGI(TAG, "- Sample Rate: %d Hz", audio_config.sample_rate);
     ESP_LOGI(TAG, "- FFT Size: %d puntos", audio_config.fft_size);
-    ESP_LOGI(TAG, "- MFCC Coefficients: %d", audio_config.n_mels);
+    ESP_LOGI(TAG, "- Bandas Mel: %d", audio_config.n_mels);
+    ESP_LOGI(TAG, "- MFCC Coefficients: %d", audio_config.n_mfcc);
     ESP_LOGI(TAG, "- Duración captura: %d seg", audio_config.capture_duration);
     ESP_LOGI(TAG, "- Intervalo: %d seg", audio_config.capture_interval);
     ESP_LOGI(TAG, "- Calidad: %d/5", audio_config.quality_level);
@@ -1052,10 +3675,8 @@ void app_main() {
     // Guardar configuración actual
     save_config();
     
-    // La tarea principal termina aquí, las otras tareas continúan ejecutándose
-    while(1) {
-        vTaskDelay(pdMS_TO_TICKS(10000));
-    }
+    // La tarea principal termina aquí (ESP-IDF la elimina al volver de
+    // app_main), las otras tareas continúan ejecutándose
 }
 
 //
\ No newline at end of file
@@ -0,0 +1,325 @@
+/*
+ * Benchmark del índice de referencia
+ *
+ * Indexa canales sintéticos con el pipeline DSP real, genera consultas
+ * como las de un dispositivo (ventanas de 10 s con ruido y otra ganancia,
+ * desalineadas respecto al salto) y mide aciertos y consultas/s con varios
+ * hilos mientras otro hilo sigue insertando al ritmo de la ingesta en vivo.
+ *
+ * Uso: match_bench [-c canales] [-d segundos] [-t hilos] [-s shards] [-n consultas]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "audio_dsp.h"
+#include "ref_index.h"
+
+#define BENCH_QUALITY        3
+#define BENCH_HOP_LENGTH     512
+#define BENCH_BLOCK_SAMPLES  1024
+#define BENCH_QUERY_SECONDS  10
+#define BENCH_BUCKET_SECONDS 10
+#define BENCH_SLACK_SECONDS  15   // Margen del servidor (-D) alrededor del timestamp
+#define BENCH_RUN_SECONDS    5
+
+static dsp_params_t params;
+static ref_index_t* index_ = NULL;
+static uint32_t n_channels = 32;
+static uint32_t seconds = 300;
+
+// ================================
+// SEÑAL
+// ================================
+
+static inline uint32_t mix(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+// Acordes de tres tonos que cambian cada 100 ms, distintos por canal
+static void channel_block(uint32_t channel, size_t start, float* out, size_t n) {
+    uint32_t rate = params.sample_rate;
+    for (size_t i = 0; i < n; i++) {
+        size_t s = start + i;
+        uint32_t segment = (uint32_t)(s / (rate / 10));
+        float t = (float)s / rate;
+        float v = 0.0f;
+        for (uint32_t k = 0; k < 3; k++) {
+            uint32_t h = mix(channel * 7919u + segment * 104729u + k);
+            float f = 300.0f + (h % 4000);
+            v += 0.2f * sinf(2.0f * (float)M_PI * f * t);
+        }
+        out[i] = v;
+    }
+}
+
+// ================================
+// INDEXADO Y CONSULTAS
+// ================================
+
+typedef struct {
+    dsp_context_t dsp;
+    arena_t arena;
+    arena_t bulk;
+    stft_stream_t stft;
+    landmark_extractor_t extractor;
+    fingerprint_session_t session;
+    uint16_t channel;
+} pipeline_t;
+
+static void index_on_frame(const stft_frame_t* frame, void* ctx) {
+    pipeline_t* p = ctx;
+    landmark_t landmarks[LANDMARK_MAX_PER_FRAME];
+    size_t n = landmark_extractor_frame(&p->extractor, frame, landmarks, LANDMARK_MAX_PER_FRAME);
+    ref_index_insert(index_, p->channel, 0, landmarks, n);
+}
+
+static void index_channel(pipeline_t* p, uint16_t channel) {
+    float block[BENCH_BLOCK_SAMPLES];
+    p->channel = channel;
+    dsp_context_free(&p->dsp);
+    stft_stream_init(&p->stft, &p->dsp, &p->arena, index_on_frame, p);
+    stft_stream_reset(&p->stft, &params);
+    p->stft.want_spectrum = true;
+    landmark_extractor_reset(&p->extractor);
+    size_t total = (size_t)params.sample_rate * seconds;
+    for (size_t i = 0; i < total; i += BENCH_BLOCK_SAMPLES) {
+        channel_block(channel, i, block, BENCH_BLOCK_SAMPLES);
+        stft_stream_feed(&p->stft, block, BENCH_BLOCK_SAMPLES);
+    }
+}
+
+typedef struct {
+    uint16_t channel;
+    uint32_t tick;             // Tick de referencia esperado para el frame 0
+    landmark_t* landmarks;
+    uint32_t n_landmarks;
+} query_t;
+
+// Ventana de un canal con otra ganancia y ruido, como la captaría el micrófono
+static void build_query(pipeline_t* p, query_t* q, uint32_t seed) {
+    fingerprint_params_t fp_params = {
+        .mode = FINGERPRINT_MODE_LANDMARKS,
+        .window_seconds = BENCH_QUERY_SECONDS,
+        .interval_seconds = BENCH_QUERY_SECONDS,
+        .noise_threshold = 0.0001f,
+    };
+    size_t window = (size_t)params.sample_rate * BENCH_QUERY_SECONDS;
+    size_t span = (size_t)params.sample_rate * seconds - window;
+    q->channel = mix(seed) % n_channels;
+    size_t start = mix(seed ^ 0x5bd1e995u) % span;
+    q->tick = (start + BENCH_HOP_LENGTH / 2) / BENCH_HOP_LENGTH;
+
+    dsp_context_free(&p->dsp);
+    stft_stream_init(&p->stft, &p->dsp, &p->arena, fingerprint_session_on_frame, &p->session);
+    p->session.arena = &p->bulk;
+    stft_stream_reset(&p->stft, &params);
+    fingerprint_session_reset(&p->session, &p->stft, &fp_params);
+    p->stft.want_spectrum = true;
+
+    float block[BENCH_BLOCK_SAMPLES];
+    uint32_t noise = seed;
+    for (size_t i = 0; i < window; i += BENCH_BLOCK_SAMPLES) {
+        size_t n = (window - i < BENCH_BLOCK_SAMPLES) ? window - i : BENCH_BLOCK_SAMPLES;
+        channel_block(q->channel, start + i, block, n);
+        for (size_t k = 0; k < n; k++) {
+            noise = noise * 1664525u + 1013904223u;
+            block[k] = 0.5f * block[k] + 0.02f * ((int32_t)noise >> 8) / 8388608.0f;
+        }
+        stft_stream_feed(&p->stft, block, n);
+    }
+    fingerprint_t fingerprint;
+    generate_fingerprint(&p->stft, &p->session, 0, &fingerprint);
+    q->n_landmarks = fingerprint.n_landmarks;
+    q->landmarks = malloc(q->n_landmarks * sizeof(landmark_t));
+    memcpy(q->landmarks, fingerprint.landmarks, q->n_landmarks * sizeof(landmark_t));
+}
+
+// Ventana de búsqueda del servidor para un dispositivo con el reloj en hora
+static void query_window(const query_t* q, uint32_t* min_tick, uint32_t* max_tick) {
+    uint32_t slack = BENCH_SLACK_SECONDS * params.sample_rate / BENCH_HOP_LENGTH;
+    uint32_t span = BENCH_QUERY_SECONDS * params.sample_rate / BENCH_HOP_LENGTH;
+    *min_tick = q->tick > slack ? q->tick - slack : 0;
+    *max_tick = q->tick + span + slack;
+}
+
+// ================================
+// CARGA
+// ================================
+
+static query_t* queries;
+static uint32_t n_queries = 256;
+static atomic_bool stop;
+static _Atomic uint64_t total_queries;
+
+static void* query_task(void* arg) {
+    uint32_t next = (uint32_t)(uintptr_t)arg;
+    ref_matcher_t* matcher = ref_matcher_create();
+    uint64_t done = 0;
+    ref_match_t match;
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        const query_t* q = &queries[next++ % n_queries];
+        uint32_t min_tick, max_tick;
+        query_window(q, &min_tick, &max_tick);
+        ref_index_match(index_, matcher, q->landmarks, q->n_landmarks, min_tick, max_tick, &match);
+        done++;
+    }
+    atomic_fetch_add(&total_queries, done);
+    ref_matcher_destroy(matcher);
+    return NULL;
+}
+
+// Inserciones al ritmo de la ingesta en vivo de todos los canales
+static void* insert_task(void* arg) {
+    (void)arg;
+    uint32_t per_second = n_channels * params.sample_rate / BENCH_HOP_LENGTH * LANDMARK_MAX_PER_FRAME;
+    uint32_t max_tick = (uint64_t)seconds * params.sample_rate / BENCH_HOP_LENGTH;
+    uint32_t seed = 1;
+    landmark_t lm;
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        for (uint32_t i = 0; i < per_second / 100; i++) {
+            seed = mix(seed + i);
+            lm.hash = seed;
+            lm.offset = seed % max_tick;
+            ref_index_insert(index_, seed % n_channels, 0, &lm, 1);
+        }
+        usleep(10000);
+    }
+    return NULL;
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char** argv) {
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int shards = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:t:s:n:")) != -1) {
+        switch (opt) {
+            case 'c': n_channels = atoi(optarg); break;
+            case 'd': seconds = atoi(optarg); break;
+            case 't': threads = atoi(optarg); break;
+            case 's': shards = atoi(optarg); break;
+            case 'n': n_queries = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Uso: %s [-c canales] [-d segundos] [-t hilos] [-s shards] "
+                        "[-n consultas]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (shards <= 0) {
+        shards = 1;
+        while (shards < 4 * threads && shards < REF_INDEX_MAX_SHARDS) shards <<= 1;
+    }
+    if (seconds <= BENCH_QUERY_SECONDS || n_channels == 0 || n_queries == 0) {
+        fprintf(stderr, "Se necesitan más de %d s de referencia\n", BENCH_QUERY_SECONDS);
+        return 1;
+    }
+
+    const dsp_preset_t* preset = dsp_preset_analysis(BENCH_QUALITY, FINGERPRINT_MODE_LANDMARKS);
+    params = (dsp_params_t){
+        .sample_rate = preset->sample_rate,
+        .fft_size = preset->fft_size,
+        .hop_length = BENCH_HOP_LENGTH,
+        .n_mels = preset->n_mels,
+        .n_mfcc = preset->n_mfcc,
+        .min_freq = 300.0f,
+        .max_freq = 8000.0f,
+        .mode = DSP_MODE_FLOAT,
+    };
+    uint32_t bucket_ticks = BENCH_BUCKET_SECONDS * params.sample_rate / BENCH_HOP_LENGTH;
+    ref_index_config_t config = {
+        .n_shards = shards,
+        .bucket_ticks = bucket_ticks,
+        .n_buckets = (seconds + BENCH_BUCKET_SECONDS - 1) / BENCH_BUCKET_SECONDS + 1,
+    };
+    index_ = ref_index_create(&config);
+    if (index_ == NULL) {
+        fprintf(stderr, "Configuración de índice no válida\n");
+        return 1;
+    }
+
+    static pipeline_t pipeline;
+    double t0 = now_s();
+    for (uint32_t c = 0; c < n_channels; c++) {
+        index_channel(&pipeline, c);
+    }
+    ref_index_stats_t stats;
+    ref_index_stats(index_, &stats);
+    printf("Indexado: %u canales x %u s en %.1f s, %llu entradas, %.1f MB\n",
+           n_channels, seconds, now_s() - t0, (unsigned long long)stats.postings,
+           stats.bytes / 1048576.0);
+
+    queries = calloc(n_queries, sizeof(query_t));
+    uint64_t landmarks = 0;
+    for (uint32_t i = 0; i < n_queries; i++) {
+        build_query(&pipeline, &queries[i], i + 1);
+        landmarks += queries[i].n_landmarks;
+    }
+
+    // Aciertos: canal correcto y desfase a un salto como mucho
+    ref_matcher_t* matcher = ref_matcher_create();
+    uint32_t correct = 0;
+    uint64_t votes = 0, runner_up = 0, hits = 0;
+    for (uint32_t i = 0; i < n_queries; i++) {
+        ref_match_t m;
+        uint32_t min_tick, max_tick;
+        query_window(&queries[i], &min_tick, &max_tick);
+        ref_index_match(index_, matcher, queries[i].landmarks, queries[i].n_landmarks,
+                        min_tick, max_tick, &m);
+        if (m.found && m.channel == queries[i].channel &&
+            llabs(m.tick - (int64_t)queries[i].tick) <= 1) {
+            correct++;
+        }
+        votes += m.votes;
+        runner_up += m.runner_up;
+        hits += m.hits;
+    }
+    ref_matcher_destroy(matcher);
+    printf("Consultas: %u de %.0f landmarks de media, %u/%u correctas, "
+           "votos %.1f (rival %.1f), %.0f entradas recorridas\n",
+           n_queries, (double)landmarks / n_queries, correct, n_queries,
+           (double)votes / n_queries, (double)runner_up / n_queries, (double)hits / n_queries);
+
+    pthread_t writer;
+    pthread_t* readers = calloc(threads, sizeof(pthread_t));
+    pthread_create(&writer, NULL, insert_task, NULL);
+    t0 = now_s();
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&readers[i], NULL, query_task, (void*)(uintptr_t)(i * 7919));
+    }
+    sleep(BENCH_RUN_SECONDS);
+    atomic_store(&stop, true);
+    for (int i = 0; i < threads; i++) {
+        pthread_join(readers[i], NULL);
+    }
+    pthread_join(writer, NULL);
+    double elapsed = now_s() - t0;
+    uint64_t total = atomic_load(&total_queries);
+    printf("Carga: %d hilos, %d shards, %.0f consultas/s (%.1f us por consulta y hilo)\n",
+           threads, shards, total / elapsed, elapsed * threads * 1e6 / total);
+
+    for (uint32_t i = 0; i < n_queries; i++) {
+        free(queries[i].landmarks);
+    }
+    free(queries);
+    free(readers);
+    ref_index_destroy(index_);
+    return correct == n_queries ? 0 : 1;
+}
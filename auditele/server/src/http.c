@@ -0,0 +1,428 @@
+/*
+ * Servidor HTTP/1.1 mínimo para las consultas de los dispositivos
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "http.h"
+#include "log.h"
+
+static const char *TAG = "HTTP";
+
+#define HTTP_MAX_HEADER    16384
+#define HTTP_MAX_EVENTS    256
+#define HTTP_READ_CHUNK    16384
+
+typedef struct {
+    int fd;
+    uint8_t* in;
+    size_t in_len;
+    size_t in_cap;
+    char* out;
+    size_t out_len;
+    size_t out_sent;
+    size_t out_cap;
+    bool close_after;          // Cerrar al terminar de escribir
+    bool continue_sent;        // Ya se respondió "100 Continue" a la petición en curso
+    bool want_write;           // Registrado con EPOLLOUT
+} http_conn_t;
+
+typedef struct {
+    int index;
+    uint16_t port;
+    http_handler_t handler;
+    void* worker;
+    http_response_t resp;
+    int epfd;
+} http_worker_t;
+
+// ================================
+// RESPUESTAS
+// ================================
+
+static bool buffer_reserve(char** buf, size_t* cap, size_t needed) {
+    if (needed <= *cap) {
+        return true;
+    }
+    size_t cap_new = *cap ? *cap : 4096;
+    while (cap_new < needed) {
+        cap_new *= 2;
+    }
+    char* p = realloc(*buf, cap_new);
+    if (p == NULL) {
+        return false;
+    }
+    *buf = p;
+    *cap = cap_new;
+    return true;
+}
+
+void http_response_printf(http_response_t* resp, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    if (n < 0 || !buffer_reserve(&resp->body, &resp->capacity, resp->len + n + 1)) {
+        return;
+    }
+    va_start(args, fmt);
+    vsnprintf(resp->body + resp->len, n + 1, fmt, args);
+    va_end(args);
+    resp->len += n;
+}
+
+static const char* status_text(int status) {
+    switch (status) {
+        case 100: return "Continue";
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 413: return "Payload Too Large";
+        case 415: return "Unsupported Media Type";
+        case 422: return "Unprocessable Entity";
+        case 431: return "Request Header Fields Too Large";
+        case 501: return "Not Implemented";
+        default:  return "Internal Server Error";
+    }
+}
+
+static void conn_queue(http_conn_t* conn, int status, const char* content_type,
+                       const char* body, size_t len) {
+    char head[256];
+    int n = snprintf(head, sizeof(head),
+                     "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+                     "Connection: %s\r\n\r\n",
+                     status, status_text(status), content_type, len,
+                     conn->close_after ? "close" : "keep-alive");
+    if (!buffer_reserve(&conn->out, &conn->out_cap, conn->out_len + n + len)) {
+        conn->close_after = true;
+        return;
+    }
+    memcpy(conn->out + conn->out_len, head, n);
+    memcpy(conn->out + conn->out_len + n, body, len);
+    conn->out_len += n + len;
+}
+
+static void conn_error(http_conn_t* conn, int status) {
+    char body[64];
+    int n = snprintf(body, sizeof(body), "{\"error\":\"%s\"}", status_text(status));
+    conn->close_after = true;
+    conn_queue(conn, status, "application/json", body, n);
+}
+
+// ================================
+// PARSER
+// ================================
+
+typedef enum {
+    PARSE_INCOMPLETE,
+    PARSE_OK,
+    PARSE_ERROR
+} parse_result_t;
+
+typedef struct {
+    char method[8];
+    char path[256];
+    char content_type[64];
+    size_t header_len;
+    size_t content_length;
+    bool close;
+    bool expect_continue;
+    int error;                 // Estado HTTP si PARSE_ERROR
+} parsed_request_t;
+
+static void copy_span(char* dst, size_t size, const char* src, size_t len) {
+    if (len >= size) {
+        len = size - 1;
+    }
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+static bool header_is(const char* name, size_t len, const char* expected) {
+    return len == strlen(expected) && strncasecmp(name, expected, len) == 0;
+}
+
+// Analizar la cabecera sin modificar el buffer: al llegar más datos se
+// vuelve a empezar desde el principio
+static parse_result_t parse_request(const http_conn_t* conn, parsed_request_t* req) {
+    memset(req, 0, sizeof(*req));
+    const char* data = (const char*)conn->in;
+    const char* end = memmem(data, conn->in_len, "\r\n\r\n", 4);
+    if (end == NULL) {
+        if (conn->in_len > HTTP_MAX_HEADER) {
+            req->error = 431;
+            return PARSE_ERROR;
+        }
+        return PARSE_INCOMPLETE;
+    }
+    req->header_len = end - data + 4;
+
+    // Línea de petición: MÉTODO RUTA HTTP/1.x
+    const char* line_end = memmem(data, end - data + 2, "\r\n", 2);
+    const char* sp1 = memchr(data, ' ', line_end - data);
+    const char* sp2 = sp1 ? memchr(sp1 + 1, ' ', line_end - sp1 - 1) : NULL;
+    if (sp2 == NULL || line_end - sp2 < 9 || strncmp(sp2 + 1, "HTTP/1.", 7)) {
+        req->error = 400;
+        return PARSE_ERROR;
+    }
+    copy_span(req->method, sizeof(req->method), data, sp1 - data);
+    copy_span(req->path, sizeof(req->path), sp1 + 1, sp2 - sp1 - 1);
+    req->close = (sp2[8] == '0');
+
+    for (const char* line = line_end + 2; line < end; ) {
+        const char* next = memmem(line, end + 2 - line, "\r\n", 2);
+        const char* colon = memchr(line, ':', next - line);
+        if (colon) {
+            const char* value = colon + 1;
+            while (value < next && (*value == ' ' || *value == '\t')) value++;
+            size_t name_len = colon - line, value_len = next - value;
+            if (header_is(line, name_len, "Content-Length")) {
+                req->content_length = strtoul(value, NULL, 10);
+            } else if (header_is(line, name_len, "Content-Type")) {
+                copy_span(req->content_type, sizeof(req->content_type), value, value_len);
+            } else if (header_is(line, name_len, "Connection")) {
+                if (value_len == 5 && !strncasecmp(value, "close", 5)) req->close = true;
+                if (value_len == 10 && !strncasecmp(value, "keep-alive", 10)) req->close = false;
+            } else if (header_is(line, name_len, "Expect")) {
+                req->expect_continue = (value_len == 12 && !strncasecmp(value, "100-continue", 12));
+            } else if (header_is(line, name_len, "Transfer-Encoding")) {
+                req->error = 501;
+                return PARSE_ERROR;
+            }
+        }
+        line = next + 2;
+    }
+
+    if (req->header_len + req->content_length > HTTP_MAX_REQUEST) {
+        req->error = 413;
+        return PARSE_ERROR;
+    }
+    return (conn->in_len >= req->header_len + req->content_length) ? PARSE_OK : PARSE_INCOMPLETE;
+}
+
+// ================================
+// CONEXIONES
+// ================================
+
+static void conn_close(http_worker_t* w, http_conn_t* conn) {
+    epoll_ctl(w->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    free(conn->in);
+    free(conn->out);
+    free(conn);
+}
+
+// Escribir lo pendiente; false si la conexión se cerró
+static bool conn_flush(http_worker_t* w, http_conn_t* conn) {
+    while (conn->out_sent < conn->out_len) {
+        ssize_t n = send(conn->fd, conn->out + conn->out_sent, conn->out_len - conn->out_sent,
+                         MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            conn_close(w, conn);
+            return false;
+        }
+        conn->out_sent += n;
+    }
+
+    bool pending = conn->out_sent < conn->out_len;
+    if (!pending) {
+        conn->out_len = conn->out_sent = 0;
+        if (conn->close_after) {
+            conn_close(w, conn);
+            return false;
+        }
+    }
+    if (pending != conn->want_write) {
+        struct epoll_event ev = {
+            .events = EPOLLIN | EPOLLRDHUP | (pending ? EPOLLOUT : 0),
+            .data.ptr = conn
+        };
+        epoll_ctl(w->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+        conn->want_write = pending;
+    }
+    return true;
+}
+
+// Atender todas las peticiones completas del buffer (admite pipelining)
+static void conn_process(http_worker_t* w, http_conn_t* conn) {
+    while (!conn->close_after) {
+        parsed_request_t parsed;
+        parse_result_t r = parse_request(conn, &parsed);
+        if (r == PARSE_ERROR) {
+            conn_error(conn, parsed.error);
+            break;
+        }
+        if (r == PARSE_INCOMPLETE) {
+            if (parsed.header_len && parsed.expect_continue && !conn->continue_sent) {
+                static const char cont[] = "HTTP/1.1 100 Continue\r\n\r\n";
+                if (buffer_reserve(&conn->out, &conn->out_cap, conn->out_len + sizeof(cont))) {
+                    memcpy(conn->out + conn->out_len, cont, sizeof(cont) - 1);
+                    conn->out_len += sizeof(cont) - 1;
+                }
+                conn->continue_sent = true;
+            }
+            break;
+        }
+
+        http_request_t req = {
+            .method = parsed.method,
+            .path = parsed.path,
+            .content_type = parsed.content_type,
+            .body = conn->in + parsed.header_len,
+            .body_len = parsed.content_length,
+        };
+        http_response_t* resp = &w->resp;
+        resp->status = 200;
+        resp->content_type = "application/json";
+        resp->len = 0;
+        w->handler(&req, resp, w->worker);
+
+        conn->close_after = parsed.close;
+        conn_queue(conn, resp->status, resp->content_type, resp->body ? resp->body : "", resp->len);
+        conn->continue_sent = false;
+
+        size_t used = parsed.header_len + parsed.content_length;
+        memmove(conn->in, conn->in + used, conn->in_len - used);
+        conn->in_len -= used;
+    }
+}
+
+static void conn_read(http_worker_t* w, http_conn_t* conn) {
+    while (1) {
+        if (!buffer_reserve((char**)&conn->in, &conn->in_cap, conn->in_len + HTTP_READ_CHUNK)) {
+            conn_close(w, conn);
+            return;
+        }
+        ssize_t n = recv(conn->fd, conn->in + conn->in_len, conn->in_cap - conn->in_len, 0);
+        if (n > 0) {
+            conn->in_len += n;
+            if (conn->in_len > HTTP_MAX_REQUEST + HTTP_MAX_HEADER) {
+                break;
+            }
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (n < 0) {
+            conn_close(w, conn);
+            return;
+        }
+        // El cliente cerró su lado: responder lo recibido y cerrar
+        conn_process(w, conn);
+        conn->close_after = true;
+        conn_flush(w, conn);
+        return;
+    }
+    conn_process(w, conn);
+    conn_flush(w, conn);
+}
+
+static int listen_socket(uint16_t port) {
+    int fd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int one = 1, zero = 0;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+    struct sockaddr_in6 addr = {
+        .sin6_family = AF_INET6,
+        .sin6_port = htons(port),
+        .sin6_addr = IN6ADDR_ANY_INIT
+    };
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 1024) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void* http_worker_task(void* arg) {
+    http_worker_t* w = arg;
+    int lfd = listen_socket(w->port);
+    w->epfd = epoll_create1(0);
+    if (lfd < 0 || w->epfd < 0) {
+        SRV_LOGE(TAG, "Worker %d: no se pudo escuchar en el puerto %u: %s",
+                 w->index, w->port, strerror(errno));
+        exit(1);
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    epoll_ctl(w->epfd, EPOLL_CTL_ADD, lfd, &ev);
+
+    struct epoll_event events[HTTP_MAX_EVENTS];
+    while (1) {
+        int n = epoll_wait(w->epfd, events, HTTP_MAX_EVENTS, -1);
+        for (int i = 0; i < n; i++) {
+            http_conn_t* conn = events[i].data.ptr;
+            if (conn == NULL) {
+                int fd;
+                while ((fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+                    int one = 1;
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    http_conn_t* c = calloc(1, sizeof(*c));
+                    if (c == NULL) {
+                        close(fd);
+                        continue;
+                    }
+                    c->fd = fd;
+                    struct epoll_event cev = { .events = EPOLLIN | EPOLLRDHUP, .data.ptr = c };
+                    epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &cev);
+                }
+                continue;
+            }
+            if (events[i].events & EPOLLERR) {
+                conn_close(w, conn);
+                continue;
+            }
+            if ((events[i].events & EPOLLOUT) && !conn_flush(w, conn)) {
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+                conn_read(w, conn);
+            }
+        }
+    }
+    return NULL;
+}
+
+bool http_serve(uint16_t port, int n_workers, http_handler_t handler,
+                http_worker_init_t worker_init, void* ctx) {
+    http_worker_t* workers = calloc(n_workers, sizeof(http_worker_t));
+    pthread_t* threads = calloc(n_workers, sizeof(pthread_t));
+    if (workers == NULL || threads == NULL) {
+        return false;
+    }
+    for (int i = 0; i < n_workers; i++) {
+        workers[i].index = i;
+        workers[i].port = port;
+        workers[i].handler = handler;
+        workers[i].worker = worker_init ? worker_init(i, ctx) : ctx;
+        if (pthread_create(&threads[i], NULL, http_worker_task, &workers[i]) != 0) {
+            SRV_LOGE(TAG, "No se pudo crear el worker %d", i);
+            return false;
+        }
+        pthread_setname_np(threads[i], "http");
+    }
+    SRV_LOGI(TAG, "Escuchando en el puerto %u con %d workers", port, n_workers);
+    for (int i = 0; i < n_workers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    return true;
+}
@@ -0,0 +1,47 @@
+/*
+ * Servidor HTTP/1.1 mínimo para las consultas de los dispositivos
+ *
+ * Un hilo por core con su propio socket de escucha (SO_REUSEPORT) y su
+ * bucle epoll: el kernel reparte las conexiones y ningún estado se comparte
+ * entre hilos. Conexiones persistentes, cuerpos con Content-Length y sin
+ * TLS (se termina en un proxy delante).
+ */
+
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define HTTP_MAX_REQUEST  (4 * 1024 * 1024)
+
+typedef struct {
+    const char* method;
+    const char* path;
+    const char* content_type;  // "" si no se envió
+    const uint8_t* body;
+    size_t body_len;
+} http_request_t;
+
+typedef struct {
+    int status;
+    const char* content_type;
+    char* body;
+    size_t len;
+    size_t capacity;
+} http_response_t;
+
+// Añadir texto al cuerpo de la respuesta
+void http_response_printf(http_response_t* resp, const char* fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// `worker` es lo que devolvió worker_init en el hilo que atiende la petición
+typedef void (*http_handler_t)(const http_request_t* req, http_response_t* resp, void* worker);
+typedef void* (*http_worker_init_t)(int worker_index, void* ctx);
+
+// Atender peticiones en `port` con n_workers hilos; no vuelve salvo error
+bool http_serve(uint16_t port, int n_workers, http_handler_t handler,
+                http_worker_init_t worker_init, void* ctx);
+
+#endif // HTTP_H
@@ -0,0 +1,243 @@
+/*
+ * Ingesta continua de los canales de referencia
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "ingest.h"
+#include "log.h"
+
+static const char *TAG = "INGEST";
+
+#define INGEST_BLOCK_SAMPLES   1024
+#define INGEST_RESTART_DELAY   5      // Segundos antes de relanzar un comando
+#define INGEST_MAX_DRIFT       2      // Segundos de desfase del flujo con el reloj
+
+// ================================
+// RELOJ
+// ================================
+
+static int64_t clock_us(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void timebase_init(timebase_t* tb, uint32_t sample_rate, uint16_t hop_length) {
+    tb->start_us = clock_us(CLOCK_REALTIME);
+    tb->mono_start_us = clock_us(CLOCK_MONOTONIC);
+    tb->sample_rate = sample_rate;
+    tb->hop_length = hop_length;
+}
+
+uint32_t timebase_now_tick(const timebase_t* tb) {
+    int64_t elapsed = clock_us(CLOCK_MONOTONIC) - tb->mono_start_us;
+    return (uint32_t)(elapsed * tb->sample_rate / ((int64_t)tb->hop_length * 1000000));
+}
+
+int64_t timebase_tick_to_us(const timebase_t* tb, int64_t tick) {
+    return tb->start_us + tick * tb->hop_length * 1000000 / tb->sample_rate;
+}
+
+// Inversa de timebase_tick_to_us; negativo antes del arranque
+int64_t timebase_us_to_tick(const timebase_t* tb, int64_t us) {
+    return (us - tb->start_us) * tb->sample_rate / ((int64_t)tb->hop_length * 1000000);
+}
+
+int64_t timebase_ticks(const timebase_t* tb, uint32_t seconds) {
+    return (int64_t)seconds * tb->sample_rate / tb->hop_length;
+}
+
+// ================================
+// CONFIGURACIÓN
+// ================================
+
+int channels_load(const char* path, channel_config_t* channels, int max) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        SRV_LOGE(TAG, "No se puede abrir %s", path);
+        return -1;
+    }
+    char line[CHANNEL_NAME_LEN + CHANNEL_COMMAND_LEN + 2];
+    int n = 0;
+    while (n < max && fgets(line, sizeof(line), f)) {
+        char* p = line;
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == '\0' || *p == '#') {
+            continue;
+        }
+        char* end = p + strlen(p);
+        while (end > p && isspace((unsigned char)end[-1])) *--end = '\0';
+
+        char* name_end = p;
+        while (*name_end && !isspace((unsigned char)*name_end)) name_end++;
+        char* command = name_end;
+        while (isspace((unsigned char)*command)) command++;
+        *name_end = '\0';
+        if (*command == '\0') {
+            SRV_LOGW(TAG, "%s: canal %s sin comando", path, p);
+            continue;
+        }
+        snprintf(channels[n].name, sizeof(channels[n].name), "%s", p);
+        snprintf(channels[n].command, sizeof(channels[n].command), "%s", command);
+        n++;
+    }
+    fclose(f);
+    return n;
+}
+
+// ================================
+// HILOS DE CANAL
+// ================================
+
+typedef struct {
+    int id;
+    channel_config_t config;
+    ref_index_t* index;
+    const dsp_params_t* params;
+    const timebase_t* tb;
+
+    arena_t arena;
+    dsp_context_t dsp;
+    stft_stream_t stft;
+    landmark_extractor_t extractor;
+    uint32_t tick0;            // Tick del frame 0 del flujo actual
+
+    _Atomic uint64_t samples;
+    _Atomic uint64_t landmarks;
+    _Atomic uint32_t restarts;
+    atomic_bool running;
+    pthread_t thread;
+} channel_t;
+
+static channel_t* channels = NULL;
+static int n_channels = 0;
+
+static void channel_on_frame(const stft_frame_t* frame, void* ctx) {
+    channel_t* ch = ctx;
+    landmark_t landmarks[LANDMARK_MAX_PER_FRAME];
+    size_t n = landmark_extractor_frame(&ch->extractor, frame, landmarks, LANDMARK_MAX_PER_FRAME);
+    if (n > 0) {
+        ref_index_insert(ch->index, ch->id, ch->tick0, landmarks, n);
+        atomic_fetch_add_explicit(&ch->landmarks, n, memory_order_relaxed);
+    }
+}
+
+// Empezar un flujo nuevo con el frame 0 en el tick actual
+static bool channel_restart_stream(channel_t* ch) {
+    if (stft_stream_reset(&ch->stft, ch->params) != ESP_OK) {
+        return false;
+    }
+    ch->stft.want_spectrum = true;
+    landmark_extractor_reset(&ch->extractor);
+    ch->tick0 = timebase_now_tick(ch->tb);
+    return true;
+}
+
+static void* channel_task(void* arg) {
+    channel_t* ch = arg;
+    int16_t block[INGEST_BLOCK_SAMPLES];
+    float block_f[INGEST_BLOCK_SAMPLES];
+    int64_t max_drift = timebase_ticks(ch->tb, INGEST_MAX_DRIFT);
+    size_t check_every = ch->params->sample_rate;
+    bool fixed = (ch->params->mode == DSP_MODE_FIXED);
+
+    while (1) {
+        FILE* pipe = popen(ch->config.command, "r");
+        if (pipe == NULL) {
+            SRV_LOGE(TAG, "Canal %s: no se pudo lanzar el comando", ch->config.name);
+            sleep(INGEST_RESTART_DELAY);
+            continue;
+        }
+        if (!channel_restart_stream(ch)) {
+            SRV_LOGE(TAG, "Canal %s: sin memoria para el analizador", ch->config.name);
+            pclose(pipe);
+            return NULL;
+        }
+        atomic_store(&ch->running, true);
+        SRV_LOGI(TAG, "Canal %s: flujo iniciado en el tick %u", ch->config.name, ch->tick0);
+
+        size_t n, since_check = 0;
+        while ((n = fread(block, sizeof(int16_t), INGEST_BLOCK_SAMPLES, pipe)) > 0) {
+            if (fixed) {
+                stft_stream_feed_q15(&ch->stft, block, n);
+            } else {
+                for (size_t i = 0; i < n; i++) {
+                    block_f[i] = block[i] / 32768.0f;
+                }
+                stft_stream_feed(&ch->stft, block_f, n);
+            }
+            atomic_fetch_add_explicit(&ch->samples, n, memory_order_relaxed);
+
+            // Un flujo que se adelanta o atrasa respecto al reloj dejaría de
+            // coincidir con las consultas: volver a anclarlo
+            since_check += n;
+            if (since_check >= check_every) {
+                since_check = 0;
+                int64_t drift = (int64_t)timebase_now_tick(ch->tb) -
+                                ((int64_t)ch->tick0 + ch->stft.n_frames);
+                if (drift > max_drift || drift < -max_drift) {
+                    SRV_LOGW(TAG, "Canal %s: desfase de %lld ticks, reanclando",
+                             ch->config.name, (long long)drift);
+                    channel_restart_stream(ch);
+                }
+            }
+        }
+
+        atomic_store(&ch->running, false);
+        atomic_fetch_add(&ch->restarts, 1);
+        int status = pclose(pipe);
+        SRV_LOGW(TAG, "Canal %s: el comando terminó (estado %d), relanzando en %d s",
+                 ch->config.name, status, INGEST_RESTART_DELAY);
+        sleep(INGEST_RESTART_DELAY);
+    }
+    return NULL;
+}
+
+bool ingest_start(ref_index_t* index, const dsp_params_t* params, const timebase_t* tb,
+                  const channel_config_t* configs, int count) {
+    channels = calloc(count, sizeof(channel_t));
+    if (channels == NULL) {
+        return false;
+    }
+    for (int i = 0; i < count; i++) {
+        channel_t* ch = &channels[i];
+        ch->id = i;
+        ch->config = configs[i];
+        ch->index = index;
+        ch->params = params;
+        ch->tb = tb;
+        ch->arena.name = ch->config.name;
+        stft_stream_init(&ch->stft, &ch->dsp, &ch->arena, channel_on_frame, ch);
+        if (pthread_create(&ch->thread, NULL, channel_task, ch) != 0) {
+            SRV_LOGE(TAG, "No se pudo crear el hilo del canal %s", ch->config.name);
+            return false;
+        }
+        pthread_setname_np(ch->thread, "ingest");
+        n_channels++;
+    }
+    return true;
+}
+
+void ingest_channel_stats(int channel, channel_stats_t* stats) {
+    channel_t* ch = &channels[channel];
+    stats->samples = atomic_load_explicit(&ch->samples, memory_order_relaxed);
+    stats->landmarks = atomic_load_explicit(&ch->landmarks, memory_order_relaxed);
+    stats->restarts = atomic_load(&ch->restarts);
+    stats->running = atomic_load(&ch->running);
+}
+
+const char* ingest_channel_name(int channel) {
+    return (channel >= 0 && channel < n_channels) ? channels[channel].config.name : NULL;
+}
+
+int ingest_channel_count(void) {
+    return n_channels;
+}
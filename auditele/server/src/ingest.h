@@ -0,0 +1,59 @@
+/*
+ * Ingesta continua de los canales de referencia
+ *
+ * Cada canal es un comando (normalmente ffmpeg) que escribe PCM s16le mono
+ * a la frecuencia del índice por la salida estándar. Un hilo por canal lo
+ * pasa por el mismo pipeline DSP que el dispositivo y añade los landmarks
+ * al índice.
+ */
+
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "audio_dsp.h"
+#include "ref_index.h"
+
+#define CHANNEL_NAME_LEN     32
+#define CHANNEL_COMMAND_LEN  1024
+#define MAX_CHANNELS         256
+
+// Reloj común de los ticks: tick 0 = arranque del servidor
+typedef struct {
+    int64_t start_us;          // Hora UTC del arranque (microsegundos)
+    int64_t mono_start_us;     // CLOCK_MONOTONIC en el arranque
+    uint32_t sample_rate;
+    uint16_t hop_length;
+} timebase_t;
+
+void timebase_init(timebase_t* tb, uint32_t sample_rate, uint16_t hop_length);
+uint32_t timebase_now_tick(const timebase_t* tb);
+int64_t timebase_tick_to_us(const timebase_t* tb, int64_t tick);
+int64_t timebase_us_to_tick(const timebase_t* tb, int64_t us);
+int64_t timebase_ticks(const timebase_t* tb, uint32_t seconds);
+
+typedef struct {
+    char name[CHANNEL_NAME_LEN];
+    char command[CHANNEL_COMMAND_LEN];
+} channel_config_t;
+
+// Leer "nombre comando..." por línea; '#' inicia un comentario
+int channels_load(const char* path, channel_config_t* channels, int max);
+
+typedef struct {
+    uint64_t samples;          // Muestras procesadas
+    uint64_t landmarks;        // Landmarks añadidos al índice
+    uint32_t restarts;         // Veces que hubo que relanzar el comando
+    bool running;              // El comando está entregando audio
+} channel_stats_t;
+
+// Lanzar un hilo por canal. `params` y `tb` deben seguir vivos.
+bool ingest_start(ref_index_t* index, const dsp_params_t* params, const timebase_t* tb,
+                  const channel_config_t* channels, int n_channels);
+
+void ingest_channel_stats(int channel, channel_stats_t* stats);
+const char* ingest_channel_name(int channel);
+int ingest_channel_count(void);
+
+#endif // INGEST_H
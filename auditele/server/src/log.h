@@ -0,0 +1,31 @@
+/*
+ * Registro con el mismo formato que ESP_LOGx: "I (ms) TAG: mensaje"
+ */
+
+#ifndef SRV_LOG_H
+#define SRV_LOG_H
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+
+static inline void srv_log(char level, const char* tag, const char* fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static inline void srv_log(char level, const char* tag, const char* fmt, ...) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    char line[512];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    fprintf(stderr, "%c (%lld) %s: %s\n", level,
+            (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000, tag, line);
+}
+
+#define SRV_LOGE(tag, fmt, ...)  srv_log('E', tag, fmt, ##__VA_ARGS__)
+#define SRV_LOGW(tag, fmt, ...)  srv_log('W', tag, fmt, ##__VA_ARGS__)
+#define SRV_LOGI(tag, fmt, ...)  srv_log('I', tag, fmt, ##__VA_ARGS__)
+
+#endif // SRV_LOG_H
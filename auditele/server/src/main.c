@@ -0,0 +1,385 @@
+/*
+ * Servidor de matching de fingerprints de audiencia televisiva
+ *
+ * Indexa de forma continua los canales de referencia con el mismo pipeline
+ * DSP que el ESP32 y responde a los lotes de los dispositivos (formato
+ * binario de audimeter_wire.h) con el canal reconocido en cada fingerprint.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include "audio_dsp.h"
+#include "audimeter_wire.h"
+#include "ref_index.h"
+#include "ingest.h"
+#include "http.h"
+#include "log.h"
+
+static const char *TAG = "MATCHER";
+
+// ================================
+// CONFIGURACIÓN
+// ================================
+
+typedef struct {
+    const char* channels_path;
+    uint16_t port;
+    int workers;               // Hilos HTTP (0 = uno por core)
+    int shards;                // Shards del índice (0 = 4 por core)
+    uint8_t quality_level;     // Preset DSP de los dispositivos
+    uint16_t hop_length;
+    float min_freq;
+    float max_freq;
+    uint32_t retention;        // Segundos de referencia consultables
+    uint32_t bucket_seconds;   // Granularidad de la expulsión
+    uint32_t window_slack;     // Segundos de margen alrededor del timestamp del dispositivo
+    uint32_t min_votes;        // Coincidencias mínimas para aceptar un canal
+} server_config_t;
+
+static server_config_t config = {
+    .port = 8080,
+    .quality_level = 3,
+    .hop_length = 512,
+    .min_freq = 300.0f,
+    .max_freq = 8000.0f,
+    .retention = 300,
+    .bucket_seconds = 10,
+    .window_slack = 15,
+    .min_votes = 8,
+};
+
+// ================================
+// ESTADO
+// ================================
+
+typedef struct {
+    ref_matcher_t* matcher;
+    landmark_t* query;         // Copia alineada del payload
+    _Atomic uint64_t requests;
+    _Atomic uint64_t fingerprints;
+    _Atomic uint64_t matched;
+} worker_t;
+
+static ref_index_t* ref_index = NULL;
+static dsp_params_t dsp_params;
+static timebase_t timebase;
+static uint32_t retention_ticks;
+static uint32_t slack_ticks;
+static worker_t* workers = NULL;
+static int n_workers = 0;
+
+#define QUERY_MAX_LANDMARKS  65536
+
+static void* worker_init(int index, void* ctx) {
+    (void)ctx;
+    worker_t* w = &workers[index];
+    w->matcher = ref_matcher_create();
+    w->query = malloc(QUERY_MAX_LANDMARKS * sizeof(landmark_t));
+    if (w->matcher == NULL || w->query == NULL) {
+        SRV_LOGE(TAG, "Sin memoria para el worker %d", index);
+        exit(1);
+    }
+    return w;
+}
+
+// ================================
+// API
+// ================================
+
+// Cadena JSON con los caracteres no imprimibles escapados
+static void json_string(http_response_t* resp, const char* s, size_t max) {
+    http_response_printf(resp, "\"");
+    for (size_t i = 0; i < max && s[i]; i++) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') {
+            http_response_printf(resp, "\\%c", c);
+        } else if (c < 0x20 || c >= 0x7f) {
+            http_response_printf(resp, "\\u%04x", c);
+        } else {
+            http_response_printf(resp, "%c", c);
+        }
+    }
+    http_response_printf(resp, "\"");
+}
+
+static void json_error(http_response_t* resp, int status, const char* message) {
+    resp->status = status;
+    resp->len = 0;
+    http_response_printf(resp, "{\"error\":\"%s\"}", message);
+}
+
+// Buscar el canal de un fingerprint de landmarks y añadir el resultado
+static void match_fingerprint(worker_t* w, const audimeter_record_header_t* rec,
+                              const uint8_t* record, http_response_t* resp) {
+    audimeter_fingerprint_t fp;
+    size_t fp_offset = sizeof(audimeter_record_header_t);
+    if (rec->record_size < fp_offset + sizeof(fp)) {
+        http_response_printf(resp, "\"status\":\"malformed\"");
+        return;
+    }
+    memcpy(&fp, record + fp_offset, sizeof(fp));
+    if (rec->encoding != AUDIMETER_FEATURES_LANDMARKS) {
+        http_response_printf(resp, "\"status\":\"unsupported_encoding\"");
+        return;
+    }
+    if (fp.hop_length != dsp_params.hop_length || fp.fft_size != dsp_params.fft_size) {
+        http_response_printf(resp, "\"status\":\"parameter_mismatch\"");
+        return;
+    }
+    size_t available = (rec->record_size - fp_offset - sizeof(fp)) / sizeof(landmark_t);
+    size_t n = fp.count;
+    if (n > available) n = available;
+    if (n > QUERY_MAX_LANDMARKS) n = QUERY_MAX_LANDMARKS;
+    memcpy(w->query, record + fp_offset + sizeof(fp), n * sizeof(landmark_t));
+
+    // Buscar sólo alrededor del intervalo que dice el dispositivo, con margen
+    // para el error de su reloj y el retardo de emisión. Si cae fuera de la
+    // retención (reloj sin sincronizar) se busca en toda ella.
+    int64_t device_start_us = (int64_t)rec->timestamp - (int64_t)fp.duration * 1000000;
+    int64_t now = timebase_now_tick(&timebase);
+    int64_t oldest = (now > retention_ticks) ? now - retention_ticks : 0;
+    int64_t start_tick = timebase_us_to_tick(&timebase, device_start_us);
+    int64_t min_tick = start_tick - slack_ticks;
+    int64_t max_tick = start_tick + timebase_ticks(&timebase, fp.duration) + slack_ticks;
+    if (min_tick < oldest) min_tick = oldest;
+    if (max_tick > now) max_tick = now;
+    if (min_tick > max_tick) {
+        min_tick = oldest;
+        max_tick = now;
+    }
+    ref_match_t match;
+    ref_index_match(ref_index, w->matcher, w->query, n, (uint32_t)min_tick, (uint32_t)max_tick, &match);
+    atomic_fetch_add_explicit(&w->fingerprints, 1, memory_order_relaxed);
+
+    if (!match.found || match.votes < config.min_votes) {
+        http_response_printf(resp, "\"status\":\"no_match\",\"votes\":%u", match.votes);
+        return;
+    }
+    atomic_fetch_add_explicit(&w->matched, 1, memory_order_relaxed);
+
+    // El timestamp del dispositivo corresponde al final de la ventana
+    int64_t reference_us = timebase_tick_to_us(&timebase, match.tick);
+    http_response_printf(resp, "\"status\":\"match\",\"channel\":");
+    json_string(resp, ingest_channel_name(match.channel), CHANNEL_NAME_LEN);
+    http_response_printf(resp, ",\"votes\":%u,\"runner_up\":%u,\"reference_timestamp\":%lld,"
+                         "\"delay_ms\":%lld",
+                         match.votes, match.runner_up, (long long)reference_us,
+                         (long long)((device_start_us - reference_us) / 1000));
+}
+
+// POST de un lote binario: un resultado por registro de fingerprint
+static void handle_batch(const http_request_t* req, worker_t* w, http_response_t* resp) {
+    if (strncmp(req->content_type, AUDIMETER_WIRE_CONTENT_TYPE,
+                strlen(AUDIMETER_WIRE_CONTENT_TYPE)) != 0) {
+        json_error(resp, 415, "se espera " AUDIMETER_WIRE_CONTENT_TYPE);
+        return;
+    }
+    audimeter_batch_header_t batch;
+    if (req->body_len < sizeof(batch)) {
+        json_error(resp, 400, "lote truncado");
+        return;
+    }
+    memcpy(&batch, req->body, sizeof(batch));
+    if (batch.magic != AUDIMETER_WIRE_MAGIC || batch.version != AUDIMETER_WIRE_VERSION ||
+        batch.header_size < sizeof(batch) || batch.header_size > req->body_len) {
+        json_error(resp, 400, "cabecera de lote no válida");
+        return;
+    }
+    if (batch.sample_rate != dsp_params.sample_rate) {
+        json_error(resp, 422, "frecuencia de muestreo distinta de la del índice");
+        return;
+    }
+    atomic_fetch_add_explicit(&w->requests, 1, memory_order_relaxed);
+
+    http_response_printf(resp, "{\"device_id\":");
+    json_string(resp, batch.device_id, AUDIMETER_DEVICE_ID_LEN);
+    http_response_printf(resp, ",\"results\":[");
+
+    size_t pos = batch.header_size;
+    bool first = true;
+    for (uint16_t i = 0; i < batch.record_count; i++) {
+        audimeter_record_header_t rec;
+        if (pos + sizeof(rec) > req->body_len) {
+            break;
+        }
+        memcpy(&rec, req->body + pos, sizeof(rec));
+        if (rec.record_size < sizeof(rec) || pos + rec.record_size > req->body_len) {
+            break;
+        }
+        if (rec.type == AUDIMETER_RECORD_FINGERPRINT) {
+            http_response_printf(resp, "%s{\"timestamp\":%llu,\"hash\":\"", first ? "" : ",",
+                                 (unsigned long long)rec.timestamp);
+            for (int k = 0; k < 16; k++) {
+                http_response_printf(resp, "%02x", rec.hash[k]);
+            }
+            http_response_printf(resp, "\",");
+            match_fingerprint(w, &rec, req->body + pos, resp);
+            http_response_printf(resp, "}");
+            first = false;
+        }
+        pos += rec.record_size;
+    }
+    http_response_printf(resp, "]}");
+}
+
+static void handle_stats(http_response_t* resp) {
+    ref_index_stats_t stats;
+    ref_index_stats(ref_index, &stats);
+    uint64_t requests = 0, fingerprints = 0, matched = 0;
+    for (int i = 0; i < n_workers; i++) {
+        requests += atomic_load_explicit(&workers[i].requests, memory_order_relaxed);
+        fingerprints += atomic_load_explicit(&workers[i].fingerprints, memory_order_relaxed);
+        matched += atomic_load_explicit(&workers[i].matched, memory_order_relaxed);
+    }
+    http_response_printf(resp, "{\"tick\":%u,\"index\":{\"postings\":%llu,\"inserted\":%llu,"
+                         "\"bytes\":%zu},\"queries\":{\"requests\":%llu,\"fingerprints\":%llu,"
+                         "\"matched\":%llu},\"channels\":[",
+                         timebase_now_tick(&timebase), (unsigned long long)stats.postings,
+                         (unsigned long long)stats.inserted, stats.bytes,
+                         (unsigned long long)requests, (unsigned long long)fingerprints,
+                         (unsigned long long)matched);
+    for (int c = 0; c < ingest_channel_count(); c++) {
+        channel_stats_t ch;
+        ingest_channel_stats(c, &ch);
+        http_response_printf(resp, "%s{\"name\":", c ? "," : "");
+        json_string(resp, ingest_channel_name(c), CHANNEL_NAME_LEN);
+        http_response_printf(resp, ",\"running\":%s,\"samples\":%llu,\"landmarks\":%llu,"
+                             "\"restarts\":%u}",
+                             ch.running ? "true" : "false", (unsigned long long)ch.samples,
+                             (unsigned long long)ch.landmarks, ch.restarts);
+    }
+    http_response_printf(resp, "]}");
+}
+
+static void handle_request(const http_request_t* req, http_response_t* resp, void* worker) {
+    bool post = !strcmp(req->method, "POST");
+    bool get = !strcmp(req->method, "GET");
+    if (!strcmp(req->path, "/api/match") || !strcmp(req->path, "/api/fingerprint")) {
+        if (!post) {
+            json_error(resp, 405, "se espera POST");
+            return;
+        }
+        handle_batch(req, worker, resp);
+    } else if (!strcmp(req->path, "/api/stats")) {
+        if (!get) {
+            json_error(resp, 405, "se espera GET");
+            return;
+        }
+        handle_stats(resp);
+    } else if (!strcmp(req->path, "/health")) {
+        http_response_printf(resp, "{\"status\":\"ok\"}");
+    } else {
+        json_error(resp, 404, "ruta desconocida");
+    }
+}
+
+// ================================
+// ARRANQUE
+// ================================
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Uso: %s -c canales.conf [opciones]\n"
+            "  -p PUERTO      Puerto HTTP (%u)\n"
+            "  -w HILOS       Workers HTTP (uno por core)\n"
+            "  -s SHARDS      Shards del índice, potencia de 2 (4 por core)\n"
+            "  -q NIVEL       Preset de calidad de los dispositivos, 1-%d (%u)\n"
+            "  -H SALTO       hop_length de los dispositivos (%u)\n"
+            "  -f HZ / -F HZ  min_freq / max_freq de los dispositivos (%.0f / %.0f)\n"
+            "  -r SEGUNDOS    Retención del índice (%u)\n"
+            "  -b SEGUNDOS    Cubetas de expulsión (%u)\n"
+            "  -D SEGUNDOS    Margen de búsqueda alrededor del timestamp del dispositivo (%u)\n"
+            "  -m VOTOS       Votos mínimos para aceptar un canal (%u)\n",
+            prog, config.port, DSP_PRESET_COUNT, config.quality_level, config.hop_length,
+            config.min_freq, config.max_freq, config.retention, config.bucket_seconds,
+            config.window_slack, config.min_votes);
+}
+
+int main(int argc, char** argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "c:p:w:s:q:H:f:F:r:b:D:m:h")) != -1) {
+        switch (opt) {
+            case 'c': config.channels_path = optarg; break;
+            case 'p': config.port = atoi(optarg); break;
+            case 'w': config.workers = atoi(optarg); break;
+            case 's': config.shards = atoi(optarg); break;
+            case 'q': config.quality_level = atoi(optarg); break;
+            case 'H': config.hop_length = atoi(optarg); break;
+            case 'f': config.min_freq = atof(optarg); break;
+            case 'F': config.max_freq = atof(optarg); break;
+            case 'r': config.retention = atoi(optarg); break;
+            case 'b': config.bucket_seconds = atoi(optarg); break;
+            case 'D': config.window_slack = atoi(optarg); break;
+            case 'm': config.min_votes = atoi(optarg); break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    // Todos los niveles comparten el análisis de landmarks (dsp_preset_analysis)
+    const dsp_preset_t* preset = dsp_preset_analysis(config.quality_level, FINGERPRINT_MODE_LANDMARKS);
+    if (config.channels_path == NULL || preset == NULL || config.hop_length == 0 ||
+        config.bucket_seconds == 0 || config.retention < config.bucket_seconds) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    n_workers = config.workers > 0 ? config.workers : cores;
+    int shards = 1;
+    while (shards < (config.shards > 0 ? config.shards : 4 * cores) && shards < REF_INDEX_MAX_SHARDS) {
+        shards <<= 1;
+    }
+
+    dsp_params = (dsp_params_t){
+        .sample_rate = preset->sample_rate,
+        .fft_size = preset->fft_size,
+        .hop_length = config.hop_length,
+        .n_mels = preset->n_mels,
+        .n_mfcc = preset->n_mfcc,
+        .min_freq = config.min_freq,
+        .max_freq = config.max_freq,
+        .mode = preset->mode,
+    };
+    timebase_init(&timebase, dsp_params.sample_rate, dsp_params.hop_length);
+    retention_ticks = timebase_ticks(&timebase, config.retention);
+    slack_ticks = timebase_ticks(&timebase, config.window_slack);
+
+    // Una cubeta más que la retención: la que se está llenando
+    ref_index_config_t index_config = {
+        .n_shards = shards,
+        .bucket_ticks = timebase_ticks(&timebase, config.bucket_seconds),
+        .n_buckets = (config.retention + config.bucket_seconds - 1) / config.bucket_seconds + 1,
+    };
+    ref_index = ref_index_create(&index_config);
+    if (ref_index == NULL) {
+        SRV_LOGE(TAG, "Configuración de índice no válida (%d shards, %u cubetas)",
+                 shards, index_config.n_buckets);
+        return 1;
+    }
+
+    static channel_config_t channels[MAX_CHANNELS];
+    int n_channels = channels_load(config.channels_path, channels, MAX_CHANNELS);
+    if (n_channels <= 0) {
+        SRV_LOGE(TAG, "Sin canales de referencia en %s", config.channels_path);
+        return 1;
+    }
+    SRV_LOGI(TAG, "Índice: calidad %u (%u Hz, FFT %u, salto %u), %d shards, %u s de retención",
+             config.quality_level, dsp_params.sample_rate, dsp_params.fft_size,
+             dsp_params.hop_length, shards, config.retention);
+    if (!ingest_start(ref_index, &dsp_params, &timebase, channels, n_channels)) {
+        return 1;
+    }
+
+    workers = calloc(n_workers, sizeof(worker_t));
+    if (workers == NULL) {
+        return 1;
+    }
+    return http_serve(config.port, n_workers, handle_request, worker_init, NULL) ? 0 : 1;
+}
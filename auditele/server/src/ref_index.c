@@ -0,0 +1,459 @@
+/*
+ * Índice invertido de landmarks de los canales de referencia
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "ref_index.h"
+
+#define BUCKET_EMPTY        UINT32_MAX
+#define CHAIN_END           UINT32_MAX
+#define SHARD_MIN_SLOTS     1024
+#define BUCKET_MIN_POSTINGS 4096
+
+// Referencia a una entrada: cubeta en los 6 bits altos (REF_INDEX_MAX_BUCKETS)
+// e índice dentro de ella en el resto. CHAIN_END nunca es una entrada válida.
+#define REF_ENTRY_BITS      26
+#define REF_MAKE(b, i)      (((uint32_t)(b) << REF_ENTRY_BITS) | (i))
+#define REF_BUCKET(ref)     ((ref) >> REF_ENTRY_BITS)
+#define REF_ENTRY(ref)      ((ref) & ((1u << REF_ENTRY_BITS) - 1))
+#define BUCKET_MAX_POSTINGS ((1u << REF_ENTRY_BITS) - 1)
+
+#define VOTE_SLOTS          (1u << 15)   // Pares (canal, desfase) distintos por consulta
+#define VOTE_MAX_USED       (VOTE_SLOTS / 2)
+#define MATCH_MAX_QUERY     65536        // Landmarks por consulta
+#define INSERT_CHUNK        256          // Landmarks agrupados por shard en cada pasada
+
+typedef struct {
+    uint32_t hash;
+    uint32_t tick;
+    uint32_t next;             // Siguiente entrada del slot, con tick menor o igual
+    uint16_t channel;
+    uint16_t reserved;
+} ref_posting_t;
+
+// Memoria de las entradas de bucket_ticks ticks consecutivos. Las cadenas
+// de hash son del shard y cruzan cubetas: una consulta hace una sola
+// búsqueda por landmark sea cual sea la retención.
+typedef struct {
+    uint32_t id;               // tick / bucket_ticks, BUCKET_EMPTY si no se usó
+    ref_posting_t* postings;
+    uint32_t count;
+    uint32_t capacity;
+} ref_bucket_t;
+
+typedef struct {
+    pthread_rwlock_t lock;
+    uint32_t* heads;           // Entrada más reciente de cada slot de hash
+    uint32_t n_slots;          // Potencia de 2
+    uint64_t live;             // Entradas guardadas en las cubetas
+    uint32_t newest_id;        // Cubeta más reciente insertada
+    uint32_t oldest_id;        // Cubetas anteriores ya fuera de la retención
+    ref_bucket_t buckets[REF_INDEX_MAX_BUCKETS];
+    uint64_t inserted;
+} __attribute__((aligned(64))) ref_shard_t;
+
+struct ref_index {
+    ref_index_config_t config;
+    uint8_t shard_shift;       // 32 - log2(n_shards)
+    ref_shard_t* shards;
+};
+
+// Los hashes (f1 | f2 | dt) no se reparten uniformemente: mezclarlos antes
+// de elegir shard y slot
+static inline uint32_t mix_hash(uint32_t h) {
+    h ^= h >> 16;
+    h *= 0x7feb352d;
+    h ^= h >> 15;
+    h *= 0x846ca68b;
+    h ^= h >> 16;
+    return h;
+}
+
+static inline uint32_t shard_of(const ref_index_t* index, uint32_t mixed) {
+    return index->shard_shift < 32 ? mixed >> index->shard_shift : 0;
+}
+
+ref_index_t* ref_index_create(const ref_index_config_t* config) {
+    if (config->n_shards == 0 || config->n_shards > REF_INDEX_MAX_SHARDS ||
+        (config->n_shards & (config->n_shards - 1)) || config->bucket_ticks == 0 ||
+        config->n_buckets < 2 || config->n_buckets > REF_INDEX_MAX_BUCKETS) {
+        return NULL;
+    }
+    ref_index_t* index = calloc(1, sizeof(*index));
+    if (index == NULL) {
+        return NULL;
+    }
+    index->config = *config;
+    index->shard_shift = 32;
+    for (uint16_t n = config->n_shards; n > 1; n >>= 1) {
+        index->shard_shift--;
+    }
+    index->shards = aligned_alloc(64, config->n_shards * sizeof(ref_shard_t));
+    if (index->shards == NULL) {
+        free(index);
+        return NULL;
+    }
+    memset(index->shards, 0, config->n_shards * sizeof(ref_shard_t));
+
+    // Las consultas son muchas más que las inserciones: sin preferencia por
+    // el escritor la ingesta podría esperar indefinidamente
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    for (uint16_t s = 0; s < config->n_shards; s++) {
+        pthread_rwlock_init(&index->shards[s].lock, &attr);
+        for (int b = 0; b < REF_INDEX_MAX_BUCKETS; b++) {
+            index->shards[s].buckets[b].id = BUCKET_EMPTY;
+        }
+    }
+    pthread_rwlockattr_destroy(&attr);
+    return index;
+}
+
+void ref_index_destroy(ref_index_t* index) {
+    if (index == NULL) {
+        return;
+    }
+    for (uint16_t s = 0; s < index->config.n_shards; s++) {
+        for (int b = 0; b < REF_INDEX_MAX_BUCKETS; b++) {
+            free(index->shards[s].buckets[b].postings);
+        }
+        free(index->shards[s].heads);
+        pthread_rwlock_destroy(&index->shards[s].lock);
+    }
+    free(index->shards);
+    free(index);
+}
+
+// Entrada a la que lleva `ref` desde una de la cubeta `from_id` (UINT32_MAX
+// desde la cabeza), o NULL si la cadena termina. Las cadenas bajan en tick y
+// por tanto en cubeta, y sólo enlazan cubetas vivas a la vez: un enlace a
+// una cubeta más nueva es de antes de que se reciclara, y todo lo que
+// seguía ya expiró.
+static inline ref_posting_t* chain_follow(ref_shard_t* shard, uint32_t ref, uint32_t from_id) {
+    if (ref == CHAIN_END) {
+        return NULL;
+    }
+    ref_bucket_t* bucket = &shard->buckets[REF_BUCKET(ref)];
+    if (bucket->id == BUCKET_EMPTY || bucket->id > from_id || bucket->id < shard->oldest_id ||
+        REF_ENTRY(ref) >= bucket->count) {
+        return NULL;
+    }
+    return &bucket->postings[REF_ENTRY(ref)];
+}
+
+static inline ref_posting_t* ref_posting(ref_shard_t* shard, uint32_t ref) {
+    return &shard->buckets[REF_BUCKET(ref)].postings[REF_ENTRY(ref)];
+}
+
+// Pasar a `n_slots` slots. Al duplicar, cada cadena se reparte entre dos
+// slots nuevos sin perder el orden; los restos expirados se cortan.
+static bool shard_rehash(ref_shard_t* shard, uint32_t n_slots) {
+    uint32_t* heads = malloc(n_slots * sizeof(uint32_t));
+    uint32_t* tails = malloc(n_slots * sizeof(uint32_t));
+    if (heads == NULL || tails == NULL) {
+        free(heads);
+        free(tails);
+        return false;
+    }
+    memset(heads, 0xFF, n_slots * sizeof(uint32_t));
+    for (uint32_t s = 0; s < shard->n_slots; s++) {
+        uint32_t ref = shard->heads[s];
+        uint32_t from = UINT32_MAX;
+        ref_posting_t* p;
+        while ((p = chain_follow(shard, ref, from)) != NULL) {
+            uint32_t next = p->next;
+            uint32_t slot = mix_hash(p->hash) & (n_slots - 1);
+            p->next = CHAIN_END;
+            if (heads[slot] == CHAIN_END) {
+                heads[slot] = ref;
+            } else {
+                ref_posting(shard, tails[slot])->next = ref;
+            }
+            tails[slot] = ref;
+            from = shard->buckets[REF_BUCKET(ref)].id;
+            ref = next;
+        }
+    }
+    free(tails);
+    free(shard->heads);
+    shard->heads = heads;
+    shard->n_slots = n_slots;
+    return true;
+}
+
+// Vaciar una cubeta para reutilizarla con otro intervalo; conserva la memoria.
+// Las cabezas que apuntaban a ella se borran; los enlaces desde cubetas más
+// nuevas los descarta chain_follow.
+static void bucket_recycle(ref_shard_t* shard, uint32_t b, uint32_t id) {
+    ref_bucket_t* bucket = &shard->buckets[b];
+    if (bucket->count > 0) {
+        for (uint32_t s = 0; s < shard->n_slots; s++) {
+            if (shard->heads[s] != CHAIN_END && REF_BUCKET(shard->heads[s]) == b) {
+                shard->heads[s] = CHAIN_END;
+            }
+        }
+    }
+    shard->live -= bucket->count;
+    bucket->id = id;
+    bucket->count = 0;
+}
+
+static bool shard_add(ref_shard_t* shard, uint32_t b, uint32_t mixed, uint32_t hash,
+                      uint16_t channel, uint32_t tick) {
+    if (shard->heads == NULL && !shard_rehash(shard, SHARD_MIN_SLOTS)) {
+        return false;
+    }
+    ref_bucket_t* bucket = &shard->buckets[b];
+    if (bucket->count == bucket->capacity) {
+        if (bucket->capacity == BUCKET_MAX_POSTINGS) {
+            return false;
+        }
+        uint32_t capacity = bucket->capacity ? bucket->capacity * 2 : BUCKET_MIN_POSTINGS;
+        if (capacity > BUCKET_MAX_POSTINGS) {
+            capacity = BUCKET_MAX_POSTINGS;
+        }
+        ref_posting_t* postings = realloc(bucket->postings, capacity * sizeof(ref_posting_t));
+        if (postings == NULL) {
+            return false;
+        }
+        bucket->postings = postings;
+        bucket->capacity = capacity;
+    }
+    uint32_t ref = REF_MAKE(b, bucket->count);
+    ref_posting_t* p = &bucket->postings[bucket->count++];
+    p->hash = hash;
+    p->tick = tick;
+    p->channel = channel;
+
+    // Cadena ordenada por tick descendente. La ingesta en vivo llega en
+    // orden y enlaza en cabeza; sólo un landmark atrasado recorre la cadena.
+    uint32_t* link = &shard->heads[mixed & (shard->n_slots - 1)];
+    uint32_t from = UINT32_MAX;
+    ref_posting_t* q;
+    while ((q = chain_follow(shard, *link, from)) != NULL && q->tick > tick) {
+        from = shard->buckets[REF_BUCKET(*link)].id;
+        link = &q->next;
+    }
+    p->next = q ? *link : CHAIN_END;
+    *link = ref;
+    shard->live++;
+
+    // Cadenas de ~2 entradas de media
+    if (shard->live > 2 * (uint64_t)shard->n_slots) {
+        shard_rehash(shard, shard->n_slots * 2);
+    }
+    return true;
+}
+
+void ref_index_insert(ref_index_t* index, uint16_t channel, uint32_t tick0,
+                      const landmark_t* landmarks, size_t n) {
+    const ref_index_config_t* config = &index->config;
+    uint16_t n_shards = config->n_shards;
+    uint32_t shard_start[REF_INDEX_MAX_SHARDS + 1];
+    uint32_t fill[REF_INDEX_MAX_SHARDS];
+    uint32_t mixed[INSERT_CHUNK];
+    uint16_t order[INSERT_CHUNK];
+
+    // Agrupar por shard como en ref_index_match: un cerrojo de escritura por
+    // shard y frame, no uno por landmark
+    for (size_t base = 0; base < n; base += INSERT_CHUNK) {
+        const landmark_t* chunk = &landmarks[base];
+        size_t count = (n - base < INSERT_CHUNK) ? n - base : INSERT_CHUNK;
+        memset(shard_start, 0, (n_shards + 1) * sizeof(uint32_t));
+        for (size_t i = 0; i < count; i++) {
+            mixed[i] = mix_hash(chunk[i].hash);
+            shard_start[shard_of(index, mixed[i]) + 1]++;
+        }
+        for (uint16_t s = 0; s < n_shards; s++) {
+            shard_start[s + 1] += shard_start[s];
+        }
+        memcpy(fill, shard_start, n_shards * sizeof(uint32_t));
+        for (size_t i = 0; i < count; i++) {
+            order[fill[shard_of(index, mixed[i])]++] = i;
+        }
+
+        for (uint16_t s = 0; s < n_shards; s++) {
+            if (shard_start[s] == shard_start[s + 1]) {
+                continue;
+            }
+            ref_shard_t* shard = &index->shards[s];
+            pthread_rwlock_wrlock(&shard->lock);
+            for (uint32_t k = shard_start[s]; k < shard_start[s + 1]; k++) {
+                const landmark_t* lm = &chunk[order[k]];
+                uint32_t tick = tick0 + lm->offset;
+                uint32_t id = tick / config->bucket_ticks;
+                uint32_t b = id % config->n_buckets;
+                ref_bucket_t* bucket = &shard->buckets[b];
+                if (id > shard->newest_id) {
+                    shard->newest_id = id;
+                    shard->oldest_id = id >= config->n_buckets ? id - config->n_buckets + 1 : 0;
+                }
+                if (bucket->id == BUCKET_EMPTY || bucket->id < id) {
+                    bucket_recycle(shard, b, id);
+                }
+                // Un landmark más antiguo que la cubeta ya no cabe en la retención
+                if (bucket->id == id && id >= shard->oldest_id &&
+                    shard_add(shard, b, mixed[order[k]], lm->hash, channel, tick)) {
+                    shard->inserted++;
+                }
+            }
+            pthread_rwlock_unlock(&shard->lock);
+        }
+    }
+}
+
+void ref_index_stats(ref_index_t* index, ref_index_stats_t* stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->bytes = sizeof(*index) + index->config.n_shards * sizeof(ref_shard_t);
+    for (uint16_t s = 0; s < index->config.n_shards; s++) {
+        ref_shard_t* shard = &index->shards[s];
+        pthread_rwlock_rdlock(&shard->lock);
+        stats->inserted += shard->inserted;
+        stats->postings += shard->live;
+        stats->bytes += shard->n_slots * sizeof(uint32_t);
+        for (int b = 0; b < index->config.n_buckets; b++) {
+            stats->bytes += shard->buckets[b].capacity * sizeof(ref_posting_t);
+        }
+        pthread_rwlock_unlock(&shard->lock);
+    }
+}
+
+// ================================
+// VOTACIÓN
+// ================================
+
+typedef struct {
+    int64_t delta;
+    uint32_t stamp;            // Consulta que usó el slot por última vez
+    uint32_t votes;
+    uint16_t channel;
+} vote_t;
+
+struct ref_matcher {
+    uint32_t stamp;
+    uint32_t n_used;
+    uint32_t used[VOTE_MAX_USED];
+    vote_t votes[VOTE_SLOTS];
+    // Consulta ordenada por shard
+    uint32_t shard_start[REF_INDEX_MAX_SHARDS + 1];
+    uint32_t order[MATCH_MAX_QUERY];
+    uint32_t mixed[MATCH_MAX_QUERY];
+};
+
+ref_matcher_t* ref_matcher_create(void) {
+    return calloc(1, sizeof(ref_matcher_t));
+}
+
+void ref_matcher_destroy(ref_matcher_t* matcher) {
+    free(matcher);
+}
+
+static inline void vote(ref_matcher_t* m, uint16_t channel, int64_t delta) {
+    uint32_t h = mix_hash((uint32_t)delta ^ ((uint32_t)(delta >> 32) * 0x9e3779b9u) ^
+                          ((uint32_t)channel << 20));
+    for (uint32_t probe = 0; probe < VOTE_SLOTS; probe++) {
+        vote_t* v = &m->votes[(h + probe) & (VOTE_SLOTS - 1)];
+        if (v->stamp != m->stamp) {
+            // Tabla a media carga: los pares nuevos ya no pueden ganar
+            if (m->n_used == VOTE_MAX_USED) {
+                return;
+            }
+            v->stamp = m->stamp;
+            v->delta = delta;
+            v->channel = channel;
+            v->votes = 1;
+            m->used[m->n_used++] = (h + probe) & (VOTE_SLOTS - 1);
+            return;
+        }
+        if (v->delta == delta && v->channel == channel) {
+            v->votes++;
+            return;
+        }
+    }
+}
+
+void ref_index_match(ref_index_t* index, ref_matcher_t* m, const landmark_t* query,
+                     size_t n, uint32_t min_tick, uint32_t max_tick, ref_match_t* result) {
+    const ref_index_config_t* config = &index->config;
+    uint16_t n_shards = config->n_shards;
+    memset(result, 0, sizeof(*result));
+    if (n > MATCH_MAX_QUERY) {
+        n = MATCH_MAX_QUERY;
+    }
+
+    if (++m->stamp == 0) {
+        memset(m->votes, 0, sizeof(m->votes));
+        m->stamp = 1;
+    }
+    m->n_used = 0;
+
+    // Ordenar la consulta por shard: un solo cerrojo por shard y consulta
+    memset(m->shard_start, 0, (n_shards + 1) * sizeof(uint32_t));
+    for (size_t i = 0; i < n; i++) {
+        m->mixed[i] = mix_hash(query[i].hash);
+        m->shard_start[shard_of(index, m->mixed[i]) + 1]++;
+    }
+    for (uint16_t s = 0; s < n_shards; s++) {
+        m->shard_start[s + 1] += m->shard_start[s];
+    }
+    uint32_t fill[REF_INDEX_MAX_SHARDS];
+    memcpy(fill, m->shard_start, n_shards * sizeof(uint32_t));
+    for (size_t i = 0; i < n; i++) {
+        m->order[fill[shard_of(index, m->mixed[i])]++] = i;
+    }
+
+    // Una búsqueda por landmark: la cadena del slot baja en tick desde la
+    // entrada más reciente y se corta al salir de la ventana
+    for (uint16_t s = 0; s < n_shards; s++) {
+        if (m->shard_start[s] == m->shard_start[s + 1]) {
+            continue;
+        }
+        ref_shard_t* shard = &index->shards[s];
+        pthread_rwlock_rdlock(&shard->lock);
+        for (uint32_t k = m->shard_start[s]; k < m->shard_start[s + 1] && shard->heads; k++) {
+            const landmark_t* q = &query[m->order[k]];
+            uint32_t ref = shard->heads[m->mixed[m->order[k]] & (shard->n_slots - 1)];
+            uint32_t from = UINT32_MAX;
+            const ref_posting_t* p;
+            while ((p = chain_follow(shard, ref, from)) != NULL && p->tick >= min_tick) {
+                if (p->hash == q->hash && p->tick <= max_tick) {
+                    vote(m, p->channel, (int64_t)p->tick - q->offset);
+                    result->hits++;
+                }
+                from = shard->buckets[REF_BUCKET(ref)].id;
+                ref = p->next;
+            }
+        }
+        pthread_rwlock_unlock(&shard->lock);
+    }
+
+    // El ganador y el mejor rival; los desfases vecinos del ganador en el
+    // mismo canal son el mismo contenido con el salto desalineado
+    const vote_t* best = NULL;
+    for (uint32_t i = 0; i < m->n_used; i++) {
+        const vote_t* v = &m->votes[m->used[i]];
+        if (best == NULL || v->votes > best->votes) {
+            best = v;
+        }
+    }
+    if (best == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < m->n_used; i++) {
+        const vote_t* v = &m->votes[m->used[i]];
+        if (v->channel == best->channel && llabs(v->delta - best->delta) <= 1) {
+            continue;
+        }
+        if (v->votes > result->runner_up) {
+            result->runner_up = v->votes;
+        }
+    }
+    result->found = true;
+    result->channel = best->channel;
+    result->tick = best->delta;
+    result->votes = best->votes;
+}
@@ -0,0 +1,75 @@
+/*
+ * Índice invertido de landmarks de los canales de referencia
+ *
+ * hash -> (canal, tick). Un tick es un salto STFT (hop_length muestras)
+ * desde el arranque del servidor, común a todos los canales. El índice se
+ * reparte en shards por hash, cada uno con su cerrojo lector/escritor,
+ * para que ingesta y consultas de distintos cores no compitan. Cada shard
+ * tiene una sola tabla hash cuyas cadenas van de la entrada más reciente a
+ * la más antigua, así que un landmark se resuelve con una búsqueda. Las
+ * entradas se guardan en cubetas de tiempo: expulsar lo antiguo es
+ * reutilizar la cubeta más vieja, y los enlaces que quedan apuntando a
+ * ella se descartan al recorrerlos.
+ */
+
+#ifndef REF_INDEX_H
+#define REF_INDEX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "audio_dsp.h"
+
+#define REF_INDEX_MAX_SHARDS   256
+#define REF_INDEX_MAX_BUCKETS  64
+
+typedef struct {
+    uint16_t n_shards;         // Potencia de 2
+    uint32_t bucket_ticks;     // Ticks cubiertos por cada cubeta
+    uint16_t n_buckets;        // Cubetas vivas por shard (retención = n_buckets * bucket_ticks)
+} ref_index_config_t;
+
+typedef struct ref_index ref_index_t;
+
+ref_index_t* ref_index_create(const ref_index_config_t* config);
+void ref_index_destroy(ref_index_t* index);
+
+// Añadir los landmarks de un canal; el tick de cada uno es tick0 + offset
+void ref_index_insert(ref_index_t* index, uint16_t channel, uint32_t tick0,
+                      const landmark_t* landmarks, size_t n);
+
+typedef struct {
+    uint64_t postings;         // Entradas vivas
+    uint64_t inserted;         // Entradas añadidas desde el arranque
+    size_t bytes;              // Memoria reservada
+} ref_index_stats_t;
+
+void ref_index_stats(ref_index_t* index, ref_index_stats_t* stats);
+
+// ================================
+// VOTACIÓN
+// ================================
+
+// Resultado de una consulta: el par (canal, desfase) con más coincidencias.
+// `tick` es el tick de referencia que corresponde al frame 0 de la consulta.
+typedef struct {
+    bool found;
+    uint16_t channel;
+    int64_t tick;
+    uint32_t votes;
+    uint32_t runner_up;        // Votos del mejor candidato de otro canal o desfase
+    uint32_t hits;             // Entradas del índice recorridas
+} ref_match_t;
+
+// Memoria de trabajo de una consulta; una por hilo
+typedef struct ref_matcher ref_matcher_t;
+
+ref_matcher_t* ref_matcher_create(void);
+void ref_matcher_destroy(ref_matcher_t* matcher);
+
+// Histograma de desfases (tick de referencia - offset de la consulta) por
+// canal. Sólo cuenta entradas con tick en [min_tick, max_tick].
+void ref_index_match(ref_index_t* index, ref_matcher_t* matcher, const landmark_t* query,
+                     size_t n, uint32_t min_tick, uint32_t max_tick, ref_match_t* result);
+
+#endif // REF_INDEX_H